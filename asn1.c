@@ -0,0 +1,637 @@
+/*!
+	\file
+	\brief ASN.1 (DER) values of TLV tags
+
+	OBJECT IDENTIFIER is decoded by arcs (base 128, bit 7 set on all but
+	the last byte of arc). Eight bytes are tested at once: when none of
+	them has bit 7 set they are eight arcs, otherwise position of the
+	first byte ending an arc gives length of the arc directly.
+
+	Algorithm identifiers are recognized without decoding: DER bytes of
+	OID are hashed (asn1_hash) to slot of perfect hash table and compared
+	with the only candidate. The seed was found offline by trying seeds
+	from 1 until all OIDs of asn1_algs got different slots; when the
+	table is changed the seed has to be searched again.
+
+	Times are converted to seconds since 1970 without libc: digits are
+	validated and combined to two-digit numbers eight at once, date is
+	converted to days by days-from-civil algorithm.
+
+	DER is canonicalized by moving encoded elements of SET OF, nothing is
+	re-encoded. Elements are ordered as octet strings (shorter one padded
+	with zeros), all SETs are treated as SET OF (for SET of distinct tags
+	it gives the same order except of mixing primitive and constructed
+	forms). Nested SETs are sorted first, as their order changes the
+	bytes of enclosing SET. Verification is one pass: each element of SET
+	is compared only with the previous one.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include "asn1.h"
+
+#define ASN1_SEED   1901
+#define ASN1_SLOTS  7        /* log2 of number of slots */
+#define ASN1_K      0x9E3779B97F4A7C15ull
+#define ASN1_HI     0x8080808080808080ull
+
+/*!
+    \brief load 8 bytes as little endian number
+*/
+static uint64_t asn1_ld64(const uchar *b)
+{
+  uint64_t w;
+  memcpy(&w,b,8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  w=__builtin_bswap64(w);
+#endif
+  return w;
+}
+
+/*!
+    \brief decode OBJECT IDENTIFIER
+    \param v value of OID tag
+    \param l value length
+    \param arcs output arcs
+    \param n size of arcs table
+    \return negative - failure (-EINVAL wrong coding or arc over 32 bits, -ENOSPC arcs table too short),
+            number of arcs
+*/
+int asn1_oid(const uchar *v, int l, uint32_t *arcs, int n)
+{
+  uint64_t w;
+  uint32_t a;
+  int i=0,k=0,e,j;
+
+  if (l <= 0 || (v[l-1]&0x80) != 0) return -EINVAL;
+  while (i < l)
+  {
+    e=0;
+    if (l-i >= 8 && k > 0)
+    {
+      w=asn1_ld64(v+i);
+      if ((w&ASN1_HI) == 0)
+      {
+        /* eight one byte arcs */
+        if (n-k < 8) return -ENOSPC;
+        for (j=0; j < 8; j++) arcs[k++]=v[i+j];
+        i+=8;
+        continue;
+      }
+      /* bytes up to the first without bit 7 */
+      if ((w=~w&ASN1_HI) == 0) return -EINVAL;
+      e=__builtin_ctzll(w)>>3;
+    }
+    else
+      while ((v[i+e]&0x80) != 0) e++;
+    if (v[i] == 0x80 || e > 4 || (e == 4 && v[i] > 0x8f)) return -EINVAL;
+    for (a=0,j=0; j <= e; j++) a=(a<<7)|(v[i+j]&0x7f);
+    i+=e+1;
+    if (k == 0)
+    {
+      /* first arcs are coded together: 40*x+y */
+      if (n < 2) return -ENOSPC;
+      arcs[0] = a < 80 ? a/40 : 2;
+      arcs[1] = a-40*arcs[0];
+      k=2;
+    }
+    else
+    {
+      if (k == n) return -ENOSPC;
+      arcs[k++]=a;
+    }
+  }
+  return k;
+}
+
+/*!
+    \brief format OBJECT IDENTIFIER as dotted string
+    \param v value of OID tag
+    \param l value length
+    \param s output string
+    \param slen output string size
+    \return negative - failure (see asn1_oid, -ENOSPC string too short), string length
+*/
+int asn1_oidstr(const uchar *v, int l, char *s, int slen)
+{
+  uint32_t arcs[ASN1_MAXARCS];
+  int i,n,p=0,r;
+  if ((n=asn1_oid(v,l,arcs,ASN1_MAXARCS)) < 0) return n;
+  for (i=0; i < n; i++)
+  {
+    r=snprintf(s+p,slen-p,i ? ".%u" : "%u",arcs[i]);
+    if (r >= slen-p) return -ENOSPC;
+    p+=r;
+  }
+  return p;
+}
+
+static const struct
+{
+  uchar l;
+  char b[12];
+  const char *name;
+} asn1_algs[ASN1_ALG_MAX] = {
+  {  9,"\x2a\x86\x48\x86\xf7\x0d\x01\x01\x01","rsa" },
+  {  9,"\x2a\x86\x48\x86\xf7\x0d\x01\x01\x05","rsa-sha1" },
+  {  9,"\x2a\x86\x48\x86\xf7\x0d\x01\x01\x0b","rsa-sha256" },
+  {  9,"\x2a\x86\x48\x86\xf7\x0d\x01\x01\x0c","rsa-sha384" },
+  {  9,"\x2a\x86\x48\x86\xf7\x0d\x01\x01\x0d","rsa-sha512" },
+  {  9,"\x2a\x86\x48\x86\xf7\x0d\x01\x01\x0a","rsa-pss" },
+  {  9,"\x2a\x86\x48\x86\xf7\x0d\x01\x01\x07","rsa-oaep" },
+  {  9,"\x2a\x86\x48\x86\xf7\x0d\x01\x01\x08","mgf1" },
+  {  7,"\x2a\x86\x48\xce\x3d\x02\x01","ec" },
+  {  7,"\x2a\x86\x48\xce\x3d\x04\x01","ecdsa-sha1" },
+  {  8,"\x2a\x86\x48\xce\x3d\x04\x03\x02","ecdsa-sha256" },
+  {  8,"\x2a\x86\x48\xce\x3d\x04\x03\x03","ecdsa-sha384" },
+  {  8,"\x2a\x86\x48\xce\x3d\x04\x03\x04","ecdsa-sha512" },
+  {  8,"\x2a\x86\x48\xce\x3d\x03\x01\x07","p256" },
+  {  5,"\x2b\x81\x04\x00\x22","p384" },
+  {  5,"\x2b\x81\x04\x00\x23","p521" },
+  {  3,"\x2b\x65\x70","ed25519" },
+  {  3,"\x2b\x65\x71","ed448" },
+  {  3,"\x2b\x65\x6e","x25519" },
+  {  3,"\x2b\x65\x6f","x448" },
+  {  5,"\x2b\x0e\x03\x02\x1a","sha1" },
+  {  9,"\x60\x86\x48\x01\x65\x03\x04\x02\x01","sha256" },
+  {  9,"\x60\x86\x48\x01\x65\x03\x04\x02\x02","sha384" },
+  {  9,"\x60\x86\x48\x01\x65\x03\x04\x02\x03","sha512" },
+  {  9,"\x60\x86\x48\x01\x65\x03\x04\x02\x08","sha3-256" },
+  {  9,"\x60\x86\x48\x01\x65\x03\x04\x01\x02","aes128-cbc" },
+  {  9,"\x60\x86\x48\x01\x65\x03\x04\x01\x2a","aes256-cbc" },
+  {  9,"\x60\x86\x48\x01\x65\x03\x04\x01\x06","aes128-gcm" },
+  {  9,"\x60\x86\x48\x01\x65\x03\x04\x01\x2e","aes256-gcm" },
+  {  9,"\x60\x86\x48\x01\x65\x03\x04\x01\x05","aes128-wrap" },
+  {  9,"\x60\x86\x48\x01\x65\x03\x04\x01\x2d","aes256-wrap" },
+  {  8,"\x2a\x86\x48\x86\xf7\x0d\x03\x07","des-ede3-cbc" },
+  {  8,"\x2a\x86\x48\x86\xf7\x0d\x02\x07","hmac-sha1" },
+  {  8,"\x2a\x86\x48\x86\xf7\x0d\x02\x09","hmac-sha256" },
+  {  8,"\x2a\x86\x48\x86\xf7\x0d\x02\x0b","hmac-sha512" },
+  {  9,"\x2a\x86\x48\x86\xf7\x0d\x01\x05\x0c","pbkdf2" },
+  {  9,"\x2a\x86\x48\x86\xf7\x0d\x01\x05\x0d","pbes2" },
+  {  9,"\x2a\x86\x48\x86\xf7\x0d\x01\x03\x01","dh" },
+  {  7,"\x2a\x86\x48\xce\x38\x04\x01","dsa" },
+  {  9,"\x60\x86\x48\x01\x65\x03\x04\x03\x02","dsa-sha256" },
+  {  9,"\x2a\x86\x48\x86\xf7\x0d\x01\x07\x01","cms-data" },
+  {  9,"\x2a\x86\x48\x86\xf7\x0d\x01\x07\x02","cms-signed" },
+  {  9,"\x2a\x86\x48\x86\xf7\x0d\x01\x07\x03","cms-enveloped" },
+  {  9,"\x2a\x86\x48\x86\xf7\x0d\x01\x07\x05","cms-digested" },
+  {  9,"\x2a\x86\x48\x86\xf7\x0d\x01\x07\x06","cms-encrypted" },
+  { 11,"\x2a\x86\x48\x86\xf7\x0d\x01\x09\x10\x01\x17","cms-authenv" }
+};
+
+/* slot -> algorithm */
+static const uchar asn1_slots[1<<ASN1_SLOTS] = {
+  28, 0,36, 0, 0, 0, 0, 0, 0, 0,12,40, 0, 0, 1, 0,
+  34,39, 0, 0, 0,11,29, 0,22, 0, 6, 0,19, 0, 0, 0,
+  44, 0,17, 0, 0,35, 0, 0,46, 0,13,16, 7, 0, 0, 9,
+   0,30,45, 0, 0, 0,24, 0, 8, 0, 0, 0, 0,32, 0, 0,
+   0, 0,25, 5,26,43, 0,31, 0, 0, 0, 2, 0, 0, 0, 0,
+  10,37, 0, 0, 0,38, 0, 0, 0,27, 0, 0, 0, 0, 0,20,
+   0, 0, 0,41, 0,18, 0,23, 0, 3,15,14, 0, 0, 0, 0,
+   0, 0, 0, 0, 4, 0,42, 0, 0,21, 0,33, 0, 0, 0, 0
+};
+
+/*!
+    \brief hash DER bytes of OID (eight bytes at once)
+*/
+static uint64_t asn1_hash(const uchar *v, int l)
+{
+  uint64_t x=ASN1_SEED^((uint64_t)l*ASN1_K),w;
+  int i=0,j;
+  for (; i+8 <= l; i+=8) x=(x^asn1_ld64(v+i))*ASN1_K;
+  if (i < l)
+  {
+    for (w=0,j=l-1; j >= i; j--) w=(w<<8)|v[j];
+    x=(x^w)*ASN1_K;
+  }
+  return x^(x>>29);
+}
+
+/*!
+    \brief recognize algorithm by OBJECT IDENTIFIER
+    \param v value of OID tag (DER)
+    \param l value length
+    \return ASN1_ALG_* (ASN1_ALG_UNKNOWN if OID is not known)
+*/
+int asn1_alg(const uchar *v, int l)
+{
+  int a;
+  if (l <= 0 || l > (int)sizeof(asn1_algs[0].b)) return ASN1_ALG_UNKNOWN;
+  a=asn1_slots[asn1_hash(v,l)>>(64-ASN1_SLOTS)];
+  if (a == 0 || asn1_algs[a-1].l != l || memcmp(asn1_algs[a-1].b,v,l) != 0) return ASN1_ALG_UNKNOWN;
+  return a;
+}
+
+/*!
+    \brief recognize algorithm of AlgorithmIdentifier
+    \param v value of AlgorithmIdentifier (SEQUENCE) tag
+    \param l value length
+    \param params output parameters tag (t=0 if there are none), may be NULL
+    \return -EINVAL no OID, ASN1_ALG_*
+*/
+int asn1_algid(const uchar *v, int l, TLV *params)
+{
+  TLV t;
+  int a;
+  if (tlv_parseTLV(v,l,&t) <= 0 || t.t != ASN1_OID) return -EINVAL;
+  a=asn1_alg(t.v,t.l);
+  if (params != NULL)
+  {
+    t.v += t.l;
+    l -= t.v-v;
+    if (tlv_parseTLV(t.v,l,params) <= 0) memset(params,0,sizeof(TLV));
+  }
+  return a;
+}
+
+/*!
+    \brief get name of algorithm
+    \param alg ASN1_ALG_*
+    \return name ("unknown" for ASN1_ALG_UNKNOWN or wrong alg)
+*/
+const char *asn1_algname(int alg)
+{
+  if (alg <= 0 || alg > ASN1_ALG_MAX) return "unknown";
+  return asn1_algs[alg-1].name;
+}
+
+/*!
+    \brief convert up to 8 ASCII digits to two-digit numbers
+    \param b digits
+    \param n number of digits (even, max 8)
+    \param p output numbers in bytes 0,2,4,6 (first is in byte 0)
+    \return 0 success, -EINVAL not a digit
+*/
+static int asn1_pairs(const uchar *b, int n, uint64_t *p)
+{
+  uchar t[8]={'0','0','0','0','0','0','0','0'};
+  uint64_t w;
+  memcpy(t,b,n);
+  w=asn1_ld64(t);
+  if ((w&0xf0f0f0f0f0f0f0f0ull) != 0x3030303030303030ull ||
+      ((w+0x0606060606060606ull)&0xf0f0f0f0f0f0f0f0ull) != 0x3030303030303030ull)
+    return -EINVAL;
+  w&=0x0f0f0f0f0f0f0f0full;
+  *p=(w*10+(w>>8))&0x00ff00ff00ff00ffull;
+  return 0;
+}
+
+#define ASN1_PAIR(p,i) ((unsigned)((p)>>(16*(i)))&0xff)
+
+/*!
+    \brief get number of days since 1970-01-01 (proleptic Gregorian)
+*/
+static int64_t asn1_days(int y, unsigned m, unsigned d)
+{
+  int era;
+  unsigned yoe,doy,doe;
+  y -= m <= 2;
+  era = (y >= 0 ? y : y-399)/400;
+  yoe = y-era*400;
+  doy = (153*(m > 2 ? m-3 : m+9)+2)/5+d-1;
+  doe = yoe*365+yoe/4-yoe/100+doy;
+  return (int64_t)era*146097+doe-719468;
+}
+
+/*!
+    \brief decode UTCTime or GeneralizedTime
+    \param v value of time tag
+    \param l value length
+    \param tag ASN1_UTCTIME or ASN1_GENTIME
+    \param t output seconds since 1970-01-01 00:00:00 UTC
+    \return 0 success, -EINVAL wrong value (only "Z" time zone is accepted)
+*/
+int asn1_time(const uchar *v, int l, ushort tag, int64_t *t)
+{
+  static const uchar mdays[12]={31,29,31,30,31,30,31,31,30,31,30,31};
+  uint64_t p,q;
+  unsigned y,m,d,hh,mm,ss;
+  int i;
+
+  if (l < 13 || v[l-1] != 'Z') return -EINVAL;
+  if (tag == ASN1_UTCTIME)
+  {
+    /* YYMMDDHHMMSSZ */
+    if (l != 13 || asn1_pairs(v,8,&p) < 0 || asn1_pairs(v+8,4,&q) < 0) return -EINVAL;
+    y=ASN1_PAIR(p,0); y+= y < 50 ? 2000 : 1900;
+    m=ASN1_PAIR(p,1); d=ASN1_PAIR(p,2); hh=ASN1_PAIR(p,3);
+  }
+  else if (tag == ASN1_GENTIME)
+  {
+    /* YYYYMMDDHHMMSS[.f]Z */
+    if (l < 15 || asn1_pairs(v,8,&p) < 0 || asn1_pairs(v+8,6,&q) < 0) return -EINVAL;
+    if (l > 15)
+    {
+      if ((v[14] != '.' && v[14] != ',') || l == 16) return -EINVAL;
+      for (i=15; i < l-1; i++)
+        if (v[i] < '0' || v[i] > '9') return -EINVAL;
+    }
+    y=ASN1_PAIR(p,0)*100+ASN1_PAIR(p,1);
+    m=ASN1_PAIR(p,2); d=ASN1_PAIR(p,3); hh=ASN1_PAIR(q,0);
+    q>>=16;
+  }
+  else return -EINVAL;
+  mm=ASN1_PAIR(q,0); ss=ASN1_PAIR(q,1);
+  if (m < 1 || m > 12 || d < 1 || d > mdays[m-1] || hh > 23 || mm > 59 || ss > 59) return -EINVAL;
+  if (m == 2 && d == 29 && (y%4 != 0 || (y%100 == 0 && y%400 != 0))) return -EINVAL;
+  *t=asn1_days(y,m,d)*86400+hh*3600+mm*60+ss;
+  return 0;
+}
+
+/*!
+    \brief decode batch of time tags
+    \param tlv time tags (ASN1_UTCTIME or ASN1_GENTIME)
+    \param n number of tags
+    \param t output times (ASN1_BADTIME for wrong ones)
+    \return number of correctly decoded times
+*/
+int asn1_times(const TLV *tlv, int n, int64_t *t)
+{
+  int i,k=0;
+  for (i=0; i < n; i++)
+  {
+    if (asn1_time(tlv[i].v,tlv[i].l,tlv[i].t,&t[i]) < 0) t[i]=ASN1_BADTIME;
+    else k++;
+  }
+  return k;
+}
+
+/*!
+    \brief check DER coding of INTEGER (not empty, minimal)
+    \return 0 correct, -EINVAL wrong
+*/
+static int asn1_intcheck(const uchar *v, int l)
+{
+  if (l <= 0) return -EINVAL;
+  if (l > 1 && ((v[0] == 0x00 && v[1] < 0x80) || (v[0] == 0xff && v[1] >= 0x80))) return -EINVAL;
+  return 0;
+}
+
+/*!
+    \brief decode non-negative INTEGER
+    \param v value of INTEGER tag
+    \param l value length
+    \param x output number
+    \return 0 success, -EINVAL wrong coding, -ERANGE negative or over 64 bits
+*/
+int asn1_uint64(const uchar *v, int l, uint64_t *x)
+{
+  uint64_t r;
+  int i;
+  if (asn1_intcheck(v,l) < 0) return -EINVAL;
+  if (v[0]&0x80) return -ERANGE;
+  if (v[0] == 0x00) { v++; l--; }
+  if (l > 8) return -ERANGE;
+  if (l == 8) r=asn1_ld64(v), r=__builtin_bswap64(r);
+  else for (r=0,i=0; i < l; i++) r=(r<<8)|v[i];
+  *x=r;
+  return 0;
+}
+
+/*!
+    \brief decode INTEGER
+    \param v value of INTEGER tag
+    \param l value length
+    \param x output number
+    \return 0 success, -EINVAL wrong coding, -ERANGE over 64 bits
+*/
+int asn1_int64(const uchar *v, int l, int64_t *x)
+{
+  uint64_t r;
+  int i;
+  if (asn1_intcheck(v,l) < 0) return -EINVAL;
+  if (l > 8) return -ERANGE;
+  /* sign extension */
+  r = v[0]&0x80 ? ~(uint64_t)0 : 0;
+  for (i=0; i < l; i++) r=(r<<8)|v[i];
+  *x=(int64_t)r;
+  return 0;
+}
+
+/*!
+    \brief decode batch of non-negative INTEGER tags
+    \param tlv INTEGER tags
+    \param n number of tags
+    \param x output numbers (0 for wrong ones)
+    \param ok output flags of correct numbers (may be NULL)
+    \return number of correctly decoded numbers
+*/
+int asn1_uint64s(const TLV *tlv, int n, uint64_t *x, uchar *ok)
+{
+  int i,r,k=0;
+  for (i=0; i < n; i++)
+  {
+    r = tlv[i].t == ASN1_INTEGER && asn1_uint64(tlv[i].v,tlv[i].l,&x[i]) == 0;
+    if (!r) x[i]=0;
+    if (ok) ok[i]=r;
+    k+=r;
+  }
+  return k;
+}
+
+/*!
+    \brief get big endian span of INTEGER (for numbers of any size)
+    \param v value of INTEGER tag
+    \param l value length
+    \param m output span: magnitude without sign byte (non-negative),
+             two's complement (negative)
+    \param ml output span length
+    \return 0 non-negative, 1 negative, -EINVAL wrong coding
+*/
+int asn1_intspan(const uchar *v, int l, const uchar **m, int *ml)
+{
+  if (asn1_intcheck(v,l) < 0) return -EINVAL;
+  if (v[0]&0x80) { *m=v; *ml=l; return 1; }
+  if (v[0] == 0x00 && l > 1) { v++; l--; }
+  *m=v; *ml=l;
+  return 0;
+}
+
+/*!
+    \brief parse DER header
+    \param b buffer
+    \param l buffer length
+    \param tag output tag ID
+    \param hl output header length
+    \param vl output value length
+    \return 0 success, TLVerr code
+*/
+static int asn1_hdr(const uchar *b, int l, ushort *tag, int *hl, int *vl)
+{
+  uint32_t v;
+  int i,n;
+  if (l < 1) return TLV_ETAG;
+  if (b[0] == 0x00) return ASN1_EEOC;
+  if ((i=tlv_tag(b,l,tag)) <= 0) return TLV_ETAG;
+  if (i > 1 && (b[1] == TAG_NEXT || (i == 2 && b[1] < TAG_SEQ))) return ASN1_ETAGMIN;
+  if (i >= l) return TLV_ELEN;
+  if (b[i] == LEN_BYTES) return ASN1_EINDEF;
+  if (b[i]&LEN_BYTES)
+  {
+    n=b[i++]&0x7f;
+    if (n > 4) return TLV_ELENGTH;
+    if (n > l-i) return TLV_ELEN;
+    if (b[i] == 0x00) return ASN1_ELENMIN;
+    for (v=0; n > 0; n--) v=(v<<8)|b[i++];
+    if (v < LEN_BYTES) return ASN1_ELENMIN;
+  }
+  else v=b[i++];
+  if (v > (uint32_t)(l-i)) return TLV_EVALUE;
+  *hl=i; *vl=v;
+  return 0;
+}
+
+/*!
+    \brief compare DER encodings (as octet strings padded with zeros)
+*/
+static int asn1_cmp(const uchar *a, int al, const uchar *b, int bl)
+{
+  int r=memcmp(a,b,al < bl ? al : bl);
+  return r ? r : al-bl;
+}
+
+typedef struct
+{
+  int o,l;
+} ASN1span;
+
+/*!
+    \brief sort elements of SET OF (its value), moving their encodings
+    \param v value of SET
+    \param l value length
+    \return negative - failure (-EINVAL not DER, -ENOMEM), number of elements
+*/
+int asn1_setsort(uchar *v, int l)
+{
+  ASN1span *e,*t,*x;
+  uchar *c;
+  ushort tag;
+  int i,j=0,k,n,w,hl,vl,o;
+
+  /* spans of elements (already sorted is usual case) */
+  for (n=0,o=0,k=1; o < l; n++, o+=hl+vl)
+  {
+    if (asn1_hdr(v+o,l-o,&tag,&hl,&vl) != 0) return -EINVAL;
+    if (n > 0 && k && asn1_cmp(v+j,o-j,v+o,hl+vl) > 0) k=0;
+    j=o;
+  }
+  if (k) return n;
+
+  if ((e=(ASN1span*)malloc(2*n*sizeof(ASN1span)+l)) == NULL) return -ENOMEM;
+  t=e+n; c=(uchar*)(t+n);
+  for (i=0,o=0; o < l; i++, o+=hl+vl)
+  {
+    asn1_hdr(v+o,l-o,&tag,&hl,&vl);
+    e[i].o=o; e[i].l=hl+vl;
+  }
+  /* bottom-up merge sort (stable) */
+  for (w=1; w < n; w*=2)
+  {
+    for (i=0; i < n; i+=2*w)
+    {
+      int m = i+w < n ? i+w : n, h = i+2*w < n ? i+2*w : n;
+      for (j=i,k=m,o=i; o < h; o++)
+      {
+        if (j < m && (k == h || asn1_cmp(v+e[j].o,e[j].l,v+e[k].o,e[k].l) <= 0)) t[o]=e[j++];
+        else t[o]=e[k++];
+      }
+    }
+    x=e; e=t; t=x;
+  }
+  for (i=0,o=0; i < n; o+=e[i].l, i++) memcpy(c+o,v+e[i].o,e[i].l);
+  memcpy(v,c,l);
+  free(e < t ? e : t);
+  return n;
+}
+
+/*!
+    \brief canonicalize DER: sort elements of all SETs (nested ones first)
+    \param b buffer (TLV structured, DER lengths)
+    \param l buffer length
+    \return negative - failure (-EINVAL not DER, -ELOOP nesting too deep, -ENOMEM),
+            number of SETs
+*/
+int asn1_canon(uchar *b, int l)
+{
+  ASN1span *s=NULL,*x;
+  int end[TLV_ERRDEPTH+1];
+  int d=0,o=0,n=0,ns=0,hl,vl,r;
+  ushort tag;
+
+  /* SETs in pre-order, so reverse order sorts inner before outer */
+  end[0]=l;
+  for (;;)
+  {
+    if (o == end[d])
+    {
+      if (d == 0) break;
+      d--;
+      continue;
+    }
+    if (asn1_hdr(b+o,end[d]-o,&tag,&hl,&vl) != 0) { free(s); return -EINVAL; }
+    if ((b[o]&TAG_CONSTR) == 0) { o+=hl+vl; continue; }
+    if (tag == ASN1_SET)
+    {
+      if (n == ns)
+      {
+        ns = ns ? 2*ns : 16;
+        if ((x=(ASN1span*)realloc(s,ns*sizeof(ASN1span))) == NULL) { free(s); return -ENOMEM; }
+        s=x;
+      }
+      s[n].o=o+hl; s[n].l=vl; n++;
+    }
+    if (d == TLV_ERRDEPTH) { free(s); return -ELOOP; }
+    o+=hl; end[++d]=o+vl;
+  }
+  for (r=n; n > 0; n--)
+    if ((d=asn1_setsort(b+s[n-1].o,s[n-1].l)) < 0) { r=d; break; }
+  free(s);
+  return r;
+}
+
+/*!
+    \brief check that buffer is canonical DER (one pass)
+    \param b buffer
+    \param l buffer length
+    \param err output error (may be NULL)
+    \return 0 - not DER (or SET OF not sorted), 1 - canonical DER
+*/
+int asn1_dercheck(const uchar *b, int l, TLVerr *err)
+{
+  const uchar *s=b,*end[TLV_ERRDEPTH+1],*prev[TLV_ERRDEPTH+1];
+  ushort tags[TLV_ERRDEPTH+1];
+  int d=0,hl,vl,c,i;
+  ushort tag=0;
+
+  end[0]=b+(l < 0 ? 0 : l); prev[0]=NULL; tags[0]=0;
+  for (;;)
+  {
+    if (b == end[d])
+    {
+      if (d == 0) return 1;
+      d--;
+      continue;
+    }
+    tag=0;
+    if ((c=asn1_hdr(b,end[d]-b,&tag,&hl,&vl)) != 0) break;
+    if (tags[d] == ASN1_SET)
+    {
+      if (prev[d] && asn1_cmp(prev[d],b-prev[d],b,hl+vl) > 0) { c=ASN1_EORDER; break; }
+      prev[d]=b;
+    }
+    if ((*b&TAG_CONSTR) == 0) { b+=hl+vl; continue; }
+    if (d == TLV_ERRDEPTH) { c=TLV_EDEPTH; break; }
+    b+=hl; d++;
+    end[d]=b+vl; prev[d]=NULL; tags[d]=tag;
+  }
+  if (err)
+  {
+    memset(err,0,sizeof(TLVerr));
+    err->code=c; err->off=b-s; err->tag=tag; err->depth=d;
+    for (i=0; i < d && i < TLV_ERRPATH; i++) err->path[i]=tags[i+1];
+  }
+  return 0;
+}
@@ -0,0 +1,94 @@
+#ifndef __COMMON_ASN1_H
+#define __COMMON_ASN1_H
+/*!
+	\file
+	\brief ASN.1 (DER) values of TLV tags (header)
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include "tlv.h"
+
+#define ASN1_INTEGER    0x02  /*!< \brief tag of INTEGER */
+#define ASN1_OID        0x06  /*!< \brief tag of OBJECT IDENTIFIER */
+#define ASN1_SET        0x31  /*!< \brief tag of SET (OF) */
+#define ASN1_UTCTIME    0x17  /*!< \brief tag of UTCTime */
+#define ASN1_GENTIME    0x18  /*!< \brief tag of GeneralizedTime */
+#define ASN1_BADTIME    INT64_MIN /*!< \brief time of wrong value in batch */
+#define ASN1_MAXARCS    32    /*!< \brief max arcs of OID */
+
+/* DER errors (TLVerr code, besides TLV_ETAG, TLV_ELEN, TLV_ELENGTH, TLV_EVALUE, TLV_EDEPTH) */
+#define ASN1_ETAGMIN    16    /*!< \brief tag not in shortest form */
+#define ASN1_ELENMIN    17    /*!< \brief length not in shortest form */
+#define ASN1_EINDEF     18    /*!< \brief indefinite length */
+#define ASN1_EEOC       19    /*!< \brief end-of-contents or padding */
+#define ASN1_EORDER     20    /*!< \brief elements of SET OF not sorted */
+
+/* algorithm identifiers (asn1_alg) */
+#define ASN1_ALG_UNKNOWN       0
+#define ASN1_ALG_RSA           1  /*!< \brief 1.2.840.113549.1.1.1 */
+#define ASN1_ALG_RSA_SHA1      2  /*!< \brief 1.2.840.113549.1.1.5 */
+#define ASN1_ALG_RSA_SHA256    3  /*!< \brief 1.2.840.113549.1.1.11 */
+#define ASN1_ALG_RSA_SHA384    4  /*!< \brief 1.2.840.113549.1.1.12 */
+#define ASN1_ALG_RSA_SHA512    5  /*!< \brief 1.2.840.113549.1.1.13 */
+#define ASN1_ALG_RSA_PSS       6  /*!< \brief 1.2.840.113549.1.1.10 */
+#define ASN1_ALG_RSA_OAEP      7  /*!< \brief 1.2.840.113549.1.1.7 */
+#define ASN1_ALG_MGF1          8  /*!< \brief 1.2.840.113549.1.1.8 */
+#define ASN1_ALG_EC            9  /*!< \brief 1.2.840.10045.2.1 */
+#define ASN1_ALG_ECDSA_SHA1    10 /*!< \brief 1.2.840.10045.4.1 */
+#define ASN1_ALG_ECDSA_SHA256  11 /*!< \brief 1.2.840.10045.4.3.2 */
+#define ASN1_ALG_ECDSA_SHA384  12 /*!< \brief 1.2.840.10045.4.3.3 */
+#define ASN1_ALG_ECDSA_SHA512  13 /*!< \brief 1.2.840.10045.4.3.4 */
+#define ASN1_ALG_P256          14 /*!< \brief 1.2.840.10045.3.1.7 */
+#define ASN1_ALG_P384          15 /*!< \brief 1.3.132.0.34 */
+#define ASN1_ALG_P521          16 /*!< \brief 1.3.132.0.35 */
+#define ASN1_ALG_ED25519       17 /*!< \brief 1.3.101.112 */
+#define ASN1_ALG_ED448         18 /*!< \brief 1.3.101.113 */
+#define ASN1_ALG_X25519        19 /*!< \brief 1.3.101.110 */
+#define ASN1_ALG_X448          20 /*!< \brief 1.3.101.111 */
+#define ASN1_ALG_SHA1          21 /*!< \brief 1.3.14.3.2.26 */
+#define ASN1_ALG_SHA256        22 /*!< \brief 2.16.840.1.101.3.4.2.1 */
+#define ASN1_ALG_SHA384        23 /*!< \brief 2.16.840.1.101.3.4.2.2 */
+#define ASN1_ALG_SHA512        24 /*!< \brief 2.16.840.1.101.3.4.2.3 */
+#define ASN1_ALG_SHA3_256      25 /*!< \brief 2.16.840.1.101.3.4.2.8 */
+#define ASN1_ALG_AES128_CBC    26 /*!< \brief 2.16.840.1.101.3.4.1.2 */
+#define ASN1_ALG_AES256_CBC    27 /*!< \brief 2.16.840.1.101.3.4.1.42 */
+#define ASN1_ALG_AES128_GCM    28 /*!< \brief 2.16.840.1.101.3.4.1.6 */
+#define ASN1_ALG_AES256_GCM    29 /*!< \brief 2.16.840.1.101.3.4.1.46 */
+#define ASN1_ALG_AES128_WRAP   30 /*!< \brief 2.16.840.1.101.3.4.1.5 */
+#define ASN1_ALG_AES256_WRAP   31 /*!< \brief 2.16.840.1.101.3.4.1.45 */
+#define ASN1_ALG_DES_EDE3_CBC  32 /*!< \brief 1.2.840.113549.3.7 */
+#define ASN1_ALG_HMAC_SHA1     33 /*!< \brief 1.2.840.113549.2.7 */
+#define ASN1_ALG_HMAC_SHA256   34 /*!< \brief 1.2.840.113549.2.9 */
+#define ASN1_ALG_HMAC_SHA512   35 /*!< \brief 1.2.840.113549.2.11 */
+#define ASN1_ALG_PBKDF2        36 /*!< \brief 1.2.840.113549.1.5.12 */
+#define ASN1_ALG_PBES2         37 /*!< \brief 1.2.840.113549.1.5.13 */
+#define ASN1_ALG_DH            38 /*!< \brief 1.2.840.113549.1.3.1 */
+#define ASN1_ALG_DSA           39 /*!< \brief 1.2.840.10040.4.1 */
+#define ASN1_ALG_DSA_SHA256    40 /*!< \brief 2.16.840.1.101.3.4.3.2 */
+#define ASN1_ALG_CMS_DATA      41 /*!< \brief 1.2.840.113549.1.7.1 */
+#define ASN1_ALG_CMS_SIGNED    42 /*!< \brief 1.2.840.113549.1.7.2 */
+#define ASN1_ALG_CMS_ENVELOPED 43 /*!< \brief 1.2.840.113549.1.7.3 */
+#define ASN1_ALG_CMS_DIGESTED  44 /*!< \brief 1.2.840.113549.1.7.5 */
+#define ASN1_ALG_CMS_ENCRYPTED 45 /*!< \brief 1.2.840.113549.1.7.6 */
+#define ASN1_ALG_CMS_AUTHENV   46 /*!< \brief 1.2.840.113549.1.9.16.1.23 */
+#define ASN1_ALG_MAX           46
+
+__BEGIN_DECLS
+EXPORT int asn1_oid(const uchar *v, int l, uint32_t *arcs, int n);
+EXPORT int asn1_oidstr(const uchar *v, int l, char *s, int slen);
+EXPORT int asn1_alg(const uchar *v, int l);
+EXPORT int asn1_algid(const uchar *v, int l, TLV *params);
+EXPORT const char *asn1_algname(int alg);
+EXPORT int asn1_time(const uchar *v, int l, ushort tag, int64_t *t);
+EXPORT int asn1_times(const TLV *tlv, int n, int64_t *t);
+EXPORT int asn1_uint64(const uchar *v, int l, uint64_t *x);
+EXPORT int asn1_int64(const uchar *v, int l, int64_t *x);
+EXPORT int asn1_uint64s(const TLV *tlv, int n, uint64_t *x, uchar *ok);
+EXPORT int asn1_intspan(const uchar *v, int l, const uchar **m, int *ml);
+EXPORT int asn1_setsort(uchar *v, int l);
+EXPORT int asn1_canon(uchar *b, int l);
+EXPORT int asn1_dercheck(const uchar *b, int l, TLVerr *err);
+__END_DECLS
+
+#endif
@@ -0,0 +1,390 @@
+/*!
+	\file
+	\brief b64 - parallel base64 encoding and decoding of files
+
+	usage: b64 [-d] [-s] [-u] [-m] [-j threads] [input [output]]
+	  -d  decode (default encode)
+	  -s  strict decoding: only alphabet and final padding (and line
+	      breaks with -m), unused bits zero
+	  -u  URL and filename safe alphabet (- _)
+	  -m  MIME: lines of 76 characters ended by CRLF
+	  -j  number of threads (default number of CPUs)
+	input and output default to stdin and stdout ("-").
+	build: cc -O2 -pthread b64.c base64.c -o b64
+
+	Input is mapped and split into chunks taken by threads, output
+	offset of every chunk is known before it is coded, so it is written
+	by pwrite directly to its place. Encoding chunks are multiples of 57
+	bytes (MIME line, 3 bytes groups). Decoding first counts characters
+	per chunk (input may contain line breaks, and anything else when not
+	strict), then every thread decodes 4 characters groups beginning in
+	its chunk, reading over its end to finish the last one. Threads use
+	fixed buffers and mapped pages of done chunks are dropped, so memory
+	use doesn't grow with file size. Input which can't be mapped (pipe)
+	is copied to unlinked temporary file, output which can't be written
+	by pwrite (pipe, file opened to append) is written in order by one thread.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "base64.h"
+
+#define LINE	57			/* bytes of MIME line (76 characters) */
+#define CHUNK	(LINE*65536)		/* input bytes of chunk (page multiple) */
+#define EBLOCK	(LINE*16384)		/* bytes encoded at once */
+#define DBLOCK	(4*262144)		/* characters decoded at once */
+#define MAXTHR	256
+
+#define C_ALPH	0
+#define C_PAD	1
+#define C_EOL	2
+#define C_OTHER	3
+
+/* decoding: characters counted in chunk (first pass) */
+typedef struct {
+	size_t n;		/* alphabet (and padding if strict) characters */
+	size_t npad;		/* padding characters */
+	size_t bad;		/* offset of wrong character (strict) or SIZE_MAX */
+} b64_chunk;
+
+typedef struct {
+	int dec, strict, alph, mime;
+	int pass;		/* decoding: 0 counting, 1 decoding */
+	const unsigned char *in;
+	size_t size;
+	int ofd, seek;
+	off_t base;		/* output offset of first byte */
+	size_t nchunk;
+	atomic_size_t next;
+	atomic_int err;		/* errno of first failure, -1 wrong input */
+	atomic_size_t errpos;	/* offset of first wrong character */
+	unsigned char cls[256];	/* character classes C_* */
+	b64_chunk *ch;
+	size_t *start;		/* characters before chunk (nchunk+1 entries) */
+} b64_job;
+
+static void fail(b64_job *j, int e) {
+	int z = 0;
+	atomic_compare_exchange_strong(&j->err, &z, e);
+}
+
+static void out(b64_job *j, const void *b, size_t l, size_t off) {
+	const char *p = b;
+	ssize_t r;
+	while (l > 0) {
+		if (j->seek) r = pwrite(j->ofd, p, l, j->base + off);
+		else r = write(j->ofd, p, l);
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			fail(j, errno);
+			return;
+		}
+		p += r; off += r; l -= r;
+	}
+}
+
+static void drop(b64_job *j, size_t k) {
+	size_t o = k * CHUNK, l = j->size - o < CHUNK ? j->size - o : CHUNK;
+	madvise((void *)(j->in + o), l, MADV_DONTNEED);
+}
+
+static void encode_chunk(b64_job *j, size_t k, char *buf) {
+	size_t o = k * CHUNK, end = j->size - o < CHUNK ? j->size : o + CHUNK;
+	size_t off = j->mime ? o / LINE * 78 : o / 3 * 4;
+	while (o < end && atomic_load_explicit(&j->err, memory_order_relaxed) == 0) {
+		size_t l = end - o < EBLOCK ? end - o : EBLOCK, n = 0;
+		if (!j->mime) n = base64_encode_block(j->alph, j->in + o, l, buf);
+		else {
+			for (size_t i = 0; i < l; i += LINE) {
+				n += base64_encode_block(j->alph, j->in + o + i, l - i < LINE ? l - i : LINE, buf + n);
+				buf[n++] = '\r'; buf[n++] = '\n';
+			}
+		}
+		out(j, buf, n, off);
+		o += l; off += n;
+	}
+}
+
+static void count_chunk(b64_job *j, size_t k) {
+	const unsigned char *p = j->in + k * CHUNK;
+	size_t l = j->size - k * CHUNK < CHUNK ? j->size - k * CHUNK : CHUNK;
+	b64_chunk *c = &j->ch[k];
+	size_t n = 0, npad = 0, i;
+
+	c->bad = SIZE_MAX;
+	if (!j->strict) {
+		for (i = 0; i < l; ++i) {
+			int x = j->cls[p[i]];
+			if (x == C_ALPH) ++n;
+			else if (x == C_PAD) { npad = 1; break; }
+		}
+	} else {
+		for (i = 0; i < l; ++i) {
+			int x = j->cls[p[i]];
+			if (x == C_ALPH && npad == 0) { ++n; continue; }
+			if (x == C_EOL && j->mime) continue;
+			if (x == C_PAD) { ++n; ++npad; continue; }
+			c->bad = k * CHUNK + i;
+			break;
+		}
+	}
+	c->n = n; c->npad = npad;
+}
+
+/* wrong input at offset pos, keeps the first one */
+static void bad(b64_job *j, size_t pos) {
+	size_t p = atomic_load(&j->errpos);
+	fail(j, -1);
+	while (pos < p && !atomic_compare_exchange_weak(&j->errpos, &p, pos)) ;
+}
+
+/* decodes characters [a,b) (rounded to groups) of those counted before
+ * chunk; runs of alphabet are decoded directly from input, groups
+ * broken by line breaks or other characters are gathered in q */
+static void decode_chunk(b64_job *j, size_t k, unsigned char *obuf) {
+	size_t t = j->start[j->nchunk];
+	size_t a = (j->start[k] + 3) & ~(size_t)3, b = (j->start[k+1] + 3) & ~(size_t)3;
+	size_t g = j->start[k], o = k * CHUNK, off, ol = 0, l, len, pos;
+	char q[4];
+	int n = 0, x;
+
+	if (b > t) b = t;
+	if (a >= b) return;
+	off = a / 4 * 3;
+	while (g < b && o < j->size) {
+		if (ol >= DBLOCK / 4 * 3) {
+			out(j, obuf, ol, off);
+			off += ol; ol = 0;
+			/* wrong input in later chunk, this one may have earlier */
+			if (atomic_load_explicit(&j->err, memory_order_relaxed) > 0) return;
+		}
+		if (n == 0 && g >= a) {
+			/* last group of strict input is checked in q */
+			l = b - g - (j->strict && b == t ? 4 : 0);
+			if (l > DBLOCK) l = DBLOCK;
+			if (l > j->size - o) l = j->size - o;
+			l &= ~(size_t)3;
+			/* padding inside strict input, left to check in q */
+			if (l > 0 && j->in[o+l-1] == '=') l -= 4;
+			if (l > 0) {
+				if (base64_decode_block(j->alph, 0, (const char *)j->in + o, l, obuf + ol, &len, &pos) != 0) {
+					l = pos & ~(size_t)3;
+					len = l / 4 * 3;
+				}
+				ol += len; o += l; g += l;
+				if (l > 0) continue;
+			}
+		}
+		x = j->cls[j->in[o]];
+		if (x == C_ALPH || (x == C_PAD && j->strict)) {
+			if (x == C_PAD && g + 2 < t) { bad(j, o); return; }
+			if (g++ >= a) q[n++] = j->in[o];
+		} else if (j->strict && (x == C_OTHER || (x == C_EOL && !j->mime))) {
+			bad(j, o);
+			return;
+		}
+		++o;
+		if (n == 4 || (n > 0 && g == b)) {
+			/* strict input of wrong length (ends inside group) */
+			if (n < 4 && j->strict) { bad(j, j->size); return; }
+			if (base64_decode_block(j->alph, j->strict, q, n, obuf + ol, &len, &pos) != 0) {
+				bad(j, o - 1);
+				return;
+			}
+			ol += len; n = 0;
+		}
+	}
+	out(j, obuf, ol, off);
+}
+
+static void *worker(void *arg) {
+	b64_job *j = arg;
+	void *buf = malloc(j->dec ? BASE64_DECLEN(DBLOCK) + DBLOCK / 4 * 3 : EBLOCK / LINE * 78);
+	size_t k;
+
+	if (buf == NULL) fail(j, ENOMEM);
+	while (atomic_load(&j->err) == 0 && (k = atomic_fetch_add(&j->next, 1)) < j->nchunk) {
+		if (!j->dec) encode_chunk(j, k, buf);
+		else if (j->pass == 0) count_chunk(j, k);
+		else decode_chunk(j, k, buf);
+		drop(j, k);
+	}
+	free(buf);
+	return NULL;
+}
+
+static void run(b64_job *j, int nthr) {
+	pthread_t t[MAXTHR];
+	int i, n = 0;
+
+	atomic_store(&j->next, 0);
+	if ((size_t)nthr > j->nchunk) nthr = j->nchunk;
+	for (i = 1; i < nthr; ++i)
+		if (pthread_create(&t[n], NULL, worker, j) == 0) ++n;
+	worker(j);
+	for (i = 0; i < n; ++i) pthread_join(t[i], NULL);
+}
+
+/* sums counts of chunks, checks strict input, returns decoded length
+ * or -1 with *pos of wrong character */
+static ssize_t decode_plan(b64_job *j, size_t *pos) {
+	size_t s = 0, npad = 0, k;
+	int end = 0;
+
+	*pos = SIZE_MAX;
+	for (k = 0; k < j->nchunk; ++k) {
+		b64_chunk *c = &j->ch[k];
+		if (j->strict) {
+			if (c->bad != SIZE_MAX) { *pos = c->bad; return -1; }
+			/* alphabet after padding of previous chunk */
+			if (npad > 0 && c->n > c->npad) { *pos = k * CHUNK; return -1; }
+		}
+		if (end) c->n = 0;
+		j->start[k] = s;
+		s += c->n; npad += c->npad;
+		if (!j->strict && c->npad) end = 1;
+	}
+	j->start[k] = s;
+	if (!j->strict) return s / 4 * 3 + ((s & 3) >= 2 ? (s & 3) - 1 : 0);
+	if ((s & 3) || npad > 2) { *pos = j->size; return -1; }
+	return s / 4 * 3 - npad;
+}
+
+/* copy unmappable input to unlinked temporary file */
+static int spool(int fd) {
+	const char *dir = getenv("TMPDIR");
+	char path[4096], buf[65536];
+	ssize_t r, w;
+	int t;
+
+	snprintf(path, sizeof(path), "%s/b64XXXXXX", dir ? dir : "/tmp");
+	if ((t = mkstemp(path)) < 0) return -1;
+	unlink(path);
+	while ((r = read(fd, buf, sizeof(buf))) != 0) {
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			close(t);
+			return -1;
+		}
+		for (ssize_t o = 0; o < r; o += w) {
+			if ((w = write(t, buf + o, r - o)) < 0) {
+				if (errno == EINTR) { w = 0; continue; }
+				close(t);
+				return -1;
+			}
+		}
+	}
+	return t;
+}
+
+static void usage(void) {
+	fprintf(stderr, "usage: b64 [-d] [-s] [-u] [-m] [-j threads] [input [output]]\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	static b64_job job;
+	b64_job *j = &job;
+	const char *alph;
+	struct stat st;
+	int ifd = 0, opt, nthr = 0, e;
+	size_t pos;
+	ssize_t total = 0;
+
+	while ((opt = getopt(argc, argv, "dsumj:")) != -1) {
+		switch (opt) {
+		case 'd': j->dec = 1; break;
+		case 's': j->strict = 1; break;
+		case 'u': j->alph = BASE64_URL; break;
+		case 'm': j->mime = 1; break;
+		case 'j': nthr = atoi(optarg); break;
+		default: usage();
+		}
+	}
+	if (argc - optind > 2) usage();
+	if (nthr <= 0) nthr = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthr <= 0) nthr = 1;
+	if (nthr > MAXTHR) nthr = MAXTHR;
+
+	if (optind < argc && strcmp(argv[optind], "-") != 0 && (ifd = open(argv[optind], O_RDONLY)) < 0) {
+		fprintf(stderr, "b64: %s: %s\n", argv[optind], strerror(errno));
+		return 2;
+	}
+	j->ofd = 1;
+	if (optind + 1 < argc && strcmp(argv[optind+1], "-") != 0 &&
+	    (j->ofd = open(argv[optind+1], O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0) {
+		fprintf(stderr, "b64: %s: %s\n", argv[optind+1], strerror(errno));
+		return 2;
+	}
+	if (fstat(ifd, &st) < 0 || (!S_ISREG(st.st_mode) && ((ifd = spool(ifd)) < 0 || fstat(ifd, &st) < 0))) {
+		fprintf(stderr, "b64: input: %s\n", strerror(errno));
+		return 2;
+	}
+	j->size = st.st_size;
+	if (j->size > 0) {
+		if ((j->in = mmap(NULL, j->size, PROT_READ, MAP_PRIVATE, ifd, 0)) == MAP_FAILED) {
+			fprintf(stderr, "b64: mmap: %s\n", strerror(errno));
+			return 2;
+		}
+		madvise((void *)j->in, j->size, MADV_SEQUENTIAL);
+	}
+	j->nchunk = (j->size + CHUNK - 1) / CHUNK;
+	/* pwrite ignores offset of O_APPEND file */
+	j->seek = fstat(j->ofd, &st) == 0 && S_ISREG(st.st_mode) && !(fcntl(j->ofd, F_GETFL) & O_APPEND) &&
+		(j->base = lseek(j->ofd, 0, SEEK_CUR)) >= 0;
+	if (!j->seek) nthr = 1;
+
+	if (!j->dec) {
+		run(j, nthr);
+		total = j->mime ? BASE64_ENCLEN(j->size) + (j->size + LINE - 1) / LINE * 2 : BASE64_ENCLEN(j->size);
+	} else {
+		alph = j->alph == BASE64_URL ? "-_" : "+/";
+		memset(j->cls, C_OTHER, sizeof(j->cls));
+		for (int c = 0; c < 26; ++c) j->cls['A'+c] = j->cls['a'+c] = C_ALPH;
+		for (int c = 0; c < 10; ++c) j->cls['0'+c] = C_ALPH;
+		j->cls[(unsigned char)alph[0]] = j->cls[(unsigned char)alph[1]] = C_ALPH;
+		j->cls['='] = C_PAD;
+		j->cls['\r'] = j->cls['\n'] = C_EOL;
+		j->ch = calloc(j->nchunk + 1, sizeof(b64_chunk));
+		j->start = calloc(j->nchunk + 1, sizeof(size_t));
+		if (j->ch == NULL || j->start == NULL) {
+			fprintf(stderr, "b64: %s\n", strerror(ENOMEM));
+			return 2;
+		}
+		atomic_store(&j->errpos, SIZE_MAX);
+		if (j->strict && !j->mime) {
+			/* only characters of alphabet (and final line break), no counting */
+			while (j->size > 0 && j->cls[j->in[j->size-1]] == C_EOL) --j->size;
+			j->nchunk = (j->size + CHUNK - 1) / CHUNK;
+			for (size_t k = 0; k <= j->nchunk; ++k) j->start[k] = k < j->nchunk ? k * CHUNK : j->size;
+			pos = 0;
+			while (pos < 2 && pos < j->size && j->in[j->size-1-pos] == '=') ++pos;
+			/* wrong length is reported by decoding, if no character before is wrong */
+			total = j->size / 4 * 3 - pos;
+		} else {
+			run(j, nthr);
+			if (atomic_load(&j->err) == 0 && (total = decode_plan(j, &pos)) < 0) bad(j, pos);
+		}
+		j->pass = 1;
+		if (atomic_load(&j->err) == 0) run(j, nthr);
+	}
+	if ((e = atomic_load(&j->err)) != 0) {
+		if (e < 0) fprintf(stderr, "b64: wrong input at offset %zu\n", atomic_load(&j->errpos));
+		else fprintf(stderr, "b64: %s\n", strerror(e));
+		return e < 0 ? 1 : 2;
+	}
+	if (j->seek) lseek(j->ofd, j->base + total, SEEK_SET);
+	if (j->ofd != 1 && close(j->ofd) < 0) {
+		fprintf(stderr, "b64: %s\n", strerror(errno));
+		return 2;
+	}
+	return 0;
+}
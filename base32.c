@@ -0,0 +1,315 @@
+/*!
+	\file
+	\brief Base32 implementation (RFC 4648 standard and extended hex alphabet)
+
+	Whole quanta (5 bytes, 8 characters) are coded by kernel chosen once
+	at startup: on x86-64 with BMI2 the 40 bits are spread (pdep) or
+	gathered (pext) by one instruction and all 8 characters are mapped
+	by SWAR arithmetic, otherwise table-driven scalar kernel is used.
+	Partial quanta, padding and validation are done by streaming context.
+*/
+#include <string.h>
+#include <stdint.h>
+#include "base32.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define BASE32_PAD '='
+#define ONES 0x0101010101010101ULL
+#define HI   0x8080808080808080ULL
+#define M5   0x1f1f1f1f1f1f1f1fULL
+
+typedef size_t (*base32_enc_fn)(const unsigned char *in, size_t nq, char *out, int alph);
+typedef size_t (*base32_dec_fn)(const char *in, size_t nq, unsigned char *out, int alph);
+
+static const char *BASE32[2] = {
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZ234567",
+	"0123456789ABCDEFGHIJKLMNOPQRSTUV"
+};
+/* character to value: 0..31, 32+value for lower case letter, 0xff other */
+static unsigned char base32_val[2][256];
+
+static uint64_t load40(const unsigned char *in) {
+	return (uint64_t)in[0]<<32 | (uint64_t)in[1]<<24 | (uint64_t)in[2]<<16 | (uint64_t)in[3]<<8 | in[4];
+}
+
+static void store40(unsigned char *out, uint64_t x) {
+	out[0] = x>>32; out[1] = x>>24; out[2] = x>>16; out[3] = x>>8; out[4] = x;
+}
+
+static size_t enc_scalar(const unsigned char *in, size_t nq, char *out, int alph) {
+	const char *a = BASE32[alph];
+	for (size_t q = 0; q < nq; ++q, in += 5, out += 8) {
+		uint64_t x = load40(in);
+		for (int i = 0; i < 8; ++i) out[i] = a[(x >> (35-5*i)) & 0x1f];
+	}
+	return nq;
+}
+
+/* decodes quanta until the first one with not canonical character */
+static size_t dec_scalar(const char *in, size_t nq, unsigned char *out, int alph) {
+	const unsigned char *t = base32_val[alph];
+	size_t q;
+	for (q = 0; q < nq; ++q, in += 8, out += 5) {
+		uint64_t x = 0;
+		unsigned bad = 0;
+		for (int i = 0; i < 8; ++i) {
+			unsigned v = t[(unsigned char)in[i]];
+			bad |= v;
+			x = x<<5 | (v & 0x1f);
+		}
+		if (bad & 0xe0) break;
+		store40(out, x);
+	}
+	return q;
+}
+
+/* mapping of value to character: v+base, +add-sub above limit */
+static const struct { uint64_t base, lim; unsigned add, sub; } SWAR_ENC[2] = {
+	{ 0x41*ONES, (0x80-26)*ONES, 0, 0x29 },
+	{ 0x30*ONES, (0x80-10)*ONES, 0x07, 0 }
+};
+
+/* 8 values 0..31 (byte 0 first) to characters */
+static inline uint64_t swar_enc(uint64_t v, int alph) {
+	uint64_t ge = ((v + SWAR_ENC[alph].lim) & HI) >> 7;
+	return v + SWAR_ENC[alph].base + ge*SWAR_ENC[alph].add - ge*SWAR_ENC[alph].sub;
+}
+
+/* bit 7 of bytes in range lo..hi (bytes must be < 0x80) */
+#define SWAR_IN(c, lo, hi) (((c) + (0x80-(lo))*ONES) & ~((c) + (0x7f-(hi))*ONES) & HI)
+
+/* 8 characters to values 0..31, returns 0 if any character is not canonical */
+static inline int swar_dec(uint64_t c, int alph, uint64_t *v) {
+	uint64_t alpha, digit, sub;
+	if (c & HI) return 0;
+	if (alph == BASE32_STD) {
+		alpha = SWAR_IN(c, 0x41, 0x5a);
+		digit = SWAR_IN(c, 0x32, 0x37);
+		sub = 0x18*ONES - (alpha>>7)*0x17;
+	}
+	else {
+		alpha = SWAR_IN(c, 0x41, 0x56);
+		digit = SWAR_IN(c, 0x30, 0x39);
+		sub = 0x30*ONES + (alpha>>7)*0x07;
+	}
+	if ((alpha | digit) != HI) return 0;
+	*v = (c - sub) & M5;
+	return 1;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("bmi2")))
+static size_t enc_bmi2(const unsigned char *in, size_t nq, char *out, int alph) {
+	uint64_t x, c;
+	for (size_t q = 0; q < nq; ++q, in += 5, out += 8) {
+		if (q + 1 < nq) {
+			/* 8 bytes are readable when another quantum follows */
+			memcpy(&x, in, 8);
+			x = __builtin_bswap64(x) >> 24;
+		}
+		else x = load40(in);
+		c = swar_enc(__builtin_bswap64(_pdep_u64(x, M5)), alph);
+		memcpy(out, &c, 8);
+	}
+	return nq;
+}
+
+__attribute__((target("bmi2")))
+static size_t dec_bmi2(const char *in, size_t nq, unsigned char *out, int alph) {
+	size_t q;
+	for (q = 0; q < nq; ++q, in += 8, out += 5) {
+		uint64_t c, v;
+		memcpy(&c, in, 8);
+		if (!swar_dec(c, alph, &v)) break;
+		store40(out, _pext_u64(__builtin_bswap64(v), M5));
+	}
+	return q;
+}
+#endif
+
+static base32_enc_fn enc_kernel = enc_scalar;
+static base32_dec_fn dec_kernel = dec_scalar;
+
+__attribute__((constructor))
+static void base32_setup(void) {
+	for (int a = 0; a < 2; ++a) {
+		memset(base32_val[a], 0xff, 256);
+		for (int i = 0; i < 32; ++i) {
+			unsigned char ch = BASE32[a][i];
+			base32_val[a][ch] = i;
+			if (ch >= 'A' && ch <= 'Z') base32_val[a][ch - 'A' + 'a'] = 32 + i;
+		}
+	}
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("bmi2")) {
+		enc_kernel = enc_bmi2;
+		dec_kernel = dec_bmi2;
+	}
+#endif
+}
+
+void base32_init(base32_ctx *ctx, int alph) {
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->alph = alph;
+}
+
+/* str must have room for BASE32_ENCLEN(ctx->n+len) characters,
+ * returns number of characters written (no terminating 0) */
+size_t base32_encode_update(base32_ctx *ctx, const unsigned char *data, size_t len, char *str) {
+	size_t j = 0, k;
+	if (ctx->n > 0) {
+		while (ctx->n < 5 && len > 0) {
+			ctx->buf[ctx->n++] = *data++;
+			--len;
+		}
+		if (ctx->n < 5) return 0;
+		enc_kernel(ctx->buf, 1, str, ctx->alph);
+		ctx->n = 0;
+		j = 8;
+	}
+	k = len / 5;
+	enc_kernel(data, k, str + j, ctx->alph);
+	j += 8*k;
+	memcpy(ctx->buf, data + 5*k, len - 5*k);
+	ctx->n = len - 5*k;
+	return j;
+}
+
+/* writes last (padded) quantum, returns number of characters (0 or 8) */
+size_t base32_encode_final(base32_ctx *ctx, char *str) {
+	static const int nch[5] = {0, 2, 4, 5, 7};
+	if (ctx->n == 0) return 0;
+	memset(ctx->buf + ctx->n, 0, 5 - ctx->n);
+	enc_scalar(ctx->buf, 1, str, ctx->alph);
+	for (int i = nch[ctx->n]; i < 8; ++i) str[i] = BASE32_PAD;
+	ctx->n = 0;
+	return 8;
+}
+
+/* strict decoding: only canonical characters, padded quanta, unused bits zero;
+ * data must have room for (ctx->n+slen)/8*5 bytes, *len is set to number of
+ * written bytes; returns 0 success, -1 wrong character, -2 wrong padding or
+ * unused bits or data after padding (ctx->pos is offset of wrong character) */
+int base32_decode_update(base32_ctx *ctx, const char *str, size_t slen, unsigned char *data, size_t *len) {
+	static const int nbytes[9] = {-1, -1, 1, -1, 2, 3, -1, 4, 5};
+	const unsigned char *t = base32_val[ctx->alph];
+	size_t i = 0, j = 0, k;
+	*len = 0;
+	while (i < slen) {
+		if (ctx->n == 0 && !ctx->end) {
+			k = dec_kernel(str + i, (slen - i) / 8, data + j, ctx->alph);
+			i += 8*k;
+			j += 5*k;
+			ctx->pos += 8*k;
+			*len = j;
+			if (i == slen) break;
+		}
+		char ch = str[i];
+		if (ctx->end) return -2;
+		if (ch == BASE32_PAD) {
+			++ctx->npad;
+		}
+		else {
+			if (t[(unsigned char)ch] > 31) return -1;
+			if (ctx->npad) return -2;
+		}
+		ctx->buf[ctx->n++] = ch == BASE32_PAD ? 0 : t[(unsigned char)ch];
+		++ctx->pos;
+		++i;
+		if (ctx->n < 8) continue;
+
+		int n = nbytes[8 - ctx->npad];
+		uint64_t x = 0;
+		for (int c = 0; c < 8; ++c) x = x<<5 | ctx->buf[c];
+		if (n < 0 || (x & ((1ULL << (40 - 8*n)) - 1)) != 0) {
+			--ctx->pos;
+			return -2;
+		}
+		for (int b = 0; b < n; ++b) data[j++] = x >> (32 - 8*b);
+		*len = j;
+		ctx->end = ctx->npad > 0;
+		ctx->n = 0;
+		ctx->npad = 0;
+	}
+	return 0;
+}
+
+/* returns 0 if input ended with complete quantum, else -2 */
+int base32_decode_final(base32_ctx *ctx) {
+	return ctx->n == 0 ? 0 : -2;
+}
+
+/* like base64_encode: *slen is buffer size, set to needed size (with 0),
+ * returns 1 if buffer is too short (nothing written) */
+int base32_encode(int alph, const unsigned char *data, size_t len, char *str, size_t *slen) {
+	base32_ctx ctx;
+	size_t j = BASE32_ENCLEN(len) + 1;
+	if (str == NULL || *slen < j) {
+		*slen = j;
+		return 1;
+	}
+	base32_init(&ctx, alph);
+	j = base32_encode_update(&ctx, data, len, str);
+	j += base32_encode_final(&ctx, str + j);
+	str[j++] = 0;
+	*slen = j;
+	return 0;
+}
+
+/* like base64_decode: other characters are skipped, lower case accepted,
+ * decoding stops at padding, incomplete bits at the end are dropped */
+int base32_decode(int alph, const char *str, size_t slen, unsigned char *data, size_t *len) {
+	const unsigned char *t = base32_val[alph];
+	unsigned c = 0, cbits = 0;
+	size_t j = 0;
+	for (size_t i = 0; i < slen; ++i) {
+		unsigned x = t[(unsigned char)str[i]];
+		if (x == 0xff) {
+			if (str[i] == BASE32_PAD) break;
+			continue;
+		}
+		c = (c<<5) | (x & 0x1f); // 5 bits read
+		cbits += 5;
+		if (cbits >= 8) {
+			cbits -= 8;
+			if (data && j < *len) data[j] = (c >> cbits) & 0xff;
+			c &= (1 << cbits) - 1;
+			++j;
+		}
+	}
+	if (*len < j) {
+		*len = j;
+		return 1;
+	}
+	*len = j;
+	return 0;
+}
+
+/* like base64_decode_strict: input must be canonical (upper case, padded
+ * to 8, unused bits zero); returns 1 if buffer is too short (*len set to
+ * needed size), on error (-1 wrong character, -2 wrong length, padding or
+ * unused bits) *errpos is offset of the wrong character */
+int base32_decode_strict(int alph, const char *str, size_t slen, unsigned char *data, size_t *len, size_t *errpos) {
+	base32_ctx ctx;
+	size_t n = slen, j;
+	int r;
+	if (slen & 7) {
+		*errpos = slen;
+		return -2;
+	}
+	while (n > 0 && slen - n < 6 && str[n-1] == BASE32_PAD) --n;
+	if (data == NULL || *len < n*5/8) {
+		*len = n*5/8;
+		return 1;
+	}
+	base32_init(&ctx, alph);
+	if ((r = base32_decode_update(&ctx, str, slen, data, &j)) < 0) {
+		*errpos = ctx.pos;
+		return r;
+	}
+	*len = j;
+	return 0;
+}
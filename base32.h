@@ -0,0 +1,34 @@
+#ifndef __COMMON_BASE32_H__
+#define __COMMON_BASE32_H__
+/*!
+	\file
+	\brief Base32 implementation (RFC 4648 standard and extended hex alphabet)
+*/
+
+#include <sys/types.h>
+
+#define BASE32_STD 0	/* alphabet A-Z 2-7 */
+#define BASE32_HEX 1	/* alphabet 0-9 A-V */
+#define BASE32_ENCLEN(n) (((n)+4)/5*8)	/* characters of n bytes (padded) */
+
+/* streaming context, either encoding or decoding */
+typedef struct {
+	int alph;		/* BASE32_STD or BASE32_HEX */
+	int n;			/* bytes (encoding) or characters (decoding) in buf */
+	int npad;		/* padding characters of current quantum */
+	int end;		/* padded quantum decoded, nothing may follow */
+	size_t pos;		/* characters consumed (error position) */
+	unsigned char buf[8];
+} base32_ctx;
+
+int base32_encode(int alph, const unsigned char *data, size_t len, char *str, size_t *slen);
+int base32_decode(int alph, const char *str, size_t slen, unsigned char *data, size_t *len);
+int base32_decode_strict(int alph, const char *str, size_t slen, unsigned char *data, size_t *len, size_t *errpos);
+
+void base32_init(base32_ctx *ctx, int alph);
+size_t base32_encode_update(base32_ctx *ctx, const unsigned char *data, size_t len, char *str);
+size_t base32_encode_final(base32_ctx *ctx, char *str);
+int base32_decode_update(base32_ctx *ctx, const char *str, size_t slen, unsigned char *data, size_t *len);
+int base32_decode_final(base32_ctx *ctx);
+
+#endif
@@ -3,6 +3,8 @@
 	\author Krzysztof Dynowski
 	\brief Base64 implementation
 */
+#include <string.h>
+#include <stdint.h>
 #include "base64.h"
 
 #define BASE64_PAD '='
@@ -75,3 +77,140 @@ int base64_decode(const char *str, size_t slen, unsigned char *data, size_t *len
 	*len = j;
 	return 0;
 }
+
+/* like base64_decode, but input must be canonical (no other characters,
+ * padded to 4, unused bits zero); on error (-1 wrong character, -2 wrong
+ * length or unused bits) *errpos is offset of the wrong character */
+int base64_decode_strict(const char *str, size_t slen, unsigned char *data, size_t *len, size_t *errpos) {
+	int c = 0, cbits = 0;
+	size_t n = slen, j = 0;
+	if (slen & 3) {
+		*errpos = slen;
+		return -2;
+	}
+	if (n > 0 && str[n-1] == BASE64_PAD) --n;
+	if (n > 0 && str[n-1] == BASE64_PAD) --n;
+	for (size_t i = 0; i < n; ++i) {
+		int x = base64_pos(str[i]);
+		if (x == -1) {
+			*errpos = i;
+			return -1;
+		}
+		c = (c<<6) | x; // 6 bits read
+		cbits += 6;
+		if (cbits >= 8) {
+			cbits -= 8;
+			if (data && j < *len) data[j] = (c >> cbits) & 0xff;
+			c &= (1 << cbits) - 1;
+			++j;
+		}
+	}
+	if (c != 0) {
+		*errpos = n - 1;
+		return -2;
+	}
+	if (*len < j) {
+		*len = j;
+		return 1;
+	}
+	*len = j;
+	return 0;
+}
+
+/* block coding: 12 bits to 2 characters, character to value shifted
+ * to its position in 24-bit group (BASE64_BAD if not in alphabet) */
+#define BASE64_BAD 0x80000000u
+static const char *BASE64X[2] = {
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/",
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_"
+};
+static uint16_t base64_enc2[2][4096];
+static uint32_t base64_dec[2][4][256];
+
+__attribute__((constructor))
+static void base64_setup(void) {
+	for (int a = 0; a < 2; ++a) {
+		const char *c = BASE64X[a];
+		for (int i = 0; i < 4096; ++i) {
+			unsigned char b[2] = { c[i>>6], c[i&0x3f] };
+			memcpy(&base64_enc2[a][i], b, 2);
+		}
+		for (int k = 0; k < 4; ++k) {
+			for (int i = 0; i < 256; ++i) base64_dec[a][k][i] = BASE64_BAD;
+			for (int i = 0; i < 64; ++i) base64_dec[a][k][(unsigned char)c[i]] = (uint32_t)i << (18 - 6*k);
+		}
+	}
+}
+
+/* str must have room for BASE64_ENCLEN(len) characters, last group is
+ * padded, returns number of characters written (no terminating 0) */
+size_t base64_encode_block(int alph, const unsigned char *data, size_t len, char *str) {
+	const uint16_t *e = base64_enc2[alph];
+	char *s = str;
+	size_t i;
+	for (i = 0; i + 3 <= len; i += 3) {
+		uint32_t v = (uint32_t)data[i]<<16 | (uint32_t)data[i+1]<<8 | data[i+2];
+		memcpy(s, &e[v>>12], 2);
+		memcpy(s + 2, &e[v&0xfff], 2);
+		s += 4;
+	}
+	if (i < len) {
+		uint32_t v = (uint32_t)data[i]<<16;
+		if (i + 1 < len) v |= (uint32_t)data[i+1]<<8;
+		memcpy(s, &e[v>>12], 2);
+		memcpy(s + 2, &e[v&0xfff], 2);
+		if (i + 1 == len) s[2] = BASE64_PAD;
+		s[3] = BASE64_PAD;
+		s += 4;
+	}
+	return s - str;
+}
+
+/* decode characters of alphabet only (no line breaks), padding is
+ * allowed at the end; strict: input padded to 4 and unused bits zero,
+ * otherwise unpadded last group is decoded (single character ignored);
+ * data must have room for BASE64_DECLEN(slen) bytes, *len is set to
+ * decoded length; errors as base64_decode_strict */
+int base64_decode_block(int alph, int strict, const char *str, size_t slen, unsigned char *data, size_t *len, size_t *errpos) {
+	const uint32_t (*d)[256] = base64_dec[alph];
+	const unsigned char *s = (const unsigned char *)str;
+	unsigned char *o = data;
+	size_t n = slen, i;
+	uint32_t v;
+
+	if (strict && (slen & 3)) {
+		*errpos = slen;
+		return -2;
+	}
+	if (n > 0 && s[n-1] == BASE64_PAD) --n;
+	if (n > 0 && s[n-1] == BASE64_PAD) --n;
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = d[0][s[i]] | d[1][s[i+1]] | d[2][s[i+2]] | d[3][s[i+3]];
+		if (v & BASE64_BAD) break;
+		o[0] = v>>16; o[1] = v>>8; o[2] = v;
+		o += 3;
+	}
+	for (v = 0; i < n; ++i) {
+		uint32_t x = d[i&3][s[i]];
+		if (x & BASE64_BAD) {
+			*errpos = i;
+			return -1;
+		}
+		v |= x;
+	}
+	/* last group of 2 or 3 characters */
+	if ((n & 3) == 1 && strict) {
+		*errpos = n - 1;
+		return -2;
+	}
+	if ((n & 3) >= 2) {
+		*o++ = v>>16;
+		if ((n & 3) == 3) *o++ = v>>8;
+		if (strict && (v & ((n & 3) == 2 ? 0xffff : 0xff))) {
+			*errpos = n - 1;
+			return -2;
+		}
+	}
+	*len = o - data;
+	return 0;
+}
@@ -8,7 +8,16 @@
 
 #include <sys/types.h>
 
+#define BASE64_STD 0	/* alphabet A-Z a-z 0-9 + / */
+#define BASE64_URL 1	/* alphabet A-Z a-z 0-9 - _ */
+#define BASE64_ENCLEN(n) (((n)+2)/3*4)	/* characters of n bytes (padded) */
+#define BASE64_DECLEN(n) ((n)/4*3+2)	/* max bytes of n characters */
+
 int base64_encode(unsigned char *data, size_t len, char *str, size_t *slen);
 int base64_decode(const char *str, size_t slen, unsigned char *data, size_t *len);
+int base64_decode_strict(const char *str, size_t slen, unsigned char *data, size_t *len, size_t *errpos);
+
+size_t base64_encode_block(int alph, const unsigned char *data, size_t len, char *str);
+int base64_decode_block(int alph, int strict, const char *str, size_t slen, unsigned char *data, size_t *len, size_t *errpos);
 
 #endif
@@ -0,0 +1,472 @@
+/*!
+	\file
+	\brief bench - TLV and base64 codecs under hardware performance counters
+
+	usage: bench [-t ms] [-n] [name...]
+	  -t  measuring time of workload (default 200 ms)
+	  -n  wall clock only (don't open counters)
+	  name  run only workloads containing one of names
+	build: cc -O2 bench.c tlv.c base64.c -o bench
+
+	Every workload is warmed up, its iterations are calibrated to the
+	measuring time and then run with counters enabled: cycles,
+	instructions, branch misses, L1 data read misses and last level
+	cache misses (perf_event_open, user space only). Counters are
+	opened one by one, so those not supported by CPU or not allowed
+	(containers, perf_event_paranoid) are reported as "-" and the rest
+	still work; multiplexed counters are scaled by time running.
+	Results are per byte and per element (tag, 3/4 bytes group) of
+	input; column "bound" is a rough estimate which stall dominates:
+	branch misses (br), cache misses (mem), or neither (core).
+	Workloads cover parsing, lookup, checking (also diagnostic walk of
+	broken record), indexing and building of TLV and LTV records and
+	base64 codecs with both alphabets; printing and one tag helpers
+	(tlv_tag, tlv_tlv0, tlv_buildT) are measured only as part of them.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "tlv.h"
+#include "base64.h"
+
+#define NCNT	5
+#define NTAGS	64		/* tags of TLV record */
+#define NBUFS	8192		/* TLV records of batch lookup (over LLC) */
+#define B64LEN	(1<<20)		/* bytes of base64 workloads */
+
+/* approximate cost of stall (cycles) for the bound estimate */
+#define BR_PENALTY	15
+#define L1_PENALTY	10
+#define LLC_PENALTY	150
+
+enum { CYC, INS, BRM, L1M, LLCM };
+
+static const struct {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+} cnt_def[NCNT] = {
+	{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	{ "L1d-misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+		PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+	{ "LLC-misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL |
+		PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+};
+
+static int cnt_fd[NCNT];
+
+typedef struct {
+	const char *name;
+	void (*fn)(void);
+	size_t bytes;		/* input bytes of one call */
+	size_t elems;		/* elements of one call */
+} workload;
+
+static volatile uintptr_t sink;
+
+/* workload data */
+static uchar rec[4096], rec2[4096], rec3[4096], bad[4096], eoc[4096], val[32];
+static char ltv[8192];
+static uchar taglist[2 * NTAGS];
+static TLVbuf tb, tb2, tb3;
+static ushort tags[NTAGS];
+static int ltvlen;
+static TLVbuf *bufs;
+static const TLVbuf **pbufs;
+static TLV *found;
+static unsigned char *raw;
+static char *enc, *encu;
+static unsigned char *dec;
+static size_t enclen;
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void cnt_open(void) {
+	struct perf_event_attr a;
+	int i, e = 0;
+
+	for (i = 0; i < NCNT; ++i) {
+		memset(&a, 0, sizeof(a));
+		a.size = sizeof(a);
+		a.type = cnt_def[i].type;
+		a.config = cnt_def[i].config;
+		a.disabled = 1;
+		a.exclude_kernel = 1;
+		a.exclude_hv = 1;
+		a.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		if ((cnt_fd[i] = syscall(__NR_perf_event_open, &a, 0, -1, -1, 0)) < 0) e = errno;
+	}
+	for (i = 0; i < NCNT; ++i)
+		printf("%s%s", i ? " " : "counters: ", cnt_fd[i] >= 0 ? cnt_def[i].name : "-");
+	if (e) printf(" (%s)", strerror(e));
+	printf("\n");
+}
+
+static void cnt_ctl(int op) {
+	for (int i = 0; i < NCNT; ++i)
+		if (cnt_fd[i] >= 0) ioctl(cnt_fd[i], op, 0);
+}
+
+/* scaled counter values, -1 not available */
+static void cnt_read(double *v) {
+	uint64_t r[3];
+	for (int i = 0; i < NCNT; ++i) {
+		v[i] = -1;
+		if (cnt_fd[i] < 0 || read(cnt_fd[i], r, sizeof(r)) != sizeof(r) || r[2] == 0) continue;
+		v[i] = (double)r[0] * r[1] / r[2];
+	}
+}
+
+/* TLV workloads */
+
+static void w_parse(void) {
+	const uchar *b = tb.buf;
+	int l = tb.len;
+	TLV t;
+	while (tlv_parseTLV(b, l, &t) > 0) {
+		t.v += t.l;
+		l -= t.v - b; b = t.v;
+	}
+	sink += (uintptr_t)b;
+}
+
+static void w_parsee(void) {
+	const uchar *b = tb.buf;
+	int l = tb.len;
+	TLVerr e;
+	TLV t;
+	while (tlv_parseTLVe(b, l, &t, &e) > 0) {
+		t.v += t.l;
+		l -= t.v - b; b = t.v;
+	}
+	sink += (uintptr_t)b;
+}
+
+static void w_parseltv(void) {
+	const uchar *b = (const uchar *)ltv;
+	int l = ltvlen;
+	TLV t;
+	while (tlv_parseLTV(b, l, &t) > 0) {
+		t.v += t.l;
+		l -= t.v - b; b = t.v;
+	}
+	sink += (uintptr_t)b;
+}
+
+static void w_findlast(void) {
+	TLV t;
+	sink += tb_find(&tb, tags[NTAGS-1], &t);
+}
+
+static void w_tlvfind(void) {
+	TLV t;
+	sink += tlv_find(tb.buf, tb.len, tags[NTAGS-1], &t);
+}
+
+static void w_ltvfind(void) {
+	TLV t;
+	sink += ltv_find((const uchar *)ltv, ltvlen, NTAGS, &t);
+}
+
+static void w_findr(void) {
+	TLV t;
+	sink += tb_findr(&tb, tags[NTAGS-1], &t);
+}
+
+static void w_findn(void) {
+	sink += tb_findn(pbufs, NBUFS, &tags[NTAGS-1], 1, found);
+}
+
+static void w_findloop(void) {
+	TLV t;
+	for (int i = 0; i < NBUFS; ++i) sink += tb_find(pbufs[i], tags[NTAGS-1], &t);
+}
+
+static void w_check(void) {
+	sink += tlv_check(tb.buf, tb.len);
+}
+
+static void w_checke(void) {
+	TLVerr e;
+	sink += tlv_checke(tb.buf, tb.len, &e);
+}
+
+/* inconsistent record, diagnostic walk */
+static void w_checkebad(void) {
+	TLVerr e;
+	sink += tlv_checke(bad, tb.len, &e) + e.off;
+}
+
+static void w_eocscan(void) {
+	TLVeoc s = { 0, 0, 1 };
+	sink += tlv_eocscan(&s, eoc, tb.len + 2) + s.off;
+}
+
+static void w_index(void) {
+	TLVent e[NTAGS];
+	sink += tlv_index(tb.buf, tb.len, e, NTAGS);
+}
+
+static void w_tbindex(void) {
+	TLVent e[NTAGS];
+	sink += tb_index(&tb, e, NTAGS);
+}
+
+static void w_adddel(void) {
+	TLV t;
+	for (int i = 0; i < NTAGS; i += 4) {
+		tb_find(&tb2, tags[i], &t);
+		tlv_init(&t, tags[i], t.l, val);
+		tb_del(&tb2, tags[i]);
+		sink += tb_add(&tb2, &t, 0);
+	}
+}
+
+/* overwrite all tags with values of same length */
+static void w_addbuf(void) {
+	sink += tb_addbuf(&tb2, tb.buf, tb.len, 1);
+}
+
+static void w_addtags(void) {
+	tb3.len = 0;
+	tb_addtags(&tb3, &tb, taglist, sizeof(taglist));
+	sink += tb3.len;
+}
+
+static int w_wr(void *ctx, const uchar *b, int l) {
+	(void)ctx;
+	sink += b[0];
+	return l;
+}
+
+static void w_encode(void) {
+	TLVenc e;
+	const uchar *b = tb.buf;
+	int l = tb.len;
+	TLV t;
+	te_init(&e, w_wr, NULL);
+	te_begin(&e, 0x70);
+	while (tlv_parseTLV(b, l, &t) > 0) {
+		te_put(&e, &t);
+		t.v += t.l;
+		l -= t.v - b; b = t.v;
+	}
+	te_end(&e);
+	sink += e.len;
+}
+
+/* base64 workloads */
+
+static void w_b64enc(void) {
+	size_t l = enclen + 1;
+	sink += base64_encode(raw, B64LEN, enc, &l);
+}
+
+static void w_b64dec(void) {
+	size_t l = B64LEN;
+	sink += base64_decode(enc, enclen, dec, &l);
+}
+
+static void w_b64strict(void) {
+	size_t l = B64LEN, e;
+	sink += base64_decode_strict(enc, enclen, dec, &l, &e);
+}
+
+static void w_b64encblk(void) {
+	sink += base64_encode_block(BASE64_STD, raw, B64LEN, enc);
+}
+
+static void w_b64decblk(void) {
+	size_t l, e;
+	sink += base64_decode_block(BASE64_STD, 1, enc, enclen, dec, &l, &e);
+}
+
+static void w_b64encurl(void) {
+	sink += base64_encode_block(BASE64_URL, raw, B64LEN, encu);
+}
+
+static void w_b64decurl(void) {
+	size_t l, e;
+	sink += base64_decode_block(BASE64_URL, 1, encu, enclen, dec, &l, &e);
+}
+
+static void setup(void) {
+	TLVent ent[NTAGS];
+	uchar v[32];
+	TLV t;
+	int i;
+
+	srand(1);
+	tb_init(&tb, rec, sizeof(rec));
+	for (i = 0; i < NTAGS; ++i) {
+		tags[i] = 0xdf01 + i;
+		tlv_init(&t, tags[i], 1 + rand() % 32, v);
+		memset(v, i, sizeof(v));
+		tb_add(&tb, &t, 0);
+	}
+	memcpy(rec2, rec, tb.len);
+	tb_init(&tb2, rec2, sizeof(rec2));
+	tb2.len = tb.len;
+	tb_init(&tb3, rec3, sizeof(rec3));
+	for (i = 0; i < NTAGS; ++i) {
+		taglist[2 * i] = tags[i] >> 8;
+		taglist[2 * i + 1] = tags[i];
+	}
+	/* value of indefinite length: record and end-of-contents */
+	memcpy(eoc, rec, tb.len);
+	eoc[tb.len] = eoc[tb.len + 1] = 0;
+	/* last tag runs over end of record */
+	memcpy(bad, rec, tb.len);
+	tlv_index(tb.buf, tb.len, ent, NTAGS);
+	bad[ent[NTAGS-1].o + ent[NTAGS-1].h - 1] = 0x7f;
+	/* LTV record: 4 digits length (tag and value), 2 digits tag */
+	for (i = 0, ltvlen = 0; i < NTAGS; ++i) {
+		int l = 1 + rand() % 32;
+		ltvlen += sprintf(ltv + ltvlen, "%04u%02u", l + 2, i + 1);
+		memset(ltv + ltvlen, 'a' + i % 26, l);
+		ltvlen += l;
+	}
+	bufs = malloc(NBUFS * sizeof(TLVbuf));
+	pbufs = malloc(NBUFS * sizeof(TLVbuf *));
+	found = malloc(NBUFS * sizeof(TLV));
+	for (i = 0; i < NBUFS; ++i) {
+		bufs[i].buf = malloc(tb.len);
+		memcpy(bufs[i].buf, tb.buf, tb.len);
+		bufs[i].len = bufs[i].mlen = tb.len;
+	}
+	/* shuffled, so hardware prefetcher doesn't hide misses */
+	for (i = 0; i < NBUFS; ++i) pbufs[i] = &bufs[i];
+	for (i = NBUFS - 1; i > 0; --i) {
+		int k = rand() % (i + 1);
+		const TLVbuf *x = pbufs[i];
+		pbufs[i] = pbufs[k]; pbufs[k] = x;
+	}
+
+	raw = malloc(B64LEN);
+	enc = malloc(BASE64_ENCLEN(B64LEN) + 1);
+	encu = malloc(BASE64_ENCLEN(B64LEN) + 1);
+	dec = malloc(B64LEN);
+	for (i = 0; i < B64LEN; ++i) raw[i] = rand();
+	enclen = base64_encode_block(BASE64_STD, raw, B64LEN, enc);
+	enc[enclen] = 0;
+	base64_encode_block(BASE64_URL, raw, B64LEN, encu);
+	encu[enclen] = 0;
+}
+
+static void run(const workload *w, double tmeas) {
+	double t, c[NCNT], per, cyc, stall;
+	const char *bound = "-";
+	long n, it;
+
+	/* warm up and calibrate */
+	for (it = 1;; it *= 2) {
+		t = now();
+		for (n = 0; n < it; ++n) w->fn();
+		t = now() - t;
+		if (t > tmeas / 10) break;
+	}
+	it = it * (tmeas / t) + 1;
+
+	cnt_ctl(PERF_EVENT_IOC_RESET);
+	cnt_ctl(PERF_EVENT_IOC_ENABLE);
+	t = now();
+	for (n = 0; n < it; ++n) w->fn();
+	t = now() - t;
+	cnt_ctl(PERF_EVENT_IOC_DISABLE);
+	cnt_read(c);
+
+	per = (double)it * w->elems;
+	printf("%-14s %8.3f %8.2f", w->name, t * 1e9 / ((double)it * w->bytes), t * 1e9 / per);
+	if (c[CYC] >= 0) printf(" %7.3f %7.2f", c[CYC] / ((double)it * w->bytes), c[CYC] / per);
+	else printf(" %7s %7s", "-", "-");
+	if (c[CYC] > 0 && c[INS] >= 0) printf(" %5.2f", c[INS] / c[CYC]); else printf(" %5s", "-");
+	for (int i = BRM; i < NCNT; ++i) {
+		if (c[i] >= 0) printf(" %8.4f", c[i] / per); else printf(" %8s", "-");
+	}
+	if (c[CYC] > 0 && (c[BRM] >= 0 || c[L1M] >= 0 || c[LLCM] >= 0)) {
+		cyc = c[CYC];
+		stall = (c[L1M] > 0 ? c[L1M] * L1_PENALTY : 0) + (c[LLCM] > 0 ? c[LLCM] * LLC_PENALTY : 0);
+		if (c[BRM] > 0 && c[BRM] * BR_PENALTY > stall && c[BRM] * BR_PENALTY > cyc / 5) bound = "br";
+		else if (stall > cyc / 5) bound = "mem";
+		else bound = "core";
+	}
+	printf(" %5s\n", bound);
+}
+
+int main(int argc, char *argv[]) {
+	workload *w;
+	size_t nw;
+	double tmeas = 0.2;
+	int opt, nocnt = 0, i, k;
+
+	while ((opt = getopt(argc, argv, "t:n")) != -1) {
+		switch (opt) {
+		case 't': tmeas = atof(optarg) / 1000; break;
+		case 'n': nocnt = 1; break;
+		default:
+			fprintf(stderr, "usage: bench [-t ms] [-n] [name...]\n");
+			return 2;
+		}
+	}
+	setup();
+	{
+		/* elements: tags of record (scanned by lookup), 3 bytes groups */
+		const size_t rl = tb.len, bl = (size_t)NBUFS * tb.len;
+		const workload tab[] = {
+			{ "tlv_parseTLV", w_parse, rl, NTAGS },
+			{ "tlv_parseTLVe", w_parsee, rl, NTAGS },
+			{ "tlv_parseLTV", w_parseltv, ltvlen, NTAGS },
+			{ "tb_find", w_findlast, rl, NTAGS },
+			{ "tlv_find", w_tlvfind, rl, NTAGS },
+			{ "ltv_find", w_ltvfind, ltvlen, NTAGS },
+			{ "tb_findr", w_findr, rl, NTAGS },
+			{ "tb_find-loop", w_findloop, bl, NBUFS * NTAGS },
+			{ "tb_findn", w_findn, bl, NBUFS * NTAGS },
+			{ "tlv_check", w_check, rl, NTAGS },
+			{ "tlv_checke", w_checke, rl, NTAGS },
+			{ "tlv_checke-bad", w_checkebad, rl, NTAGS },
+			{ "tlv_eocscan", w_eocscan, rl + 2, NTAGS },
+			{ "tlv_index", w_index, rl, NTAGS },
+			{ "tb_index", w_tbindex, rl, NTAGS },
+			{ "tb_add+del", w_adddel, rl, NTAGS / 4 },
+			{ "tb_addbuf", w_addbuf, rl, NTAGS },
+			{ "tb_addtags", w_addtags, rl, NTAGS },
+			{ "te_put", w_encode, rl, NTAGS },
+			{ "b64_encode", w_b64enc, B64LEN, B64LEN / 3 },
+			{ "b64_decode", w_b64dec, enclen, B64LEN / 3 },
+			{ "b64_strict", w_b64strict, enclen, B64LEN / 3 },
+			{ "b64_encblock", w_b64encblk, B64LEN, B64LEN / 3 },
+			{ "b64_decblock", w_b64decblk, enclen, B64LEN / 3 },
+			{ "b64_encblk-url", w_b64encurl, B64LEN, B64LEN / 3 },
+			{ "b64_decblk-url", w_b64decurl, enclen, B64LEN / 3 },
+		};
+		nw = sizeof(tab) / sizeof(tab[0]);
+		w = malloc(sizeof(tab));
+		memcpy(w, tab, sizeof(tab));
+	}
+	for (i = 0; i < NCNT; ++i) cnt_fd[i] = -1;
+	if (!nocnt) cnt_open();
+
+	printf("%-14s %8s %8s %7s %7s %5s %8s %8s %8s %5s\n", "workload", "ns/B", "ns/el",
+	       "cyc/B", "cyc/el", "IPC", "brmis/el", "L1mis/el", "LLCm/el", "bound");
+	for (i = 0; i < (int)nw; ++i) {
+		for (k = optind; k < argc && strstr(w[i].name, argv[k]) == NULL; ++k) ;
+		if (optind < argc && k == argc) continue;
+		run(&w[i], tmeas);
+	}
+	free(w);
+	return 0;
+}
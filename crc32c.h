@@ -0,0 +1,13 @@
+#ifndef __COMMON_CRC32C_H__
+#define __COMMON_CRC32C_H__
+/*!
+	\file
+	\brief CRC-32C (Castagnoli) implementation
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+#endif
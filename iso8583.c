@@ -0,0 +1,304 @@
+/*!
+	\file
+	\brief ISO 8583 message codec with zero-copy field views
+
+	Message is MTI, primary bitmap, secondary bitmap (if bit 1 is set)
+	and present fields in ascending order. Parsing is one pass over set
+	bits of bitmaps (next field by count of leading zeros), only offsets
+	and lengths of fields are kept, nothing is copied or converted.
+	Field values are views of message: ICC data (field 55) is TLVbuf
+	pointing into message, usable with tb_find()/tlv_find() directly.
+
+	Message with one field replaced (added, removed) is rebuilt as
+	scatter-gather list: new MTI and bitmaps, unchanged fields before,
+	new field, unchanged fields after, so it can be sent by one writev
+	without copying other fields.
+
+	Field definitions follow ISO 8583:1987 (as usually implemented), in
+	ASCII variant (numbers and length prefixes as ASCII digits) or BCD
+	variant (packed digits, numeric field of odd length padded on left).
+*/
+
+#include <string.h>
+#include <errno.h>
+#include "iso8583.h"
+
+#define N(x)    {I8_N,I8_FIX,x}
+#define AN(x)   {I8_AN,I8_FIX,x}
+#define B(x)    {I8_B,I8_FIX,x}
+#define LLN(x)  {I8_N,I8_LL,x}
+#define LLAN(x) {I8_AN,I8_LL,x}
+#define LLLN(x) {I8_N,I8_LLL,x}
+#define LLLAN(x) {I8_AN,I8_LLL,x}
+#define LLLB(x) {I8_B,I8_LLL,x}
+
+static const I8field i8_fields87[I8_MAXFIELD+1] = {
+  {0,0,0},   B(8),      LLN(19),   N(6),      N(12),     N(12),     N(12),     N(10),    /* 0-7 */
+  N(8),      N(8),      N(8),      N(6),      N(6),      N(4),      N(4),      N(4),     /* 8-15 */
+  N(4),      N(4),      N(4),      N(3),      N(3),      N(3),      N(3),      N(3),     /* 16-23 */
+  N(3),      N(2),      N(2),      N(1),      AN(9),     AN(9),     AN(9),     AN(9),    /* 24-31 */
+  LLN(11),   LLN(11),   LLAN(28),  LLAN(37),  LLLN(104), AN(12),    AN(6),     AN(2),    /* 32-39 */
+  AN(3),     AN(8),     AN(15),    AN(40),    LLAN(25),  LLAN(76),  LLLAN(999),LLLAN(999),/* 40-47 */
+  LLLAN(999),AN(3),     AN(3),     AN(3),     B(8),      N(16),     LLLAN(120),LLLB(999),/* 48-55 */
+  LLLAN(999),LLLAN(999),LLLAN(999),LLLAN(999),LLLAN(999),LLLAN(999),LLLAN(999),LLLAN(999),/* 56-63 */
+  B(8),      B(1),      N(1),      N(2),      N(3),      N(3),      N(3),      N(4),     /* 64-71 */
+  N(4),      N(6),      N(10),     N(10),     N(10),     N(10),     N(10),     N(10),    /* 72-79 */
+  N(10),     N(10),     N(12),     N(12),     N(12),     N(12),     N(16),     N(16),    /* 80-87 */
+  N(16),     N(16),     N(42),     AN(1),     AN(2),     AN(5),     AN(7),     AN(42),   /* 88-95 */
+  B(8),      AN(17),    AN(25),    LLN(11),   LLN(11),   LLAN(17),  LLAN(28),  LLAN(28), /* 96-103 */
+  LLLAN(100),LLLAN(999),LLLAN(999),LLLAN(999),LLLAN(999),LLLAN(999),LLLAN(999),LLLAN(999),/* 104-111 */
+  LLLAN(999),LLLAN(999),LLLAN(999),LLLAN(999),LLLAN(999),LLLAN(999),LLLAN(999),LLLAN(999),/* 112-119 */
+  LLLAN(999),LLLAN(999),LLLAN(999),LLLAN(999),LLLAN(999),LLLAN(999),LLLAN(999),LLLAN(999),/* 120-127 */
+  B(8)                                                                                      /* 128 */
+};
+
+const I8spec i8_ascii87 = { 0, 0, i8_fields87 };
+const I8spec i8_bcd87 = { 1, 0, i8_fields87 };
+
+/*!
+    \brief get bytes of field value
+    \param s specification
+    \param f field definition
+    \param c length (digits, characters or bytes)
+*/
+static int i8_bytes(const I8spec *s, const I8field *f, int c)
+{
+  return f->fmt == I8_N && s->bcd ? (c+1)/2 : c;
+}
+
+/*!
+    \brief get length of length prefix (bytes)
+*/
+static int i8_pfxlen(const I8spec *s, const I8field *f)
+{
+  return s->bcd ? (f->var+1)/2 : f->var;
+}
+
+/*!
+    \brief decode number of n digits (BCD of odd n is padded on left)
+    \return -EINVAL not a digit, number
+*/
+static int i8_num(const I8spec *s, const uchar *b, int n)
+{
+  int i,j,d,x=0;
+  for (i=0; i < n; i++)
+  {
+    j=i+(n&1);
+    if (s->bcd) d=(b[j/2]>>((j&1)?0:4))&0xf;
+    else d=b[i]-'0';
+    if (d < 0 || d > 9) return -EINVAL;
+    x=x*10+d;
+  }
+  return x;
+}
+
+/*!
+    \brief encode number to n digits
+*/
+static void i8_putnum(const I8spec *s, uchar *b, int n, int x)
+{
+  int i,j;
+  if (s->bcd) memset(b,0,(n+1)/2);
+  for (i=n-1; i >= 0; i--, x/=10)
+  {
+    j=i+(n&1);
+    if (s->bcd) b[j/2]|=(x%10)<<((j&1)?0:4);
+    else b[i]='0'+x%10;
+  }
+}
+
+/*!
+    \brief decode bitmap
+*/
+static int i8_getbm(const I8spec *s, const uchar *b, uint64_t *bm)
+{
+  int i,d;
+  uint64_t x=0;
+  if (!s->hexbm)
+  {
+    for (i=0; i < 8; i++) x=(x<<8)|b[i];
+    *bm=x;
+    return 8;
+  }
+  for (i=0; i < 16; i++)
+  {
+    if (b[i] >= '0' && b[i] <= '9') d=b[i]-'0';
+    else if ((b[i]|0x20) >= 'a' && (b[i]|0x20) <= 'f') d=(b[i]|0x20)-'a'+10;
+    else return -EINVAL;
+    x=(x<<4)|d;
+  }
+  *bm=x;
+  return 16;
+}
+
+/*!
+    \brief encode bitmap
+*/
+static int i8_putbm(const I8spec *s, uchar *b, uint64_t bm)
+{
+  int i;
+  if (!s->hexbm)
+  {
+    for (i=7; i >= 0; i--, bm>>=8) b[i]=bm;
+    return 8;
+  }
+  for (i=15; i >= 0; i--, bm>>=4) b[i]="0123456789ABCDEF"[bm&0xf];
+  return 16;
+}
+
+/*!
+    \brief parse message (MTI, bitmaps and offsets of all fields)
+    \param m output parsed message
+    \param s specification (i8_ascii87, i8_bcd87 or own)
+    \param b message
+    \param l message length
+    \return negative - failure (-EPIPE message too short, -EINVAL wrong bitmap or length,
+            -ENOTSUP field not defined by specification), message length
+*/
+int i8_parse(I8msg *m, const I8spec *s, const uchar *b, int l)
+{
+  const I8field *f;
+  uint64_t x;
+  int o,w,k,c,hl,r;
+
+  m->b=b; m->s=s; m->bm[1]=0;
+  o = s->bcd ? 2 : 4;
+  if (o+(s->hexbm ? 16 : 8) > l) return -EPIPE;
+  if ((r=i8_getbm(s,b+o,&m->bm[0])) < 0) return r;
+  o+=r;
+  if (m->bm[0]>>63)
+  {
+    if (o+r > l) return -EPIPE;
+    if ((r=i8_getbm(s,b+o,&m->bm[1])) < 0) return r;
+    o+=r;
+  }
+  m->foff=o;
+  for (w=0; w < 2; w++)
+  {
+    x = w == 0 ? m->bm[0]&~((uint64_t)1<<63) : m->bm[1];
+    while (x)
+    {
+      k=w*64+__builtin_clzll(x)+1;
+      x&=~((uint64_t)1<<(64-(k-w*64)));
+      f=&s->f[k];
+      if (f->fmt == 0) return -ENOTSUP;
+      hl=0; c=f->max;
+      if (f->var != I8_FIX)
+      {
+        hl=i8_pfxlen(s,f);
+        if (o+hl > l) return -EPIPE;
+        if ((c=i8_num(s,b+o,f->var)) < 0 || c > f->max) return -EINVAL;
+      }
+      m->off[k]=o; m->hl[k]=hl;
+      m->len[k]=i8_bytes(s,f,c);
+      o+=hl+m->len[k];
+      if (o > l) return -EPIPE;
+    }
+  }
+  m->l=o;
+  return o;
+}
+
+/*!
+    \brief check presence of field
+    \param m parsed message
+    \param k field number (2..I8_MAXFIELD)
+    \return 1 present, 0 absent
+*/
+int i8_has(const I8msg *m, int k)
+{
+  if (k < 2 || k > I8_MAXFIELD) return 0;
+  return (m->bm[(k-1)/64]>>(63-(k-1)%64))&1;
+}
+
+/*!
+    \brief get field value (view of message)
+    \param m parsed message
+    \param k field number
+    \param v output pointer to value
+    \return -ENOENT field not present, value length (bytes)
+*/
+int i8_get(const I8msg *m, int k, const uchar **v)
+{
+  if (!i8_has(m,k)) return -ENOENT;
+  *v=m->b+m->off[k]+m->hl[k];
+  return m->len[k];
+}
+
+/*!
+    \brief get TLV structured field (e.g. I8_ICC) as TLVbuf (view of message, read only)
+    \param m parsed message
+    \param k field number
+    \param tb output TLVbuf (mlen=len)
+    \return 0 success, -ENOENT field not present
+*/
+int i8_view(const I8msg *m, int k, TLVbuf *tb)
+{
+  const uchar *v;
+  int l;
+  if ((l=i8_get(m,k,&v)) < 0) return l;
+  tb->buf=(uchar*)v;
+  tb->mlen=tb->len=l;
+  return 0;
+}
+
+/*!
+    \brief rebuild message with field replaced (as scatter-gather list for writev)
+    \param m parsed message
+    \param k field number (2..I8_MAXFIELD)
+    \param v new value (NULL - remove field)
+    \param l new value length: digits of numeric field in BCD variant (value
+           is (l+1)/2 bytes, odd number of digits padded on left), otherwise bytes
+    \param o output parts of message (o->iov points to m->b, v and o)
+    \return negative - failure (-EINVAL wrong field or length), message length
+*/
+int i8_replace(const I8msg *m, int k, const uchar *v, int l, I8out *o)
+{
+  const I8spec *s=m->s;
+  const I8field *f;
+  uint64_t bm[2],bit;
+  int h,p,e,b,j,n;
+
+  if (k < 2 || k > I8_MAXFIELD || (f=&s->f[k])->fmt == 0) return -EINVAL;
+  if (v)
+  {
+    b=i8_bytes(s,f,l);
+    if (l < 0 || (f->var == I8_FIX ? l != f->max : l > f->max)) return -EINVAL;
+  }
+  bit=(uint64_t)1<<(63-(k-1)%64);
+  bm[0]=m->bm[0]; bm[1]=m->bm[1];
+  if (v) bm[(k-1)/64]|=bit; else bm[(k-1)/64]&=~bit;
+  if (bm[1]) bm[0]|=(uint64_t)1<<63; else bm[0]&=~((uint64_t)1<<63);
+
+  /* MTI and bitmaps */
+  h = s->bcd ? 2 : 4;
+  memcpy(o->hdr,m->b,h);
+  h+=i8_putbm(s,o->hdr+h,bm[0]);
+  if (bm[1]) h+=i8_putbm(s,o->hdr+h,bm[1]);
+
+  /* span of old field (or insertion point) */
+  if (i8_has(m,k)) { p=m->off[k]; e=p+m->hl[k]+m->len[k]; }
+  else
+  {
+    for (j=k+1; j <= I8_MAXFIELD && !i8_has(m,j); j++) ;
+    p=e= j <= I8_MAXFIELD ? m->off[j] : m->l;
+  }
+
+  n=0;
+  o->iov[n].iov_base=o->hdr; o->iov[n++].iov_len=h;
+  if (p > m->foff) { o->iov[n].iov_base=(void*)(m->b+m->foff); o->iov[n++].iov_len=p-m->foff; }
+  if (v)
+  {
+    if (f->var != I8_FIX)
+    {
+      i8_putnum(s,o->pfx,f->var,l);
+      o->iov[n].iov_base=o->pfx; o->iov[n++].iov_len=i8_pfxlen(s,f);
+      h+=i8_pfxlen(s,f);
+    }
+    if (b > 0) { o->iov[n].iov_base=(void*)v; o->iov[n++].iov_len=b; }
+    h+=b;
+  }
+  if (m->l > e) { o->iov[n].iov_base=(void*)(m->b+e); o->iov[n++].iov_len=m->l-e; }
+  o->niov=n;
+  return h+(p-m->foff)+(m->l-e);
+}
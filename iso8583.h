@@ -0,0 +1,86 @@
+#ifndef __COMMON_ISO8583_H
+#define __COMMON_ISO8583_H
+/*!
+	\file
+	\brief ISO 8583 message codec with zero-copy field views (header)
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include "tlv.h"
+
+#define I8_MAXFIELD 128     /*!< \brief last field (with secondary bitmap) */
+#define I8_ICC      55      /*!< \brief ICC system related data (TLV) */
+
+/* field formats */
+#define I8_N        1       /*!< \brief numeric (ASCII digit or BCD nibble) */
+#define I8_AN       2       /*!< \brief characters (byte each) */
+#define I8_B        3       /*!< \brief binary (length in bytes) */
+
+/* field length types */
+#define I8_FIX      0       /*!< \brief fixed length */
+#define I8_LL       2       /*!< \brief variable, 2 digits length prefix */
+#define I8_LLL      3       /*!< \brief variable, 3 digits length prefix */
+
+/*!
+	\struct I8field
+	\brief definition of field
+*/
+typedef struct
+{
+  uchar fmt;                /*!< \brief I8_N, I8_AN, I8_B (0 not defined) */
+  uchar var;                /*!< \brief I8_FIX, I8_LL, I8_LLL */
+  ushort max;               /*!< \brief length (fixed) or max length, in digits, characters or bytes */
+} I8field;
+
+/*!
+	\struct I8spec
+	\brief message specification
+*/
+typedef struct
+{
+  uchar bcd;                /*!< \brief MTI, numeric fields and length prefixes in BCD (else ASCII) */
+  uchar hexbm;              /*!< \brief bitmaps as 16 hex characters (else 8 bytes) */
+  const I8field *f;         /*!< \brief fields 0..I8_MAXFIELD */
+} I8spec;
+
+/*!
+	\struct I8msg
+	\brief parsed message (view of message buffer)
+*/
+typedef struct
+{
+  const uchar *b;           /*!< \brief message */
+  int l;                    /*!< \brief message length */
+  const I8spec *s;          /*!< \brief specification */
+  int foff;                 /*!< \brief offset of first field after bitmaps */
+  uint64_t bm[2];           /*!< \brief bitmaps (bit 63 of bm[0] is field 1) */
+  int off[I8_MAXFIELD+1];   /*!< \brief offsets of present fields (length prefix) */
+  uchar hl[I8_MAXFIELD+1];  /*!< \brief lengths of length prefixes */
+  ushort len[I8_MAXFIELD+1];/*!< \brief data lengths (bytes) */
+} I8msg;
+
+/*!
+	\struct I8out
+	\brief rebuilt message as scatter-gather list (writev)
+*/
+typedef struct
+{
+  uchar hdr[4+32];          /*!< \brief MTI and bitmaps */
+  uchar pfx[4];             /*!< \brief length prefix of new field */
+  struct iovec iov[5];      /*!< \brief parts of message */
+  int niov;                 /*!< \brief number of parts */
+} I8out;
+
+__BEGIN_DECLS
+EXPORT extern const I8spec i8_ascii87;
+EXPORT extern const I8spec i8_bcd87;
+EXPORT int i8_parse(I8msg *m, const I8spec *s, const uchar *b, int l);
+EXPORT int i8_has(const I8msg *m, int k);
+EXPORT int i8_get(const I8msg *m, int k, const uchar **v);
+EXPORT int i8_view(const I8msg *m, int k, TLVbuf *tb);
+EXPORT int i8_replace(const I8msg *m, int k, const uchar *v, int l, I8out *o);
+__END_DECLS
+
+#endif
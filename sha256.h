@@ -0,0 +1,24 @@
+#ifndef __COMMON_SHA256_H__
+#define __COMMON_SHA256_H__
+/*!
+	\file
+	\brief SHA-256 implementation (FIPS 180-4)
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#define SHA256_LEN 32
+
+typedef struct {
+	uint32_t h[8];
+	uint64_t n;		/* number of hashed bytes */
+	unsigned char buf[64];
+} sha256_ctx;
+
+void sha256_init(sha256_ctx *ctx);
+void sha256_update(sha256_ctx *ctx, const void *data, size_t len);
+void sha256_final(sha256_ctx *ctx, unsigned char *md);
+void sha256(const void *data, size_t len, unsigned char *md);
+
+#endif
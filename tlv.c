@@ -11,6 +11,12 @@
 #include <errno.h>
 #include "tlv.h"
 
+#if defined(__GNUC__)
+#define tlv_prefetch(p) __builtin_prefetch(p)
+#else
+#define tlv_prefetch(p)
+#endif
+
 /*
  TLV stands for Tag Length Value
 
@@ -38,6 +44,12 @@ Length Coding
   byte 0
     bit7   0  length is coded on bits 6-0
            1  length is coded on subsequent (bits 6-0) bytes
+    0x80      indefinite length (BER, constructed only): value ends
+              with end-of-contents 0x00 0x00
+
+  TLV of indefinite length is parsed with length of value up to
+  (excluding) end-of-contents, so when traversing the buffer
+  end-of-contents is skipped as padding.
 
 Examples of tag coding:
 	0x81: context class,primitive (EMV, Amount Binary)
@@ -101,28 +113,87 @@ int tlv_tag(const uchar xdata *rbuf, int rlen, ushort xdata *tag)
   if ((rbuf[i]&TAG_SEQ) == TAG_SEQ)
   {
     do
-      { i++; *tag <<= 8; *tag |= rbuf[i]; }
-    while(i < rlen && (rbuf[i]&TAG_NEXT) != 0);
-    if (i >= rlen || (rbuf[i]&TAG_NEXT) != 0)
     {
-      DEBUG1(dbgprn("tag=%x short buf, i=%d >= rlen=%d\n",*tag,i,rlen);)
-      return -1;
+      if (++i >= rlen)
+      {
+        DEBUG1(dbgprn("tag=%x short buf, i=%d >= rlen=%d\n",*tag,i,rlen);)
+        return -1;
+      }
+      *tag <<= 8; *tag |= rbuf[i];
     }
+    while ((rbuf[i]&TAG_NEXT) != 0);
   }
   i++;
   if (i-j > 2) { DEBUG1(dbgprn("tag=%02x.. bytes %d\n",*tag,i-j);) *tag=0; }
   return i;
 }
 
+/*!
+    \brief scan value of indefinite length for its end-of-contents
+    \param s scan state (initialized with depth=1, off=skip=0)
+    \param b binary buffer (next part of value)
+    \param l binary buffer length
+    \return -2 wrong coding, otherwise number of consumed bytes
+
+    Scan is finished when s->depth is 0, then s->off is length of value.
+    Otherwise buffer was too short, scan is continued with next part
+    of value beginning from first not consumed byte (bytes of headers
+    are consumed only when whole header is in buffer).
+*/
+int tlv_eocscan(TLVeoc *s, const uchar xdata *b, int l)
+{
+  int i=0,j,n;
+  unsigned long len;
+  while (s->depth > 0)
+  {
+    if (s->skip > 0)
+    {
+      n = s->skip < (unsigned long)(l-i) ? (int)s->skip : l-i;
+      i+=n; s->off+=n; s->skip-=n;
+      if (s->skip > 0) break;
+      continue;
+    }
+    if (l-i < 2) break;
+    if (b[i] == 0x00)
+    {
+      if (b[i+1] != 0x00) return -2;
+      i+=2;
+      if (--s->depth > 0) s->off+=2;
+      continue;
+    }
+    j=i;
+    if ((b[j]&TAG_SEQ) == TAG_SEQ)
+      do j++; while (j < l && (b[j]&TAG_NEXT) != 0);
+    if (++j >= l) break;
+    if (b[j] == LEN_BYTES)
+    {
+      if ((b[i]&TAG_CONSTR) == 0) return -2;
+      s->depth++; j++;
+    }
+    else if (b[j]&LEN_BYTES)
+    {
+      n=b[j++]&0x7f;
+      if (n > 4) return -2;
+      if (j+n > l) break;
+      for (len=0; n > 0; n--) len=(len<<8)|b[j++];
+      s->skip=len;
+    }
+    else s->skip=b[j++];
+    s->off+=j-i; i=j;
+  }
+  return i;
+}
+
 /*!
     \brief parse binary buffer into tag,length,value
     \param rbuf binary buffer
     \param rlen binary buffer length
     \param tlv pointer to tlv structure
-    \return -1 negative rlen, 0 no data in rbuf, 1 success
+    \return -2 wrong length coding, -1 negative rlen or short buffer, 0 no data in rbuf, 1 success
 */
 int tlv_tlv0(const uchar xdata *rbuf, int rlen, TLV xdata *tlv)
 {
+  const uchar xdata *t0=rbuf;
   int i;
   if ((i=tlv_tag(rbuf,rlen,&tlv->t)) <= 0) return i;
   rlen -= i; rbuf+=i;
@@ -131,7 +202,21 @@ int tlv_tlv0(const uchar xdata *rbuf, int rlen, TLV xdata *tlv)
 
   tlv->l=i=*rbuf;
   rbuf++; rlen--;
-  if (i&LEN_BYTES)
+  if (i == LEN_BYTES)
+  {
+    TLVeoc s;
+    while (*t0 == 0x00) t0++;
+    if ((*t0&TAG_CONSTR) == 0)
+      { DEBUG1(dbgprn("tag=%x primitive indefinite length\n",tlv->t);) return -2; }
+    s.depth=1; s.off=s.skip=0;
+    if (tlv_eocscan(&s,rbuf,rlen) < 0) return -2;
+    if (s.depth > 0)
+      { DEBUG1(dbgprn("tag=%x short buf, no end-of-contents\n",tlv->t);) return -1; }
+    if (s.off > 0xffff)
+      { DEBUG1(dbgprn("tag=%x length %lu\n",tlv->t,s.off);) return -2; }
+    tlv->l=s.off;
+  }
+  else if (i&LEN_BYTES)
   {
     i&=0x7f;
     if (i > rlen)
@@ -179,7 +264,7 @@ int tlv_parseLTV(const uchar xdata *rbuf, int rlen, TLV xdata *tlv)
   if (rlen < 6) return -1;
   if (sscanf(castptr(char*,rbuf),"%04u",&x)!=1) return -1;
 	tlv->l=x;
-  if (sscanf(castptr(char*,rbuf),"%02u",&x)!=1) return -1;
+  if (sscanf(castptr(char*,rbuf+4),"%02u",&x)!=1) return -1;
 	tlv->t=x;
   if (tlv->l < 2) return -1;
   tlv->v=(uchar*)rbuf+6; tlv->l-=2;
@@ -288,6 +373,53 @@ int tb_find(const TLVbuf xdata *tb, ushort tag, TLV xdata *tlv)
   return tlv_find(tb->buf,tb->len,tag,tlv);
 }
 
+/*!
+    \brief find tags in one buffer (single walk for all tags, first occurrence of each)
+    \return number of found tags
+*/
+static int tlv_findk(const uchar xdata *b, int l, const ushort *tags, int k, TLV xdata *tlv)
+{
+  TLV t;
+  int j,f=0;
+  for (j=0; j < k; j++) { memset((char*)&tlv[j],0,sizeof(TLV)); tlv[j].t=tags[j]; }
+  while (f < k && tlv_parseTLV(b,l,&t) > 0)
+  {
+    for (j=0; j < k; j++)
+      if (t.t == tags[j] && tlv[j].v == NULL && tags[j] != 0) { tlv[j]=t; f++; }
+    t.v += t.l;
+    l -= t.v - b; b = t.v;
+  }
+  return f;
+}
+
+/*!
+    \brief find tags in many TLVbufs (batch lookup with group prefetching)
+    \param tbs TLVbufs to search
+    \param n number of TLVbufs
+    \param tags requested tag IDs
+    \param k number of tags
+    \param tlv output table of n*k TLVs (row per TLVbuf, not found ones as by tb_find)
+    \return number of found tags
+
+    TLVbufs are searched in groups: while group is searched, buffer heads
+    of next group and TLVbuf structures of group after it are prefetched,
+    so cache misses of different TLVbufs overlap instead of serializing.
+*/
+int tb_findn(const TLVbuf xdata *const *tbs, int n, const ushort *tags, int k, TLV xdata *tlv)
+{
+  int g,i,r=0;
+  for (i=0; i < n && i < 2*TB_FINDGROUP; i++) tlv_prefetch(tbs[i]);
+  for (i=0; i < n && i < TB_FINDGROUP; i++) tlv_prefetch(tbs[i]->buf);
+  for (g=0; g < n; g+=TB_FINDGROUP)
+  {
+    for (i=g+2*TB_FINDGROUP; i < n && i < g+3*TB_FINDGROUP; i++) tlv_prefetch(tbs[i]);
+    for (i=g+TB_FINDGROUP; i < n && i < g+2*TB_FINDGROUP; i++) tlv_prefetch(tbs[i]->buf);
+    for (i=g; i < n && i < g+TB_FINDGROUP; i++)
+      r+=tlv_findk(tbs[i]->buf,tbs[i]->len,tags,k,tlv+(long)i*k);
+  }
+  return r;
+}
+
 /*!
     \brief delete tag from TLVbuf buffer
     \param tb pointer to TLVbuf structure
@@ -297,16 +429,26 @@ int tb_find(const TLVbuf xdata *tb, ushort tag, TLV xdata *tlv)
 int tb_del(TLVbuf xdata *tb, ushort t)
 {
   TLV tlv;
+  uchar xdata *b=tb->buf,*s;
+  int l=tb->len,i;
+  ushort tag;
   DEBUG2(dbgprn("tb_del(%x)\n",t);)
-  if (!tb_find(tb,t,&tlv)) { DEBUG2(dbgprintf("not found\n");) return 0; }
-  DEBUG2(dbgprintf("found, deleting\n");)
-  if (tlv.l > 0x7f) { tlv.l++; tlv.v--; }
-  if (tlv.l > 0xff) { tlv.l++; tlv.v--; }
-  tlv.l+=2; tlv.v-=2;
-  if (tlv.t > 0xff) { tlv.l++; tlv.v--; }
-  memcpy(tlv.v,tlv.v+tlv.l,tb->buf+tb->len-(tlv.v+tlv.l));
-  tb->len -= tlv.l;
-  return 1;
+  while (tlv_parseTLV(b,l,&tlv) > 0)
+  {
+    for (s=b; *s == 0x00; s++) ;
+    tlv.v += tlv.l;
+    l -= tlv.v - b; b = tlv.v;
+    if (tlv.t != t) continue;
+    DEBUG2(dbgprintf("found, deleting\n");)
+    /* indefinite length: remove also end-of-contents */
+    i=tlv_tag(s,b-s,&tag);
+    if (s[i] == LEN_BYTES) b+=2;
+    memmove(s,b,tb->buf+tb->len-b);
+    tb->len -= b-s;
+    return 1;
+  }
+  DEBUG2(dbgprintf("not found\n");)
+  return 0;
 }
 
 /*!
@@ -464,6 +606,159 @@ int tlv_check(const uchar xdata *b, int l) reentrant
   return i==0;
 }
 
+/*!
+    \brief diagnose tag at beginning of binary buffer (after padding)
+    \param b binary buffer
+    \param l binary buffer length
+    \param t output tlv (t->t set when tag is parsed)
+    \param pos output offset of wrong byte
+    \return 0 tag is correct, TLV_E* error code
+*/
+static int tlv_diag1(const uchar xdata *b, int l, TLV *t, int *pos)
+{
+  TLVeoc s;
+  int i,n;
+  *pos=0; t->t=0;
+  if ((i=tlv_tag(b,l,&t->t)) < 0) { *pos=l; return TLV_ETAG; }
+  if (i >= l) { *pos=i; return TLV_ELEN; }
+  n=b[i++];
+  if (n == LEN_BYTES)
+  {
+    if ((b[0]&TAG_CONSTR) == 0) { *pos=i-1; return TLV_EINDEF; }
+    s.depth=1; s.off=s.skip=0;
+    if (tlv_eocscan(&s,b+i,l-i) < 0) { *pos=i+s.off; return TLV_EEOC; }
+    if (s.depth > 0) { *pos=l; return TLV_ENOEOC; }
+    if (s.off > 0xffff) { *pos=i-1; return TLV_ELENGTH; }
+    t->l=s.off;
+  }
+  else if (n&LEN_BYTES)
+  {
+    n&=0x7f;
+    if (n > 2) { *pos=i-1; return TLV_ELENGTH; }
+    if (n > l-i) { *pos=l; return TLV_ELEN; }
+    for (t->l=0; n > 0; n--) { t->l<<=8; t->l|=b[i++]; }
+  }
+  else t->l=n;
+  if (t->l > l-i) { *pos=i; return TLV_EVALUE; }
+  t->v=(uchar*)b+i;
+  return 0;
+}
+
+/*!
+    \brief parse binary buffer into tag,length,value, on failure fill error
+    \param rbuf binary buffer
+    \param rlen binary buffer length
+    \param tlv pointer to tlv structure
+    \param err output error (may be NULL)
+    \return see tlv_parseTLV()
+*/
+int tlv_parseTLVe(const uchar xdata *rbuf, int rlen, TLV xdata *tlv, TLVerr *err)
+{
+  const uchar xdata *b=rbuf;
+  int i;
+  TLV t;
+  if ((i=tlv_parseTLV(rbuf,rlen,tlv)) >= 0 || err == NULL) return i;
+  memset(err,0,sizeof(TLVerr));
+  if (rlen < 0) { err->code=TLV_ELEN; return i; }
+  while (b < rbuf+rlen && *b == 0x00) b++;
+  err->code=tlv_diag1(b,rbuf+rlen-b,&t,&err->off);
+  err->off+=b-rbuf; err->tag=t.t;
+  return i;
+}
+
+/*!
+    \brief check consistency of binary buffer (TLV structured), on failure fill error
+    \param b pointer to binary buffer to check
+    \param l binary buffer length
+    \param err output error (may be NULL)
+    \return 0 - buffer is not consistent, 1 - buffer is consistent
+
+    Buffer is parsed again (diagnostically) only if it is not consistent.
+*/
+int tlv_checke(const uchar xdata *b, int l, TLVerr *err)
+{
+  const uchar xdata *s=b,*end[TLV_ERRDEPTH+1];
+  int d=0,p;
+  TLV t;
+  if (tlv_check(b,l)) return 1;
+  if (err == NULL) return 0;
+  memset(err,0,sizeof(TLVerr));
+  if (l < 0) { err->code=TLV_ELEN; return 0; }
+  end[0]=b+l;
+  for (;;)
+  {
+    while (b < end[d] && *b == 0x00) b++;
+    if (b == end[d])
+    {
+      if (d == 0) break;
+      d--;
+      continue;
+    }
+    err->depth=d;
+    if ((err->code=tlv_diag1(b,end[d]-b,&t,&p)) != 0)
+      { err->off=b-s+p; err->tag=t.t; return 0; }
+    /* as tlv_check: tag over 2 bytes (t.t 0) is not descended into */
+    if ((tlv_tag0(t.t)&TAG_CONSTR) == 0) { b=t.v+t.l; continue; }
+    if (d == TLV_ERRDEPTH)
+      { err->code=TLV_EDEPTH; err->off=b-s; err->tag=t.t; return 0; }
+    if (d < TLV_ERRPATH) err->path[d]=t.t;
+    end[++d]=t.v+t.l;
+    b=t.v;
+  }
+  /* not reached, walk applies rules of tlv_check */
+  err->code=TLV_EDEPTH; err->depth=0;
+  return 0;
+}
+
+/*!
+    \brief parse ascii buffer into length,tag,value, on failure fill error
+    \param rbuf binary buffer
+    \param rlen binary buffer length
+    \param tlv pointer to tlv structure
+    \param err output error (may be NULL)
+    \return see tlv_parseLTV()
+*/
+int tlv_parseLTVe(const uchar xdata *rbuf, int rlen, TLV xdata *tlv, TLVerr *err)
+{
+  int i,x;
+  if ((i=tlv_parseLTV(rbuf,rlen,tlv)) >= 0 || err == NULL) return i;
+  memset(err,0,sizeof(TLVerr));
+  if (rlen < 6) { err->code=TLV_ELEN; err->off=rlen < 0 ? 0 : rlen; return i; }
+  for (i=0; i < 6; i++)
+    if (rbuf[i] < '0' || rbuf[i] > '9') { err->code=TLV_ELTV; err->off=i; return -1; }
+  err->tag=(rbuf[4]-'0')*10+rbuf[5]-'0';
+  x=(rbuf[0]-'0')*1000+(rbuf[1]-'0')*100+(rbuf[2]-'0')*10+rbuf[3]-'0';
+  if (x < 2) err->code=TLV_ELTV;
+  else { err->code=TLV_EVALUE; err->off=6; }
+  return -1;
+}
+
+/*!
+    \brief build table of tags of binary buffer (TLV structured, top level only)
+    \param b pointer to binary buffer
+    \param l binary buffer length (max 0xffff)
+    \param e output tag table
+    \param n tag table size
+    \return negative - failure (-1 buffer not consistent, -EPIPE table too short, -EINVAL length over 0xffff), number of tags
+*/
+int tlv_index(const uchar xdata *b, int l, TLVent *e, int n)
+{
+  const uchar xdata *s=b,*p;
+  int i,k=0;
+  TLV t;
+  if (l > 0xffff) return -EINVAL;
+  while ((i=tlv_parseTLV(b,l,&t)) > 0)
+  {
+    if (k == n) return -EPIPE;
+    for (p=b; *p == 0x00; p++) ;
+    e[k].t=t.t; e[k].o=p-s; e[k].h=t.v-p; e[k].l=t.l; k++;
+    t.v += t.l;
+    l -= t.v - b; b = t.v;
+  }
+  if (i < 0) return i;
+  return k;
+}
+
 /*!
     \brief find tag on TLVbuf buffer
     \param tb TLVbuf to search
@@ -478,6 +773,18 @@ int tb_findr(TLVbuf xdata *tb,ushort tag,TLV *tlv)
 	return priv_findr(tb->buf,tb->len,tag,tlv);
 }
 
+/*!
+    \brief build table of tags of TLVbuf
+    \param tb TLVbuf to index
+    \param e output tag table
+    \param n tag table size
+    \return negative - failure, number of tags
+*/
+int tb_index(const TLVbuf xdata *tb, TLVent *e, int n)
+{
+  return tlv_index(tb->buf,tb->len,e,n);
+}
+
 /*!
     \brief print all tags information from binary TLVbuf (for debug purposes)
     \param tb TLVbuf to print
@@ -487,6 +794,100 @@ void tb_print(TLVbuf xdata *tb)
   priv_printtags(tb->buf,tb->len,0);
 }
 
+/*!
+    \brief initialize streaming encoder
+    \param e pointer to TLVenc structure
+    \param wr output callback (gets encoded bytes in order)
+    \param ctx callback context
+*/
+void te_init(TLVenc *e, tlv_writecb wr, void *ctx)
+{
+  memset(e,0,sizeof(TLVenc));
+  e->wr=wr; e->ctx=ctx;
+}
+
+/*!
+    \brief write bytes to encoder output
+    \return 0 success, negative failure (callback error)
+*/
+static int te_out(TLVenc *e, const uchar *b, int l)
+{
+  int r;
+  if (l == 0) return 0;
+  if ((r=e->wr(e->ctx,b,l)) < 0) return r;
+  e->len+=l;
+  return 0;
+}
+
+/*!
+    \brief begin constructed tag of indefinite length
+    \param e pointer to TLVenc structure
+    \param tag constructed tag ID
+    \return 0 success, -EINVAL invalid or primitive tag, -ELOOP too deep, negative callback error
+*/
+int te_begin(TLVenc *e, ushort tag)
+{
+  uchar h[3];
+  int i;
+  if ((i=tlv_buildT(h,sizeof(h),tag)) == 0 || (tlv_tag0(tag)&TAG_CONSTR) == 0)
+    { DEBUG1(dbgprn("tag=%02x WRONG\n",tag);) return -EINVAL; }
+  if (e->depth == TE_MAXDEPTH) return -ELOOP;
+  h[i++]=LEN_BYTES;
+  if ((i=te_out(e,h,i)) < 0) return i;
+  e->depth++;
+  return 0;
+}
+
+/*!
+    \brief put tag (of definite length) into current constructed tag
+    \param e pointer to TLVenc structure
+    \param tlv pointer to TLV structure to put (v=NULL puts zeros)
+    \return 0 success, -EINVAL invalid tag, negative callback error
+*/
+int te_put(TLVenc *e, const TLV *tlv)
+{
+  static const uchar zero[32];
+  uchar h[5];
+  int i,n,r;
+  if ((i=tlv_buildT(h,sizeof(h),tlv->t)) == 0)
+    { DEBUG1(dbgprn("tag=%02x WRONG\n",tlv->t);) return -EINVAL; }
+  if (tlv->l > 0xff) { h[i++]=0x82; h[i++]=tlv->l>>8; }
+  else if (tlv->l > 0x7f) h[i++]=0x81;
+  h[i++]=tlv->l;
+  if ((r=te_out(e,h,i)) < 0) return r;
+  if (tlv->v) return te_out(e,tlv->v,tlv->l);
+  for (i=tlv->l; i > 0; i-=n)
+    if ((r=te_out(e,zero,n=i<(int)sizeof(zero)?i:(int)sizeof(zero))) < 0) return r;
+  return 0;
+}
+
+/*!
+    \brief put already encoded TLV structured data into current constructed tag
+    \param e pointer to TLVenc structure
+    \param b binary buffer (TLV structured)
+    \param l binary buffer length
+    \return 0 success, negative callback error
+*/
+int te_write(TLVenc *e, const uchar *b, int l)
+{
+  return te_out(e,b,l);
+}
+
+/*!
+    \brief end current constructed tag (write end-of-contents)
+    \param e pointer to TLVenc structure
+    \return 0 success, -EINVAL no open tag, negative callback error
+*/
+int te_end(TLVenc *e)
+{
+  static const uchar eoc[2];
+  int r;
+  if (e->depth == 0) return -EINVAL;
+  if ((r=te_out(e,eoc,2)) < 0) return r;
+  e->depth--;
+  return 0;
+}
+
 /*!
     \brief initialize fields of TLVbuf
     \param tb pointer to TLVbuf structure
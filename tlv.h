@@ -20,7 +20,21 @@ typedef unsigned char uchar;
 #define TAG_SEQ     0x1f /*!< \brief subsequence indicator tag byte for t[0] */
 #define TAG_NEXT    0x80 /*!< \brief subsequence indicator tag byte for t[>0] */
 #define TAG_CONSTR  0x20 /*!< \brief constructed tag */
-#define LEN_BYTES   0x80 /*!< \brief length coded on l[0]&7F bytes */
+#define LEN_BYTES   0x80 /*!< \brief length coded on l[0]&7F bytes (0x80 alone: indefinite length) */
+#define TE_MAXDEPTH 16   /*!< \brief max nesting of streaming encoder */
+#define TLV_ERRPATH 8    /*!< \brief max tags of path kept in TLVerr */
+#define TLV_ERRDEPTH 64  /*!< \brief max nesting diagnosed */
+#define TB_FINDGROUP 8   /*!< \brief TLVbufs prefetched together by tb_findn */
+
+#define TLV_ETAG    1    /*!< \brief tag cut by end of buffer */
+#define TLV_ELEN    2    /*!< \brief length missing or cut by end of buffer */
+#define TLV_ELENGTH 3    /*!< \brief length coding not supported (over 2 bytes or 0xffff) */
+#define TLV_EVALUE  4    /*!< \brief value exceeds buffer (or enclosing tag) */
+#define TLV_EINDEF  5    /*!< \brief indefinite length of primitive tag */
+#define TLV_EEOC    6    /*!< \brief wrong end-of-contents */
+#define TLV_ENOEOC  7    /*!< \brief missing end-of-contents */
+#define TLV_EDEPTH  8    /*!< \brief nesting too deep to diagnose */
+#define TLV_ELTV    9    /*!< \brief LTV length or tag not decimal, length < 2 */
 
 /*!
    \struct TLV
@@ -45,25 +59,93 @@ typedef struct
 } TLVbuf;
 
 
+/*!
+	\struct TLVent
+	\brief tag table entry - position of TLV in binary buffer
+*/
+typedef struct
+{
+  ushort t;   /*!< \brief Tag ID */
+  ushort o;   /*!< \brief offset of TLV (first tag byte) in buffer */
+  ushort h;   /*!< \brief length of tag and length bytes (value at o+h) */
+  ushort l;   /*!< \brief Length of data */
+} TLVent;
+
+
+/*!
+	\struct TLVeoc
+	\brief state of end-of-contents scan of indefinite length value
+*/
+typedef struct
+{
+  unsigned long off;  /*!< \brief scanned length of value */
+  unsigned long skip; /*!< \brief bytes of current definite value still to skip */
+  int depth;          /*!< \brief open indefinite lengths, 0 when scan is done */
+} TLVeoc;
+
+/*!
+    \brief output callback of streaming encoder
+    \return negative on failure
+*/
+typedef int (*tlv_writecb)(void *ctx, const uchar *b, int l);
+
+/*!
+	\struct TLVenc
+	\brief streaming encoder (constructed tags of indefinite length)
+*/
+typedef struct
+{
+  tlv_writecb wr;     /*!< \brief output callback */
+  void *ctx;          /*!< \brief output callback context */
+  int depth;          /*!< \brief open constructed tags */
+  unsigned long len;  /*!< \brief number of bytes written */
+} TLVenc;
+
+/*!
+	\struct TLVerr
+	\brief parse error location (filled only on failure)
+*/
+typedef struct
+{
+  int code;                 /*!< \brief TLV_E* */
+  int off;                  /*!< \brief offset of wrong byte in buffer */
+  ushort tag;               /*!< \brief tag being parsed (0 if unknown) */
+  int depth;                /*!< \brief number of enclosing constructed tags */
+  ushort path[TLV_ERRPATH]; /*!< \brief enclosing tags, outermost first */
+} TLVerr;
+
+
 /* on other systems must be compiled into project */
 __BEGIN_DECLS
 EXPORT int tlv_tag0(ushort tag);
 EXPORT int tlv_tag(const uchar xdata *rbuf, int rlen, ushort xdata *tag);
+EXPORT int tlv_eocscan(TLVeoc *s, const uchar xdata *b, int l);
 EXPORT int tlv_tlv0(const uchar xdata *rbuf, int rlen, TLV xdata *tlv);
 EXPORT int tlv_parseTLV(const uchar xdata *rbuf, int rlen, TLV xdata *tlv);
 EXPORT int tlv_parseLTV(const uchar xdata *rbuf, int rlen, TLV xdata *tlv);
+EXPORT int tlv_parseTLVe(const uchar xdata *rbuf, int rlen, TLV xdata *tlv, TLVerr *err);
+EXPORT int tlv_parseLTVe(const uchar xdata *rbuf, int rlen, TLV xdata *tlv, TLVerr *err);
 EXPORT int tlv_buildT(uchar xdata *rbuf, int rlen, ushort tag);
 EXPORT int tlv_find(const uchar xdata *b, int l, ushort t, TLV xdata *tlv);
 EXPORT int ltv_find(const uchar xdata *b, int l, ushort t, TLV xdata *tlv);
 EXPORT int tlv_check(const uchar xdata *b, int l) reentrant;
+EXPORT int tlv_checke(const uchar xdata *b, int l, TLVerr *err);
+EXPORT int tlv_index(const uchar xdata *b, int l, TLVent *e, int n);
 EXPORT void tlv_print(TLV xdata *tlv);
 EXPORT int tb_find(const TLVbuf xdata *tb, ushort t, TLV xdata *tlv);
+EXPORT int tb_findn(const TLVbuf xdata *const *tbs, int n, const ushort *tags, int k, TLV xdata *tlv);
 EXPORT int tb_findr(TLVbuf xdata *tb,ushort tag,TLV *tlv) reentrant;
+EXPORT int tb_index(const TLVbuf xdata *tb, TLVent *e, int n);
 EXPORT int tb_add(TLVbuf xdata *tb, TLV xdata *tlv, uchar ovr);
 EXPORT int tb_del(TLVbuf xdata *tb, ushort t);
 EXPORT int tb_addbuf(TLVbuf xdata *tb,const uchar xdata *rbuf,int rlen,uchar ovr);
 EXPORT void tb_addtags(TLVbuf *dst,TLVbuf *src,uchar *buf,ushort len);
 EXPORT void tb_print(TLVbuf xdata *tb);
+EXPORT void te_init(TLVenc *e, tlv_writecb wr, void *ctx);
+EXPORT int te_begin(TLVenc *e, ushort tag);
+EXPORT int te_put(TLVenc *e, const TLV *tlv);
+EXPORT int te_write(TLVenc *e, const uchar *b, int l);
+EXPORT int te_end(TLVenc *e);
 EXPORT void tb_init(TLVbuf xdata *tb,uchar xdata *buf,ushort size);
 EXPORT void tb_alloc(TLVbuf xdata *tb,ushort size);
 #ifdef CONFIG_DEBUG_HEAP
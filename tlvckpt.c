@@ -0,0 +1,205 @@
+/*!
+	\file
+	\brief Checkpoint/restore of TLVbuf contexts with tag index
+
+	Batch of contexts is stored as one image:
+	  header    - magic, number of contexts, size, CRC-32C of the rest
+	  directory - per context: offset and length of data and of index
+	  indexes   - per context: top level tags (TLVent) sorted by tag
+	  data      - TLV bytes of contexts
+
+	All offsets are relative to batch start, so image is restored by
+	reading (or mapping) it and pointing TLVbufs into it, no parsing
+	and no copying. Contexts restored from mapped image may be changed
+	only in place (mlen=len), context to be extended should be copied
+	to its own buffer. Batches are appended to file, one write each.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include "crc32c.h"
+#include "tlvckpt.h"
+
+/*!
+    \brief compute image size of batch
+    \param tbs contexts
+    \param n number of contexts
+    \return negative - failure (-EINVAL broken context, -EPIPE too many tags, -EFBIG batch over 4GB), size
+*/
+int64_t tck_size(const TLVbuf *tbs, int n)
+{
+  TLVent e[TCK_MAXTAGS];
+  int64_t size=sizeof(TLVckhdr)+(int64_t)n*sizeof(TLVckdir);
+  int i,k;
+  for (i=0; i < n; i++)
+  {
+    if ((k=tb_index(&tbs[i],e,TCK_MAXTAGS)) < 0) return k==-1 ? -EINVAL : k;
+    size+=k*sizeof(TLVent)+tbs[i].len;
+  }
+  return size > 0xffffffff ? -EFBIG : size;
+}
+
+/*!
+    \brief sort index by tag (insertion sort, keeps order of equal tags)
+*/
+static void tck_sort(TLVent *e, int n)
+{
+  TLVent x;
+  int i,j;
+  for (i=1; i < n; i++)
+  {
+    x=e[i];
+    for (j=i; j > 0 && e[j-1].t > x.t; j--) e[j]=e[j-1];
+    e[j]=x;
+  }
+}
+
+/*!
+    \brief build image of batch
+    \param tbs contexts
+    \param n number of contexts
+    \param img output image (8 bytes aligned)
+    \param isize image buffer size
+    \return negative - failure (see tck_size, -ENOSPC image buffer too short), image size
+*/
+int64_t tck_build(const TLVbuf *tbs, int n, uchar *img, size_t isize)
+{
+  TLVckhdr *h=(TLVckhdr*)img;
+  TLVckdir *d=(TLVckdir*)(h+1);
+  uint64_t eo,o;
+  int64_t size;
+  int i,k;
+
+  if ((size=tck_size(tbs,n)) < 0) return size;
+  if ((uint64_t)size > isize) return -ENOSPC;
+  eo=sizeof(TLVckhdr)+(uint64_t)n*sizeof(TLVckdir);
+  for (i=0; i < n; i++)
+  {
+    k=tb_index(&tbs[i],(TLVent*)(img+eo),TCK_MAXTAGS);
+    tck_sort((TLVent*)(img+eo),k);
+    d[i].ioff=eo; d[i].nent=k; d[i].res=0;
+    eo+=k*sizeof(TLVent);
+  }
+  for (i=0,o=eo; i < n; i++)
+  {
+    d[i].off=o; d[i].len=tbs[i].len;
+    if (tbs[i].len) memcpy(img+o,tbs[i].buf,tbs[i].len);
+    o+=tbs[i].len;
+  }
+  memcpy(h->magic,TCK_MAGIC,4);
+  h->n=n; h->size=size;
+  h->crc=crc32c(0,h+1,size-sizeof(TLVckhdr));
+  h->hcrc=0; h->hcrc=crc32c(0,h,sizeof(TLVckhdr));
+  return size;
+}
+
+/*!
+    \brief write batch to file (append image with one write)
+    \param fd file descriptor
+    \param tbs contexts
+    \param n number of contexts
+    \return 0 success, negative failure (see tck_build, -ENOMEM, -errno of write)
+*/
+int tck_write(int fd, const TLVbuf *tbs, int n)
+{
+  uchar *img;
+  int64_t size;
+  ssize_t r=0;
+  size_t o;
+
+  if ((size=tck_size(tbs,n)) < 0) return size;
+  if ((img=(uchar*)malloc(size)) == NULL) return -ENOMEM;
+  tck_build(tbs,n,img,size);
+  for (o=0; o < (size_t)size; o+=r)
+  {
+    if ((r=write(fd,img+o,size-o)) < 0)
+    {
+      if (errno == EINTR) { r=0; continue; }
+      r=-errno;
+      break;
+    }
+  }
+  free(img);
+  return r < 0 ? r : 0;
+}
+
+/*!
+    \brief check batch image
+    \param img image (8 bytes aligned)
+    \param size available bytes (may contain more batches)
+    \param n output number of contexts
+    \return negative - failure (-EPIPE image too short, -EINVAL not a batch, -EBADMSG wrong CRC), batch size
+*/
+int64_t tck_check(const uchar *img, size_t size, int *n)
+{
+  TLVckhdr h;
+  uint32_t crc;
+  if (size < sizeof(TLVckhdr)) return -EPIPE;
+  memcpy(&h,img,sizeof(h));
+  if (memcmp(h.magic,TCK_MAGIC,4) != 0) return -EINVAL;
+  crc=h.hcrc; h.hcrc=0;
+  if (crc32c(0,&h,sizeof(h)) != crc) return -EBADMSG;
+  if (h.size < sizeof(TLVckhdr)+(uint64_t)h.n*sizeof(TLVckdir)) return -EINVAL;
+  if (h.size > size) return -EPIPE;
+  if (crc32c(0,img+sizeof(h),h.size-sizeof(h)) != h.crc) return -EBADMSG;
+  *n=h.n;
+  return h.size;
+}
+
+/*!
+    \brief restore contexts from batch image
+    \param img image (8 bytes aligned, writable if contexts are to be changed)
+    \param size available bytes (may contain more batches)
+    \param c output contexts (views of image)
+    \param n size of contexts table
+    \return negative - failure (see tck_check, -ENOSPC contexts table too short), batch size
+*/
+int64_t tck_restore(uchar *img, size_t size, TLVckctx *c, int n)
+{
+  const TLVckdir *d=(const TLVckdir*)(img+sizeof(TLVckhdr));
+  int64_t bsize;
+  int i,bn;
+
+  if ((bsize=tck_check(img,size,&bn)) < 0) return bsize;
+  if (bn > n) return -ENOSPC;
+  for (i=0; i < bn; i++)
+  {
+    if ((uint64_t)d[i].off+d[i].len > (uint64_t)bsize ||
+        (uint64_t)d[i].ioff+d[i].nent*sizeof(TLVent) > (uint64_t)bsize ||
+        d[i].ioff%sizeof(ushort) != 0)
+      return -EINVAL;
+    c[i].tb.buf=img+d[i].off;
+    c[i].tb.mlen=c[i].tb.len=d[i].len;
+    c[i].ent=(const TLVent*)(img+d[i].ioff);
+    c[i].nent=d[i].nent;
+  }
+  return bsize;
+}
+
+/*!
+    \brief find top level tag of restored context (using its index)
+    \param c restored context
+    \param tag requested tag identifier
+    \param tlv output tlv to fill (may be NULL)
+    \return 1 on success, else 0
+*/
+int tck_find(const TLVckctx *c, ushort tag, TLV *tlv)
+{
+  int lo=0,hi=c->nent,m;
+  while (lo < hi)
+  {
+    m=(lo+hi)>>1;
+    if (c->ent[m].t < tag) lo=m+1; else hi=m;
+  }
+  if (lo == c->nent || c->ent[lo].t != tag) return 0;
+  if ((uint32_t)c->ent[lo].o+c->ent[lo].h+c->ent[lo].l > c->tb.len) return 0;
+  if (tlv != NULL)
+  {
+    tlv->t=tag; tlv->l=c->ent[lo].l;
+    tlv->v=c->tb.buf+c->ent[lo].o+c->ent[lo].h;
+  }
+  return 1;
+}
@@ -0,0 +1,61 @@
+#ifndef __COMMON_TLVCKPT_H
+#define __COMMON_TLVCKPT_H
+/*!
+	\file
+	\brief Checkpoint/restore of TLVbuf contexts with tag index (header)
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include "tlv.h"
+
+#define TCK_MAGIC    "TLVK"
+#define TCK_MAXTAGS  256    /*!< \brief max top level tags of context */
+
+/*!
+	\struct TLVckhdr
+	\brief batch header (followed by directory, indexes and data)
+*/
+typedef struct
+{
+  char magic[4];
+  uint32_t n;               /*!< \brief number of contexts */
+  uint64_t size;            /*!< \brief batch size (with header) */
+  uint32_t crc;             /*!< \brief CRC-32C of batch after header */
+  uint32_t hcrc;            /*!< \brief CRC-32C of header (with hcrc=0) */
+} TLVckhdr;
+
+/*!
+	\struct TLVckdir
+	\brief directory entry of context (offsets from batch start)
+*/
+typedef struct
+{
+  uint32_t off;             /*!< \brief offset of TLV data */
+  uint32_t ioff;            /*!< \brief offset of tag index */
+  ushort len;               /*!< \brief TLV data length */
+  ushort nent;              /*!< \brief number of index entries */
+  uint32_t res;
+} TLVckdir;
+
+/*!
+	\struct TLVckctx
+	\brief restored context (view of batch image)
+*/
+typedef struct
+{
+  TLVbuf tb;                /*!< \brief TLV data (mlen=len) */
+  const TLVent *ent;        /*!< \brief top level tags sorted by tag (then by offset) */
+  int nent;                 /*!< \brief number of index entries */
+} TLVckctx;
+
+__BEGIN_DECLS
+EXPORT int64_t tck_size(const TLVbuf *tbs, int n);
+EXPORT int64_t tck_build(const TLVbuf *tbs, int n, uchar *img, size_t isize);
+EXPORT int tck_write(int fd, const TLVbuf *tbs, int n);
+EXPORT int64_t tck_check(const uchar *img, size_t size, int *n);
+EXPORT int64_t tck_restore(uchar *img, size_t size, TLVckctx *c, int n);
+EXPORT int tck_find(const TLVckctx *c, ushort tag, TLV *tlv);
+__END_DECLS
+
+#endif
@@ -0,0 +1,455 @@
+/*!
+	\file
+	\brief Columnar extraction of TLV records
+
+	Each record is traversed once (nested templates included) and values
+	of requested tags are appended to per tag columns. Fixed width columns
+	keep values inline (right aligned, left padded with zeros, as BCD and
+	binary numbers are), variable length columns keep offsets and data.
+	Every column has null bitmap.
+
+	Extraction is not thread-safe on a single TLVcols, for parallel
+	processing every thread fills its own set (see tc_initlike())
+	with a batch of records and batches are joined with tc_merge().
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include "tlvcol.h"
+
+#define TC_ALIGN(x) (((x)+7)&~(uint64_t)7)
+
+/*!
+    \brief find column by tag
+    \param tc pointer to TLVcols structure
+    \param tag tag ID
+    \return column index or -1 if tag is not extracted
+*/
+static int tc_colof(const TLVcols *tc, ushort tag)
+{
+  int lo=0,hi=tc->n-1,m;
+  while (lo <= hi)
+  {
+    m=(lo+hi)>>1;
+    if (tc->col[tc->idx[m]].tag == tag) return tc->idx[m];
+    if (tc->col[tc->idx[m]].tag < tag) lo=m+1; else hi=m-1;
+  }
+  return -1;
+}
+
+/*!
+    \brief make room for at least rows rows
+    \param tc pointer to TLVcols structure
+    \param rows requested number of rows
+    \return 0 success, -ENOMEM failure
+*/
+static int tc_grow(TLVcols *tc, unsigned rows)
+{
+  unsigned cap=tc->cap,ob,nb;
+  int c;
+  void *p;
+  if (rows <= cap) return 0;
+  if (cap == 0) cap=64;
+  while (cap < rows) cap<<=1;
+  ob=(tc->cap+7)>>3; nb=(cap+7)>>3;
+  for (c=0; c < tc->n; c++)
+  {
+    TLVcol *col=&tc->col[c];
+    if ((p=realloc(col->valid,nb)) == NULL) return -ENOMEM;
+    col->valid=(uchar*)p; memset(col->valid+ob,0,nb-ob);
+    if (col->width == TC_VAR)
+    {
+      if ((p=realloc(col->offs,(cap+1)*sizeof(uint32_t))) == NULL) return -ENOMEM;
+      col->offs=(uint32_t*)p;
+      if (tc->cap == 0) col->offs[0]=0;
+    }
+    else
+    {
+      if ((p=realloc(col->data,(size_t)cap*col->width)) == NULL) return -ENOMEM;
+      col->data=(uchar*)p;
+      memset(col->data+(size_t)tc->cap*col->width,0,(size_t)(cap-tc->cap)*col->width);
+    }
+  }
+  tc->cap=cap;
+  return 0;
+}
+
+/*!
+    \brief append value to variable length column
+    \param col pointer to TLVcol structure
+    \param v value
+    \param l value length
+    \return 0 success, negative failure
+*/
+static int tc_putvar(TLVcol *col, const uchar *v, uint32_t l)
+{
+  uint32_t cap=col->dcap;
+  void *p;
+  if (l == 0) return 0;
+  if (col->dlen+(uint64_t)l > UINT32_MAX) return -EFBIG;
+  if (col->dlen+l > cap)
+  {
+    if (cap == 0) cap=1024;
+    while (cap < col->dlen+l) cap = cap > UINT32_MAX/2 ? UINT32_MAX : cap<<1;
+    if ((p=realloc(col->data,cap)) == NULL) return -ENOMEM;
+    col->data=(uchar*)p; col->dcap=cap;
+  }
+  memcpy(col->data+col->dlen,v,l);
+  col->dlen+=l;
+  return 0;
+}
+
+/*!
+    \brief store tag value in the current row
+    \param tc pointer to TLVcols structure
+    \param c column index
+    \param t tag to store
+    \return 0 success, -E2BIG value longer than fixed column width, negative failure
+*/
+static int tc_put(TLVcols *tc, int c, const TLV *t)
+{
+  TLVcol *col=&tc->col[c];
+  unsigned r=tc->rows;
+  int i;
+  if (!tc_isnull(col,r)) return 0;
+  if (col->width == TC_VAR)
+  {
+    if ((i=tc_putvar(col,t->v,t->l)) < 0) return i;
+    col->offs[r+1]=col->dlen;
+  }
+  else
+  {
+    if (t->l > col->width)
+      { DEBUG1(dbgprn("tag=%x len=%d > width=%d\n",t->t,t->l,col->width);) return -E2BIG; }
+    memcpy(col->data+(size_t)r*col->width+col->width-t->l,t->v,t->l);
+  }
+  col->valid[r>>3] |= 1<<(r&7);
+  return 0;
+}
+
+/*!
+    \brief drop partially extracted current row
+    \param tc pointer to TLVcols structure
+*/
+static void tc_undo(TLVcols *tc)
+{
+  unsigned r=tc->rows;
+  int c;
+  for (c=0; c < tc->n; c++)
+  {
+    TLVcol *col=&tc->col[c];
+    col->valid[r>>3] &= ~(1<<(r&7));
+    if (col->width == TC_VAR) col->dlen=col->offs[r];
+    else memset(col->data+(size_t)r*col->width,0,col->width);
+  }
+}
+
+/*!
+    \brief initialize set of columns
+    \param tc pointer to TLVcols structure
+    \param tags tags to extract
+    \param widths value width for every tag (TC_VAR for variable length)
+    \param n number of tags
+    \return 0 success, -EINVAL duplicated tag, -ENOMEM no memory
+*/
+int tc_init(TLVcols *tc, const ushort *tags, const ushort *widths, int n)
+{
+  int i,j;
+  memset(tc,0,sizeof(TLVcols));
+  if (n <= 0) return -EINVAL;
+  tc->col=(TLVcol*)calloc(n,sizeof(TLVcol));
+  tc->idx=(ushort*)malloc(n*sizeof(ushort));
+  if (tc->col == NULL || tc->idx == NULL) { tc_free(tc); return -ENOMEM; }
+  tc->n=n;
+  for (i=0; i < n; i++)
+  {
+    tc->col[i].tag=tags[i]; tc->col[i].width=widths[i];
+    for (j=i; j > 0 && tags[tc->idx[j-1]] > tags[i]; j--) tc->idx[j]=tc->idx[j-1];
+    if (j > 0 && tags[tc->idx[j-1]] == tags[i])
+      { DEBUG1(dbgprn("tag=%x duplicated\n",tags[i]);) tc_free(tc); return -EINVAL; }
+    tc->idx[j]=i;
+  }
+  if (tc_grow(tc,1) < 0) { tc_free(tc); return -ENOMEM; }
+  return 0;
+}
+
+/*!
+    \brief initialize empty set of columns with the same tags as other set
+    \param tc pointer to TLVcols structure
+    \param src set to copy definitions from
+    \return 0 success, negative failure
+*/
+int tc_initlike(TLVcols *tc, const TLVcols *src)
+{
+  ushort *d;
+  int i,r;
+  if ((d=(ushort*)malloc(2*src->n*sizeof(ushort))) == NULL) return -ENOMEM;
+  for (i=0; i < src->n; i++) { d[i]=src->col[i].tag; d[src->n+i]=src->col[i].width; }
+  r=tc_init(tc,d,d+src->n,src->n);
+  free(d);
+  return r;
+}
+
+/*!
+    \brief extract one record (single pass over all its tags)
+    \param tc pointer to TLVcols structure
+    \param b binary buffer (TLV structured) with record
+    \param l binary buffer length
+    \return 0 success, -EINVAL broken record, -E2BIG value longer than fixed column width,
+            -ENOMEM no memory, -EPERM set is read-only (record is not added on failure)
+*/
+int tc_addrec(TLVcols *tc, const uchar *b, int l)
+{
+  const uchar *sb[TC_MAXDEPTH];
+  int sl[TC_MAXDEPTH];
+  int i,c,sp=0;
+  unsigned r=tc->rows;
+  TLV t;
+
+  if (tc->cap == 0) return -EPERM;
+  if ((i=tc_grow(tc,r+1)) < 0) return i;
+  for (c=0; c < tc->n; c++)
+    if (tc->col[c].width == TC_VAR) tc->col[c].offs[r+1]=tc->col[c].offs[r];
+
+  for (;;)
+  {
+    while ((i=tlv_parseTLV(b,l,&t)) > 0)
+    {
+      t.v += t.l;
+      l -= t.v - b; b = t.v;
+      t.v -= t.l;
+      if ((c=tc_colof(tc,t.t)) >= 0)
+        { if ((i=tc_put(tc,c,&t)) < 0) break; }
+      else if ((tlv_tag0(t.t) & TAG_CONSTR) && sp < TC_MAXDEPTH)
+        { sb[sp]=b; sl[sp]=l; sp++; b=t.v; l=t.l; }
+    }
+    if (i < 0) { tc_undo(tc); return i==-1||i==-2 ? -EINVAL : i; }
+    if (sp == 0) break;
+    sp--; b=sb[sp]; l=sl[sp];
+  }
+  tc->rows++;
+  return 0;
+}
+
+/*!
+    \brief extract stream of records, every top level TLV is single record
+    \param tc pointer to TLVcols structure
+    \param b binary buffer with records
+    \param l binary buffer length
+    \return negative failure, otherwise number of extracted records
+*/
+int tc_addrecs(TLVcols *tc, const uchar *b, int l)
+{
+  TLV t;
+  int i,n=0;
+  while ((i=tlv_parseTLV(b,l,&t)) > 0)
+  {
+    t.v += t.l;
+    if ((i=tc_addrec(tc,b,t.v-b)) < 0) return i;
+    l -= t.v - b; b = t.v;
+    n++;
+  }
+  if (i < 0) return -EINVAL;
+  return n;
+}
+
+/*!
+    \brief append rows of one set to another (join of parallel batches)
+    \param dst set to append to
+    \param src set to append (must have the same tags and widths)
+    \return 0 success, negative failure
+*/
+int tc_merge(TLVcols *dst, const TLVcols *src)
+{
+  unsigned r,i;
+  int c,e;
+  if (dst->cap == 0) return -EPERM;
+  if (dst->n != src->n) return -EINVAL;
+  for (c=0; c < dst->n; c++)
+    if (dst->col[c].tag != src->col[c].tag || dst->col[c].width != src->col[c].width)
+      return -EINVAL;
+  if ((e=tc_grow(dst,dst->rows+src->rows+1)) < 0) return e;
+
+  r=dst->rows;
+  for (c=0; c < dst->n; c++)
+  {
+    TLVcol *d=&dst->col[c];
+    const TLVcol *s=&src->col[c];
+    if ((r&7) == 0) memcpy(d->valid+(r>>3),s->valid,(src->rows+7)>>3);
+    else for (i=0; i < src->rows; i++)
+      if (!tc_isnull(s,i)) d->valid[(r+i)>>3] |= 1<<((r+i)&7);
+    if (d->width == TC_VAR)
+    {
+      uint32_t o=d->dlen;
+      if ((e=tc_putvar(d,s->data,s->dlen)) < 0) return e;
+      for (i=1; i <= src->rows; i++) d->offs[r+i]=o+s->offs[i];
+    }
+    else memcpy(d->data+(size_t)r*d->width,s->data,(size_t)src->rows*d->width);
+  }
+  dst->rows+=src->rows;
+  return 0;
+}
+
+/*!
+    \brief get value from column
+    \param tc pointer to TLVcols structure
+    \param c column index
+    \param row row number
+    \param tlv output TLV (points to column data)
+    \return 0 null value (or out of range), 1 success
+*/
+int tc_get(const TLVcols *tc, int c, unsigned row, TLV *tlv)
+{
+  const TLVcol *col;
+  if (c < 0 || c >= tc->n || row >= tc->rows) return 0;
+  col=&tc->col[c];
+  tlv->t=col->tag;
+  if (tc_isnull(col,row)) { tlv->l=0; tlv->v=NULL; return 0; }
+  if (col->width == TC_VAR)
+    { tlv->v=col->data+col->offs[row]; tlv->l=col->offs[row+1]-col->offs[row]; }
+  else
+    { tlv->v=col->data+(size_t)row*col->width; tlv->l=col->width; }
+  return 1;
+}
+
+/*!
+    \brief write whole buffer followed by zero padding to 8 bytes boundary
+    \param fd file descriptor
+    \param b data
+    \param l data length
+    \return 0 success, negative errno
+*/
+static int tc_wr(int fd, const void *b, uint64_t l)
+{
+  static const uchar zero[8];
+  const uchar *p=(const uchar*)b;
+  uint64_t pad=TC_ALIGN(l)-l;
+  ssize_t r;
+  while (l > 0 || pad > 0)
+  {
+    if (l == 0) { p=zero; l=pad; pad=0; }
+    if ((r=write(fd,p,l)) < 0) { if (errno == EINTR) continue; return -errno; }
+    p+=r; l-=r;
+  }
+  return 0;
+}
+
+/*!
+    \brief write columns to file (can be mapped back with tc_attach())
+    \param tc pointer to TLVcols structure
+    \param fd file descriptor opened for writing
+    \return 0 success, negative errno
+*/
+int tc_write(const TLVcols *tc, int fd)
+{
+  TLVcolhdr h;
+  TLVcoldir *d;
+  uint64_t o;
+  int c,r=0;
+
+  if ((d=(TLVcoldir*)calloc(tc->n,sizeof(TLVcoldir))) == NULL) return -ENOMEM;
+  memcpy(h.magic,TC_MAGIC,4);
+  h.ver=TC_VERSION; h.ncol=tc->n; h.rows=tc->rows;
+
+  o=TC_ALIGN(sizeof(h)+tc->n*sizeof(TLVcoldir));
+  for (c=0; c < tc->n; c++)
+  {
+    const TLVcol *col=&tc->col[c];
+    d[c].tag=col->tag; d[c].width=col->width;
+    d[c].valid=o; o+=TC_ALIGN((tc->rows+7)>>3);
+    if (col->width == TC_VAR)
+    {
+      d[c].offs=o; o+=TC_ALIGN((tc->rows+1)*sizeof(uint32_t));
+      d[c].dlen=col->dlen;
+    }
+    else d[c].dlen=tc->rows*col->width;
+    d[c].data=o; o+=TC_ALIGN(d[c].dlen);
+  }
+
+  if ((r=tc_wr(fd,&h,sizeof(h))) < 0) goto out;
+  if ((r=tc_wr(fd,d,tc->n*sizeof(TLVcoldir))) < 0) goto out;
+  for (c=0; c < tc->n; c++)
+  {
+    const TLVcol *col=&tc->col[c];
+    if ((r=tc_wr(fd,col->valid,(tc->rows+7)>>3)) < 0) goto out;
+    if (col->width == TC_VAR && (r=tc_wr(fd,col->offs,(tc->rows+1)*sizeof(uint32_t))) < 0) goto out;
+    if ((r=tc_wr(fd,col->data,d[c].dlen)) < 0) goto out;
+  }
+out:
+  free(d);
+  return r;
+}
+
+/*!
+    \brief attach (read-only) set of columns to mapped columnar file
+    \param tc pointer to TLVcols structure
+    \param map file content (must be 8 bytes aligned, as returned by mmap)
+    \param size file size
+    \return 0 success, -EINVAL wrong file, -ENOMEM no memory
+
+    Offsets of variable length columns are checked (ascending, within
+    data), so values returned by tc_get() of attached file are in the map.
+*/
+int tc_attach(TLVcols *tc, const void *map, size_t size)
+{
+  const TLVcolhdr *h=(const TLVcolhdr*)map;
+  const TLVcoldir *d=(const TLVcoldir*)(h+1);
+  uchar *b=(uchar*)map;
+  uint64_t vl,ol;
+  unsigned r;
+  int c,j;
+
+  memset(tc,0,sizeof(TLVcols));
+  if (size < sizeof(TLVcolhdr) || memcmp(h->magic,TC_MAGIC,4) || h->ver != TC_VERSION)
+    return -EINVAL;
+  if (h->ncol == 0 || (size-sizeof(TLVcolhdr))/sizeof(TLVcoldir) < h->ncol) return -EINVAL;
+  tc->map=map;
+  tc->col=(TLVcol*)calloc(h->ncol,sizeof(TLVcol));
+  tc->idx=(ushort*)malloc(h->ncol*sizeof(ushort));
+  if (tc->col == NULL || tc->idx == NULL) { tc_free(tc); return -ENOMEM; }
+  tc->n=h->ncol; tc->rows=h->rows;
+
+  vl=(h->rows+7)>>3; ol=(h->rows+1)*(uint64_t)sizeof(uint32_t);
+  for (c=0; c < tc->n; c++)
+  {
+    TLVcol *col=&tc->col[c];
+    if (d[c].valid > size || size-d[c].valid < vl || d[c].data > size || size-d[c].data < d[c].dlen ||
+        (d[c].width == TC_VAR && (d[c].offs > size || size-d[c].offs < ol)) ||
+        (d[c].width != TC_VAR && d[c].dlen != (uint64_t)h->rows*d[c].width))
+      { tc_free(tc); return -EINVAL; }
+    col->tag=d[c].tag; col->width=d[c].width;
+    col->valid=b+d[c].valid; col->data=b+d[c].data; col->dlen=d[c].dlen;
+    if (col->width == TC_VAR)
+    {
+      if (d[c].offs&3) { tc_free(tc); return -EINVAL; }
+      col->offs=(uint32_t*)(void*)(b+d[c].offs);
+      for (r=0; r < tc->rows && col->offs[r] <= col->offs[r+1]; r++) ;
+      if (r < tc->rows || col->offs[r] > col->dlen) { tc_free(tc); return -EINVAL; }
+    }
+    for (j=c; j > 0 && tc->col[tc->idx[j-1]].tag > col->tag; j--) tc->idx[j]=tc->idx[j-1];
+    tc->idx[j]=c;
+  }
+  return 0;
+}
+
+/*!
+    \brief free memory of set of columns
+    \param tc pointer to TLVcols structure
+*/
+void tc_free(TLVcols *tc)
+{
+  int c;
+  /* also columns partially allocated by failed tc_grow() */
+  if (tc->col != NULL && tc->map == NULL)
+  {
+    for (c=0; c < tc->n; c++)
+    {
+      free(tc->col[c].valid); free(tc->col[c].data); free(tc->col[c].offs);
+    }
+  }
+  free(tc->col); free(tc->idx);
+  memset(tc,0,sizeof(TLVcols));
+}
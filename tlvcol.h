@@ -0,0 +1,86 @@
+#ifndef __COMMON_TLVCOL_H
+#define __COMMON_TLVCOL_H
+/*!
+	\file
+	\brief Columnar extraction of TLV records (header)
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include "tlv.h"
+
+#define TC_VAR      0       /*!< \brief column width for variable length values */
+#define TC_MAXDEPTH 8       /*!< \brief max nesting of constructed tags in a record */
+#define TC_MAGIC    "TLVC"  /*!< \brief columnar file magic */
+#define TC_VERSION  1       /*!< \brief columnar file version */
+
+/*!
+	\struct TLVcol
+	\brief one column - values of a single tag over all rows
+*/
+typedef struct
+{
+  ushort tag;         /*!< \brief Tag ID */
+  ushort width;       /*!< \brief fixed value width, TC_VAR for variable length */
+  uchar *valid;       /*!< \brief null bitmap, bit set if row has a value */
+  uchar *data;        /*!< \brief values (fixed: rows*width bytes) */
+  uint32_t *offs;     /*!< \brief variable length: rows+1 offsets into data */
+  uint32_t dlen;      /*!< \brief variable length: used data bytes */
+  uint32_t dcap;      /*!< \brief variable length: allocated data bytes */
+} TLVcol;
+
+/*!
+	\struct TLVcols
+	\brief set of columns filled from TLV records
+*/
+typedef struct
+{
+  int n;              /*!< \brief number of columns */
+  unsigned rows;      /*!< \brief number of rows */
+  unsigned cap;       /*!< \brief allocated rows, 0 if attached to mapped file */
+  TLVcol *col;        /*!< \brief columns (in order of definition) */
+  ushort *idx;        /*!< \brief column indexes sorted by tag */
+  const void *map;    /*!< \brief mapped file of attached set, NULL if columns are allocated */
+} TLVcols;
+
+/*!
+	\struct TLVcolhdr
+	\brief columnar file header (all sections are 8 bytes aligned)
+*/
+typedef struct
+{
+  char magic[4];      /*!< \brief TC_MAGIC */
+  uint32_t ver;       /*!< \brief TC_VERSION */
+  uint32_t ncol;      /*!< \brief number of TLVcoldir entries following header */
+  uint32_t rows;      /*!< \brief number of rows */
+} TLVcolhdr;
+
+/*!
+	\struct TLVcoldir
+	\brief columnar file directory entry, offsets are from begin of file
+*/
+typedef struct
+{
+  ushort tag;         /*!< \brief Tag ID */
+  ushort width;       /*!< \brief fixed value width, TC_VAR for variable length */
+  uint32_t dlen;      /*!< \brief data section length */
+  uint64_t valid;     /*!< \brief null bitmap section offset */
+  uint64_t offs;      /*!< \brief offsets section offset (TC_VAR only) */
+  uint64_t data;      /*!< \brief data section offset */
+} TLVcoldir;
+
+__BEGIN_DECLS
+EXPORT int tc_init(TLVcols *tc, const ushort *tags, const ushort *widths, int n);
+EXPORT int tc_initlike(TLVcols *tc, const TLVcols *src);
+EXPORT int tc_addrec(TLVcols *tc, const uchar *b, int l);
+EXPORT int tc_addrecs(TLVcols *tc, const uchar *b, int l);
+EXPORT int tc_merge(TLVcols *dst, const TLVcols *src);
+EXPORT int tc_get(const TLVcols *tc, int c, unsigned row, TLV *tlv);
+EXPORT int tc_write(const TLVcols *tc, int fd);
+EXPORT int tc_attach(TLVcols *tc, const void *map, size_t size);
+EXPORT void tc_free(TLVcols *tc);
+__END_DECLS
+
+#define tc_isnull(col,row) (((col)->valid[(row)>>3]&(1<<((row)&7)))==0)
+
+#endif
@@ -0,0 +1,735 @@
+/*!
+	\file
+	\brief Persistent store of TLV sessions with write-ahead log
+
+	Store directory keeps two files:
+	  snap - snapshot: TLVdbhdr, sorted session IDs, batch image of
+	         sessions with tag index (see tlvckpt)
+	  wal  - log: header record with generation, then deltas (tb_add,
+	         tb_del, drop of session) as checksummed records (see tlvrec);
+	         record tags are primitive, so added value is opaque to replay
+	         (it needn't be valid TLV even if its tag is constructed)
+
+	Snapshot is mapped read only, so sessions not changed since it are
+	read as views of mapping and tags are found by its index. Session is
+	copied to its own buffer on first change. Deltas are collected in
+	memory and tdb_commit writes all of them with one write and one
+	fdatasync (group commit); it is also done before a delta when
+	TDB_GROUP bytes are pending. Change is durable when tdb_commit
+	returned 0.
+
+	tdb_compact writes all sessions to new snapshot (renamed over the
+	old one) and starts log of next generation, so open maps snapshot
+	and replays only changes made after it. Log of generation already
+	in snapshot (crash before new log was started) is not replayed.
+	Replay stops on first broken record (torn write) and log is
+	truncated there.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "crc32c.h"
+#include "tlvrec.h"
+#include "tlvdb.h"
+
+#define TDB_SNAP    "snap"
+#define TDB_WAL     "wal"
+#define TDB_MINTAB  64      /* initial hash table size */
+#define TDB_MINBUF  64      /* initial buffer of changed session */
+
+/* session changed since snapshot */
+struct TLVdbent
+{
+  TLVdbent *next;
+  uint64_t id;
+  int dead;                 /* dropped, hides session of snapshot */
+  TLVbuf tb;                /* own buffer */
+};
+
+typedef struct
+{
+  uint64_t id;
+  const TLVbuf *tb;
+} TLVdbitem;
+
+static uint64_t tdb_hash(uint64_t x)
+{
+  x^=x>>33; x*=0xff51afd7ed558ccdull;
+  x^=x>>33; x*=0xc4ceb9fe1a85ec53ull;
+  x^=x>>33;
+  return x;
+}
+
+static void tdb_put(uchar *b, uint64_t v, int n)
+{
+  while (n-- > 0) { b[n]=v; v>>=8; }
+}
+
+static uint64_t tdb_val(const uchar *b, int n)
+{
+  uint64_t v=0;
+  int i;
+  for (i=0; i < n; i++) v=(v<<8)|b[i];
+  return v;
+}
+
+/*!
+    \brief encode one byte tag and length
+    \return header length
+*/
+static int tdb_hdr(uchar *b, uchar tag, int l)
+{
+  int i=0;
+  b[i++]=tag;
+  if (l > 0xff) { b[i++]=0x82; b[i++]=l>>8; }
+  else if (l > 0x7f) b[i++]=0x81;
+  b[i++]=l;
+  return i;
+}
+
+/*!
+    \brief write whole buffer
+    \return 0 success, negative errno
+*/
+static int tdb_wr(int fd, const void *b, size_t l)
+{
+  const uchar *p=(const uchar*)b;
+  ssize_t r;
+  while (l > 0)
+  {
+    if ((r=write(fd,p,l)) < 0) { if (errno == EINTR) continue; return -errno; }
+    p+=r; l-=r;
+  }
+  return 0;
+}
+
+/*!
+    \brief rebuild hash table of changed sessions
+    \return 0 success, -ENOMEM
+*/
+static int tdb_rehash(TLVdb *db, unsigned cap)
+{
+  TLVdbent **t,*e,*n;
+  unsigned i,h;
+  if ((t=(TLVdbent**)calloc(cap,sizeof(TLVdbent*))) == NULL) return -ENOMEM;
+  for (i=0; i < db->cap; i++)
+    for (e=db->tab[i]; e != NULL; e=n)
+    {
+      n=e->next; h=tdb_hash(e->id)&(cap-1);
+      e->next=t[h]; t[h]=e;
+    }
+  free(db->tab);
+  db->tab=t; db->cap=cap;
+  return 0;
+}
+
+static TLVdbent **tdb_slot(const TLVdb *db, uint64_t id)
+{
+  TLVdbent **p=&db->tab[tdb_hash(id)&(db->cap-1)];
+  while (*p != NULL && (*p)->id != id) p=&(*p)->next;
+  return p;
+}
+
+/*!
+    \brief find session in snapshot
+    \return index of session, -1 not found
+*/
+static int tdb_snapidx(const TLVdb *db, uint64_t id)
+{
+  int lo=0,hi=db->nsnap,m;
+  while (lo < hi)
+  {
+    m=(lo+hi)>>1;
+    if (db->ids[m] < id) lo=m+1; else hi=m;
+  }
+  return lo < db->nsnap && db->ids[lo] == id ? lo : -1;
+}
+
+/*!
+    \brief insert empty entry of changed session
+    \return new entry, NULL no memory
+*/
+static TLVdbent *tdb_insert(TLVdb *db, uint64_t id)
+{
+  TLVdbent **p,*e;
+  if (db->n >= db->cap) tdb_rehash(db,db->cap*2);
+  if ((e=(TLVdbent*)malloc(sizeof(TLVdbent))) == NULL) return NULL;
+  p=&db->tab[tdb_hash(id)&(db->cap-1)];
+  memset(e,0,sizeof(TLVdbent));
+  e->id=id; e->next=*p; *p=e;
+  db->n++;
+  return e;
+}
+
+/*!
+    \brief get session to be changed (copy it to own buffer)
+    \param create create session if it doesn't exist
+    \return entry, NULL not found (create=0) or no memory
+*/
+static TLVdbent *tdb_own(TLVdb *db, uint64_t id, int create)
+{
+  TLVdbent *e=*tdb_slot(db,id);
+  const TLVbuf *src=NULL;
+  unsigned m;
+  uchar *buf;
+  int i;
+
+  if (e != NULL && !e->dead) return e;
+  if (e == NULL && (i=tdb_snapidx(db,id)) >= 0) src=&db->ctx[i].tb;
+  else if (!create) return NULL;
+  m = src != NULL ? src->len+src->len/2 : 0;
+  if (m < TDB_MINBUF) m=TDB_MINBUF;
+  if (m > 0xffff) m=0xffff;
+  if ((buf=(uchar*)malloc(m)) == NULL) return NULL;
+  if (e == NULL && (e=tdb_insert(db,id)) == NULL) { free(buf); return NULL; }
+  e->dead=0;
+  e->tb.buf=buf; e->tb.mlen=m; e->tb.len=0;
+  if (src != NULL && src->len > 0) { memcpy(buf,src->buf,src->len); e->tb.len=src->len; }
+  return e;
+}
+
+/*!
+    \brief grow own buffer of session (up to 0xffff)
+    \return 0 success, -ENOMEM
+*/
+static int tdb_grow(TLVbuf *tb, unsigned need)
+{
+  unsigned m=tb->mlen;
+  uchar *b;
+  if (need <= m) return 0;
+  while (m < need) m*=2;
+  if (m > 0xffff) m=0xffff;
+  if ((b=(uchar*)realloc(tb->buf,m)) == NULL) return -ENOMEM;
+  tb->buf=b; tb->mlen=m;
+  return 0;
+}
+
+/*!
+    \brief drop session (without log)
+    \return 1 dropped, 0 not found, -ENOMEM
+*/
+static int tdb_dodrop(TLVdb *db, uint64_t id)
+{
+  TLVdbent **p=tdb_slot(db,id),*e=*p;
+  int snap=tdb_snapidx(db,id) >= 0;
+
+  if (e == NULL)
+  {
+    if (!snap) return 0;
+    if ((e=tdb_insert(db,id)) == NULL) return -ENOMEM;
+    e->dead=1;
+    return 1;
+  }
+  if (e->dead) return 0;
+  free(e->tb.buf);
+  memset(&e->tb,0,sizeof(TLVbuf));
+  if (snap) e->dead=1;
+  else { *p=e->next; free(e); db->n--; }
+  return 1;
+}
+
+/*!
+    \brief add tag to session (without log), session is created if needed
+    \return see tb_add, -ENOMEM
+*/
+static int tdb_doadd(TLVdb *db, uint64_t id, TLV *tlv, uchar ovr)
+{
+  TLVdbent *e;
+  TLVbuf tb;
+  int had=tdb_get(db,id,&tb),r;
+
+  if ((e=tdb_own(db,id,1)) == NULL) return -ENOMEM;
+  if ((r=tdb_grow(&e->tb,e->tb.len+tlv->l+8)) == 0) r=tb_add(&e->tb,tlv,ovr);
+  if (r <= 0 && !had) tdb_dodrop(db,id);
+  return r;
+}
+
+/*!
+    \brief delete tag of session (without log)
+    \return 1 deleted, 0 not found, -ENOMEM
+*/
+static int tdb_dodel(TLVdb *db, uint64_t id, ushort tag)
+{
+  TLVdbent *e;
+  if (!tdb_find(db,id,tag,NULL)) return 0;
+  if ((e=tdb_own(db,id,0)) == NULL) return -ENOMEM;
+  return tb_del(&e->tb,tag);
+}
+
+/*!
+    \brief make space for log record (commit pending group when it is full)
+    \return 0 success, negative failure (see tdb_commit, -ENOMEM)
+*/
+static int tdb_reserve(TLVdb *db, int l)
+{
+  uchar *b;
+  int r,m;
+  if (db->wlen >= TDB_GROUP && (r=tdb_commit(db)) < 0) return r;
+  if (db->wlen+l <= db->wcap) return 0;
+  for (m = db->wcap ? db->wcap : 4096; m < db->wlen+l; m*=2) ;
+  if ((b=(uchar*)realloc(db->wbuf,m)) == NULL) return -ENOMEM;
+  db->wbuf=b; db->wcap=m;
+  return 0;
+}
+
+/*!
+    \brief append log record (space was reserved)
+    \param tag record tag
+    \param c record content (fields)
+    \param cl content length
+    \param v rest of content (may be NULL)
+    \param vl rest length
+*/
+static void tdb_log(TLVdb *db, uchar tag, const uchar *c, int cl, const uchar *v, int vl)
+{
+  uchar *r=db->wbuf+db->wlen,*b=r;
+  b+=tdb_hdr(b,tag,cl+vl);
+  memcpy(b,c,cl); b+=cl;
+  if (vl > 0) memcpy(b,v,vl);
+  b+=vl;
+  b+=tr_trailer(r,b-r,b);
+  db->wlen=b-db->wbuf;
+}
+
+/*!
+    \brief apply log record
+    \return 0 success (or record ignored), -EINVAL wrong record, -ENOMEM
+*/
+static int tdb_apply(TLVdb *db, const TLV *rec)
+{
+  const uchar *b=rec->v;
+  int l=rec->l,r;
+  uint64_t id;
+  uchar ovr;
+  TLV t;
+
+  if (rec->t == TDB_WDROP)
+  {
+    if (rec->l != 8) return -EINVAL;
+    r=tdb_dodrop(db,tdb_val(rec->v,8));
+    return r < 0 ? r : 0;
+  }
+  if (rec->t != TDB_WADD && rec->t != TDB_WDEL) return -EINVAL;
+  if (tlv_parseTLV(b,l,&t) <= 0 || t.t != TDB_WID || t.l != 8) return -EINVAL;
+  id=tdb_val(t.v,8);
+  t.v+=t.l; l-=t.v-b; b=t.v;
+  if (tlv_parseTLV(b,l,&t) <= 0) return -EINVAL;
+  if (rec->t == TDB_WDEL)
+  {
+    if (t.t != TDB_WTAG || t.l != 2) return -EINVAL;
+    r=tdb_dodel(db,id,tdb_val(t.v,2));
+  }
+  else
+  {
+    if (t.t != TDB_WOVR || t.l != 1) return -EINVAL;
+    ovr=t.v[0];
+    t.v+=t.l; l-=t.v-b; b=t.v;
+    if (tlv_parseTLV(b,l,&t) <= 0) return -EINVAL;
+    r=tdb_doadd(db,id,&t,ovr);
+  }
+  return r == -ENOMEM ? r : 0;
+}
+
+/*!
+    \brief start new log (replaces current one)
+    \param gen log generation
+    \return 0 success, negative errno
+*/
+static int tdb_newlog(TLVdb *db, uint64_t gen)
+{
+  uchar h[10+TR_TRAILER];
+  int fd,r;
+
+  h[0]=TDB_WHDR; h[1]=8; tdb_put(h+2,gen,8);
+  tr_trailer(h,10,h+10);
+  if ((fd=openat(db->dfd,TDB_WAL ".tmp",O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC,0600)) < 0) return -errno;
+  if ((r=tdb_wr(fd,h,sizeof(h))) < 0 || (r=fsync(fd)) < 0 ||
+      (r=renameat(db->dfd,TDB_WAL ".tmp",db->dfd,TDB_WAL)) < 0 || (r=fsync(db->dfd)) < 0)
+  {
+    if (r == -1) r=-errno;
+    close(fd);
+    unlinkat(db->dfd,TDB_WAL ".tmp",0);
+    return r;
+  }
+  if (db->wfd >= 0) close(db->wfd);
+  db->wfd=fd; db->gen=gen;
+  db->wsize=sizeof(h);
+  return 0;
+}
+
+/*!
+    \brief replay log
+    \return 0 success, 1 new log is to be started, negative failure
+*/
+static int tdb_replay(TLVdb *db)
+{
+  struct stat st;
+  const uchar *m;
+  uint64_t gen;
+  size_t o=0,size;
+  int r=0,a,off;
+  TLV rec;
+
+  if (fstat(db->wfd,&st) < 0) return -errno;
+  if ((size=st.st_size) == 0) return 1;
+  if ((m=(const uchar*)mmap(NULL,size,PROT_READ,MAP_PRIVATE,db->wfd,0)) == MAP_FAILED) return -errno;
+  while (o < size)
+  {
+    if ((r=tr_next(m+o,size-o > INT_MAX ? INT_MAX : size-o,&rec,&off)) <= 0) break;
+    if (o == 0)
+    {
+      if (rec.t != TDB_WHDR || rec.l != 8) break;
+      gen=tdb_val(rec.v,8);
+      /* generation already in snapshot */
+      if (gen <= db->gen) { o=0; break; }
+      db->gen=gen;
+    }
+    else if ((a=tdb_apply(db,&rec)) < 0)
+    {
+      if (a == -ENOMEM) { munmap((void*)m,size); return a; }
+      break;
+    }
+    o+=r;
+  }
+  munmap((void*)m,size);
+  if (o == 0) return 1;
+  db->wsize=o;
+  if (o < size && (ftruncate(db->wfd,o) < 0 || fdatasync(db->wfd) < 0)) return -errno;
+  return 0;
+}
+
+/*!
+    \brief map snapshot
+    \param db store with dfd set, other snapshot fields are filled
+    \return 0 success (or no snapshot), negative failure (-EINVAL wrong file,
+            -EBADMSG wrong CRC, -ENOMEM, -errno)
+*/
+static int tdb_loadsnap(TLVdb *db)
+{
+  struct stat st;
+  TLVdbhdr h;
+  uint32_t crc;
+  int64_t r;
+  void *m;
+  int fd,n;
+
+  if ((fd=openat(db->dfd,TDB_SNAP,O_RDONLY|O_CLOEXEC)) < 0) return errno == ENOENT ? 0 : -errno;
+  if (fstat(fd,&st) < 0) { r=-errno; close(fd); return r; }
+  if ((size_t)st.st_size < sizeof(h)) { close(fd); return -EINVAL; }
+  m=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  close(fd);
+  if (m == MAP_FAILED) return -errno;
+  db->map=(uchar*)m; db->msize=st.st_size;
+
+  memcpy(&h,m,sizeof(h));
+  if (memcmp(h.magic,TDB_MAGIC,4) != 0) return -EINVAL;
+  crc=h.hcrc; h.hcrc=0;
+  if (crc32c(0,&h,sizeof(h)) != crc) return -EBADMSG;
+  if (h.n > INT_MAX || h.boff%8 != 0 || h.boff < sizeof(h)+(uint64_t)h.n*sizeof(uint64_t) ||
+      h.boff > db->msize)
+    return -EINVAL;
+  db->ids=(const uint64_t*)(db->map+sizeof(h));
+  if (crc32c(0,db->ids,h.n*sizeof(uint64_t)) != h.crc) return -EBADMSG;
+  if ((r=tck_check(db->map+h.boff,db->msize-h.boff,&n)) < 0) return r;
+  if (n != (int)h.n) return -EINVAL;
+  if ((db->ctx=(TLVckctx*)malloc((n ? n : 1)*sizeof(TLVckctx))) == NULL) return -ENOMEM;
+  if ((r=tck_restore(db->map+h.boff,db->msize-h.boff,db->ctx,n)) < 0) return r;
+  db->nsnap=n; db->gen=h.gen;
+  return 0;
+}
+
+/*!
+    \brief free changed sessions
+*/
+static void tdb_clear(TLVdb *db)
+{
+  TLVdbent *e,*n;
+  unsigned i;
+  for (i=0; i < db->cap; i++)
+  {
+    for (e=db->tab[i]; e != NULL; e=n) { n=e->next; free(e->tb.buf); free(e); }
+    db->tab[i]=NULL;
+  }
+  db->n=0;
+}
+
+/*!
+    \brief unmap snapshot
+*/
+static void tdb_unmap(TLVdb *db)
+{
+  if (db->map != NULL) munmap(db->map,db->msize);
+  free(db->ctx);
+  db->map=NULL; db->msize=0;
+  db->ids=NULL; db->ctx=NULL; db->nsnap=0;
+}
+
+/*!
+    \brief release all resources of store (pending changes are lost)
+*/
+static void tdb_release(TLVdb *db)
+{
+  if (db->tab != NULL) tdb_clear(db);
+  free(db->tab); db->tab=NULL; db->cap=0;
+  tdb_unmap(db);
+  free(db->wbuf); db->wbuf=NULL; db->wlen=db->wcap=0;
+  if (db->wfd >= 0) close(db->wfd);
+  if (db->dfd >= 0) close(db->dfd);
+  db->wfd=db->dfd=-1;
+}
+
+/*!
+    \brief open store (created if doesn't exist), map snapshot and replay log
+    \param db pointer to TLVdb structure
+    \param dir store directory
+    \return 0 success, negative failure (see tdb_loadsnap, -errno)
+*/
+int tdb_open(TLVdb *db, const char *dir)
+{
+  int r;
+
+  memset(db,0,sizeof(TLVdb));
+  db->wfd=-1;
+  if (mkdir(dir,0700) < 0 && errno != EEXIST) return -errno;
+  if ((db->dfd=open(dir,O_RDONLY|O_DIRECTORY|O_CLOEXEC)) < 0) return -errno;
+  if ((r=tdb_rehash(db,TDB_MINTAB)) < 0 || (r=tdb_loadsnap(db)) < 0) goto out;
+  if ((db->wfd=openat(db->dfd,TDB_WAL,O_RDWR|O_CREAT|O_CLOEXEC,0600)) < 0) { r=-errno; goto out; }
+  if ((r=tdb_replay(db)) > 0) r=tdb_newlog(db,db->gen+1);
+out:
+  if (r < 0) tdb_release(db);
+  return r;
+}
+
+/*!
+    \brief commit pending changes and close store
+    \param db pointer to TLVdb structure
+    \return see tdb_commit
+*/
+int tdb_close(TLVdb *db)
+{
+  int r=tdb_commit(db);
+  tdb_release(db);
+  return r;
+}
+
+/*!
+    \brief add tag to session (see tb_add), session is created if needed
+    \param db pointer to TLVdb structure
+    \param id session ID
+    \param tlv pointer to TLV structure to add (v is set to stored value)
+    \param ovr see tb_add
+    \return see tb_add, -EFBIG value too long, negative failure of tdb_commit
+*/
+int tdb_add(TLVdb *db, uint64_t id, TLV *tlv, uchar ovr)
+{
+  uchar c[24],*p=c;
+  int r;
+
+  if (tlv->l > 0xffff-32) return -EFBIG;
+  if ((r=tdb_reserve(db,sizeof(c)+tlv->l+4+TR_TRAILER)) < 0) return r;
+  if ((r=tdb_doadd(db,id,tlv,ovr)) <= 0) return r;
+  p+=tdb_hdr(p,TDB_WID,8); tdb_put(p,id,8); p+=8;
+  p+=tdb_hdr(p,TDB_WOVR,1); *p++=ovr;
+  if (tlv->t > 0xff) *p++=tlv->t>>8;
+  *p++=tlv->t;
+  if (tlv->l > 0xff) { *p++=0x82; *p++=tlv->l>>8; }
+  else if (tlv->l > 0x7f) *p++=0x81;
+  *p++=tlv->l;
+  tdb_log(db,TDB_WADD,c,p-c,tlv->v,tlv->l);
+  return r;
+}
+
+/*!
+    \brief delete tag of session (see tb_del)
+    \param db pointer to TLVdb structure
+    \param id session ID
+    \param tag tag ID
+    \return 1 deleted, 0 not found, negative failure (-ENOMEM, see tdb_commit)
+*/
+int tdb_del(TLVdb *db, uint64_t id, ushort tag)
+{
+  uchar c[16],*p=c;
+  int r;
+
+  if ((r=tdb_reserve(db,sizeof(c)+4+TR_TRAILER)) < 0) return r;
+  if ((r=tdb_dodel(db,id,tag)) <= 0) return r;
+  p+=tdb_hdr(p,TDB_WID,8); tdb_put(p,id,8); p+=8;
+  p+=tdb_hdr(p,TDB_WTAG,2); tdb_put(p,tag,2); p+=2;
+  tdb_log(db,TDB_WDEL,c,p-c,NULL,0);
+  return r;
+}
+
+/*!
+    \brief drop session
+    \param db pointer to TLVdb structure
+    \param id session ID
+    \return 1 dropped, 0 not found, negative failure (-ENOMEM, see tdb_commit)
+*/
+int tdb_drop(TLVdb *db, uint64_t id)
+{
+  uchar c[8];
+  int r;
+
+  if ((r=tdb_reserve(db,sizeof(c)+2+TR_TRAILER)) < 0) return r;
+  if ((r=tdb_dodrop(db,id)) <= 0) return r;
+  tdb_put(c,id,8);
+  tdb_log(db,TDB_WDROP,c,sizeof(c),NULL,0);
+  return r;
+}
+
+/*!
+    \brief write pending changes to log and sync it (group commit)
+    \param db pointer to TLVdb structure
+    \return 0 success, negative errno (changes stay pending)
+*/
+int tdb_commit(TLVdb *db)
+{
+  ssize_t r;
+  int o;
+
+  for (o=0; o < db->wlen; o+=r)
+  {
+    if ((r=pwrite(db->wfd,db->wbuf+o,db->wlen-o,db->wsize+o)) < 0)
+    {
+      if (errno == EINTR) { r=0; continue; }
+      break;
+    }
+  }
+  if (o < db->wlen || (db->wlen > 0 && fdatasync(db->wfd) < 0))
+  {
+    r=-errno;
+    /* don't leave part of group in the middle of log */
+    if (ftruncate(db->wfd,db->wsize) < 0) {}
+    return r;
+  }
+  db->wsize+=db->wlen; db->wlen=0;
+  return 0;
+}
+
+static int tdb_cmp(const void *a, const void *b)
+{
+  uint64_t x=((const TLVdbitem*)a)->id,y=((const TLVdbitem*)b)->id;
+  return x < y ? -1 : x > y;
+}
+
+/*!
+    \brief write all sessions to new snapshot and start new log
+    \param db pointer to TLVdb structure
+    \return 0 success, negative failure (see tck_size, -ENOMEM, -errno);
+            store must be reopened if new log couldn't be started
+            (old one is already in snapshot)
+*/
+int tdb_compact(TLVdb *db)
+{
+  TLVdbitem *it;
+  TLVbuf *tbs;
+  uint64_t *ids;
+  TLVdbent *e;
+  TLVdbhdr h;
+  TLVdb s;
+  int64_t bsize;
+  size_t k=0,i,boff;
+  int fd=-1,r;
+
+  if ((r=tdb_commit(db)) < 0) return r;
+  i=db->nsnap+db->n+1;
+  it=(TLVdbitem*)malloc(i*sizeof(TLVdbitem));
+  tbs=(TLVbuf*)malloc(i*sizeof(TLVbuf));
+  ids=(uint64_t*)malloc(i*sizeof(uint64_t));
+  if (it == NULL || tbs == NULL || ids == NULL) { r=-ENOMEM; goto out; }
+
+  for (i=0; i < (size_t)db->nsnap; i++)
+    if (*tdb_slot(db,db->ids[i]) == NULL) { it[k].id=db->ids[i]; it[k++].tb=&db->ctx[i].tb; }
+  for (i=0; i < db->cap; i++)
+    for (e=db->tab[i]; e != NULL; e=e->next)
+      if (!e->dead) { it[k].id=e->id; it[k++].tb=&e->tb; }
+  qsort(it,k,sizeof(TLVdbitem),tdb_cmp);
+  for (i=0; i < k; i++) { ids[i]=it[i].id; tbs[i]=*it[i].tb; }
+  if (k > INT_MAX) { r=-EFBIG; goto out; }
+  if ((bsize=tck_size(tbs,k)) < 0) { r=bsize; goto out; }
+
+  /* header is 32 bytes, so batch image is 8 bytes aligned */
+  boff=sizeof(h)+k*sizeof(uint64_t);
+  memset(&h,0,sizeof(h));
+  memcpy(h.magic,TDB_MAGIC,4);
+  h.n=k; h.gen=db->gen; h.boff=boff;
+  h.crc=crc32c(0,ids,k*sizeof(uint64_t));
+  h.hcrc=crc32c(0,&h,sizeof(h));
+
+  if ((fd=openat(db->dfd,TDB_SNAP ".tmp",O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC,0600)) < 0) { r=-errno; goto out; }
+  if ((r=tdb_wr(fd,&h,sizeof(h))) < 0 ||
+      (r=tdb_wr(fd,ids,boff-sizeof(h))) < 0 ||
+      (r=tck_write(fd,tbs,k)) < 0)
+    goto out;
+  if (fsync(fd) < 0 || renameat(db->dfd,TDB_SNAP ".tmp",db->dfd,TDB_SNAP) < 0 ||
+      fsync(db->dfd) < 0)
+    { r=-errno; goto out; }
+  close(fd); fd=-1;
+
+  /* snapshot is durable, changes are in it */
+  memset(&s,0,sizeof(s));
+  s.dfd=db->dfd;
+  if ((r=tdb_newlog(db,db->gen+1)) < 0)
+  {
+    close(db->wfd); db->wfd=-1;
+    goto out;
+  }
+  if ((r=tdb_loadsnap(&s)) < 0) { tdb_unmap(&s); goto out; }
+  tdb_clear(db);
+  tdb_unmap(db);
+  db->map=s.map; db->msize=s.msize;
+  db->ids=s.ids; db->ctx=s.ctx; db->nsnap=s.nsnap;
+out:
+  if (fd >= 0) { close(fd); unlinkat(db->dfd,TDB_SNAP ".tmp",0); }
+  free(it); free(tbs); free(ids);
+  return r;
+}
+
+/*!
+    \brief get session (zero-copy view, valid until session is changed,
+           tdb_compact or tdb_close)
+    \param db pointer to TLVdb structure
+    \param id session ID
+    \param tb output TLVbuf (must not be changed)
+    \return 1 found, 0 not found
+*/
+int tdb_get(TLVdb *db, uint64_t id, TLVbuf *tb)
+{
+  TLVdbent *e=*tdb_slot(db,id);
+  int i;
+  if (e != NULL)
+  {
+    if (e->dead) return 0;
+    *tb=e->tb;
+    return 1;
+  }
+  if ((i=tdb_snapidx(db,id)) < 0) return 0;
+  *tb=db->ctx[i].tb;
+  return 1;
+}
+
+/*!
+    \brief find top level tag of session (index of snapshot is used for
+           unchanged session)
+    \param db pointer to TLVdb structure
+    \param id session ID
+    \param tag requested tag identifier
+    \param tlv output tlv to fill (may be NULL), value is view as in tdb_get
+    \return 1 on success, else 0
+*/
+int tdb_find(TLVdb *db, uint64_t id, ushort tag, TLV *tlv)
+{
+  TLVdbent *e=*tdb_slot(db,id);
+  int i;
+  if (e != NULL) return e->dead ? 0 : tb_find(&e->tb,tag,tlv);
+  if ((i=tdb_snapidx(db,id)) < 0) return 0;
+  return tck_find(&db->ctx[i],tag,tlv);
+}
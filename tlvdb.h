@@ -0,0 +1,73 @@
+#ifndef __COMMON_TLVDB_H
+#define __COMMON_TLVDB_H
+/*!
+	\file
+	\brief Persistent store of TLV sessions with write-ahead log (header)
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include "tlv.h"
+#include "tlvckpt.h"
+
+#define TDB_MAGIC   "TLVD"
+#define TDB_GROUP   (64*1024) /*!< \brief pending log bytes committed automatically */
+
+#define TDB_WHDR    0xc0    /*!< \brief log header: generation (8 bytes) */
+#define TDB_WADD    0xc5    /*!< \brief log record: TDB_WID, TDB_WOVR, added TLV */
+#define TDB_WDEL    0xc6    /*!< \brief log record: TDB_WID, TDB_WTAG */
+#define TDB_WDROP   0xc4    /*!< \brief log record: session ID (8 bytes) */
+#define TDB_WID     0xc1    /*!< \brief session ID (8 bytes) */
+#define TDB_WOVR    0xc2    /*!< \brief ovr of tb_add (1 byte) */
+#define TDB_WTAG    0xc3    /*!< \brief deleted tag (2 bytes) */
+
+/*!
+	\struct TLVdbhdr
+	\brief snapshot header (followed by sorted session IDs and batch image)
+*/
+typedef struct
+{
+  char magic[4];
+  uint32_t n;               /*!< \brief number of sessions */
+  uint64_t gen;             /*!< \brief last log generation included */
+  uint64_t boff;            /*!< \brief offset of batch image (8 bytes aligned) */
+  uint32_t crc;             /*!< \brief CRC-32C of session IDs */
+  uint32_t hcrc;            /*!< \brief CRC-32C of header (with hcrc=0) */
+} TLVdbhdr;
+
+typedef struct TLVdbent TLVdbent;
+
+/*!
+	\struct TLVdb
+	\brief session store (sessions changed since snapshot are private)
+*/
+typedef struct
+{
+  int dfd;                  /*!< \brief store directory */
+  int wfd;                  /*!< \brief log file */
+  uint64_t gen;             /*!< \brief log generation */
+  uint64_t wsize;           /*!< \brief committed log size */
+  uchar *wbuf;              /*!< \brief log records not committed */
+  int wlen,wcap;
+  uchar *map;               /*!< \brief snapshot mapping */
+  size_t msize;
+  const uint64_t *ids;      /*!< \brief snapshot session IDs (sorted) */
+  TLVckctx *ctx;            /*!< \brief snapshot sessions (views of mapping) */
+  int nsnap;                /*!< \brief number of snapshot sessions */
+  TLVdbent **tab;           /*!< \brief sessions changed since snapshot */
+  unsigned cap,n;
+} TLVdb;
+
+__BEGIN_DECLS
+EXPORT int tdb_open(TLVdb *db, const char *dir);
+EXPORT int tdb_close(TLVdb *db);
+EXPORT int tdb_add(TLVdb *db, uint64_t id, TLV *tlv, uchar ovr);
+EXPORT int tdb_del(TLVdb *db, uint64_t id, ushort tag);
+EXPORT int tdb_drop(TLVdb *db, uint64_t id);
+EXPORT int tdb_commit(TLVdb *db);
+EXPORT int tdb_compact(TLVdb *db);
+EXPORT int tdb_get(TLVdb *db, uint64_t id, TLVbuf *tb);
+EXPORT int tdb_find(TLVdb *db, uint64_t id, ushort tag, TLV *tlv);
+__END_DECLS
+
+#endif
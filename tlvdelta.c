@@ -0,0 +1,239 @@
+/*!
+	\file
+	\brief Delta encoding of TLV records against reference record
+
+	Record is expressed as sequence of operations on reference record
+	tags (taken in order of reference tag table):
+	  TD_COPY n  - n reference tags unchanged
+	  TD_SKIP n  - n reference tags removed (or moved)
+	  TD_CHG  n  - reference tag with new length and value (n bytes)
+	  TD_ADD  n  - new tag, n bytes of TLV
+	Operation is one byte: code in bits 7-6, n in bits 5-0;
+	n=63 means that n-63 follows as varint.
+
+	Encoder works on tag tables (see tlv_index()) and walks both records
+	once, so consecutive records of a stream should keep the table of
+	previous record to be used as reference for the next one.
+	Padding between tags is not kept. Tags of indefinite length are
+	always added as new (with their end-of-contents).
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "tlvdelta.h"
+
+#define TD_NMAX 63
+
+/*!
+    \brief append operation header to delta
+    \return 0 success, -ENOSPC delta buffer too short
+*/
+static int td_op(uchar *d, int dlen, int *pos, int op, unsigned n)
+{
+  int p=*pos;
+  if (p >= dlen) return -ENOSPC;
+  if (n < TD_NMAX) { d[p++]=op|n; *pos=p; return 0; }
+  d[p++]=op|TD_NMAX; n-=TD_NMAX;
+  do
+  {
+    if (p >= dlen) return -ENOSPC;
+    d[p++] = n >= 0x80 ? (n&0x7f)|0x80 : n;
+    n>>=7;
+  } while (n);
+  *pos=p;
+  return 0;
+}
+
+/*!
+    \brief append operation with data to delta
+    \return 0 success, -ENOSPC delta buffer too short
+*/
+static int td_data(uchar *d, int dlen, int *pos, int op, const uchar *b, int l)
+{
+  int r;
+  if ((r=td_op(d,dlen,pos,op,l)) < 0) return r;
+  if (l > dlen-*pos) return -ENOSPC;
+  memcpy(d+*pos,b,l); *pos+=l;
+  return 0;
+}
+
+/*!
+    \brief check if tag is of indefinite length
+    \param b buffer
+    \param e tag table entry
+    \return 1 indefinite length, else 0
+*/
+static int td_indef(const uchar *b, const TLVent *e)
+{
+  ushort tag;
+  return b[e->o+e->h-1] == LEN_BYTES && tlv_tag(b+e->o,e->h,&tag) == e->h-1;
+}
+
+static int td_hash(ushort t, int m)
+{
+  return (t*40503u)&m;
+}
+
+/*!
+    \brief encode record as delta against reference record
+    \param rb reference record buffer
+    \param re reference record tag table
+    \param rn reference record number of tags
+    \param b record buffer
+    \param e record tag table
+    \param n record number of tags
+    \param d output delta buffer
+    \param dlen delta buffer length
+    \return negative - failure (-ENOSPC delta buffer too short), delta length
+*/
+int td_encode(const uchar *rb, const TLVent *re, int rn,
+              const uchar *b, const TLVent *e, int n, uchar *d, int dlen)
+{
+  short hs[2*TD_MAXTAGS],ns[TD_MAXTAGS],*head=hs,*nxt=ns;
+  int i,j,k,m,cp=0,pos=0,r=0;
+  ushort tag;
+
+  for (m=2*TD_MAXTAGS; m < 2*rn; m<<=1) ;
+  if (rn > TD_MAXTAGS)
+  {
+    head=(short*)malloc((m+rn)*sizeof(short)); nxt=head+m;
+    if (head == NULL) return -ENOMEM;
+  }
+  m--;
+  for (k=0; k <= m; k++) head[k]=-1;
+  for (k=rn-1; k >= 0; k--) { i=td_hash(re[k].t,m); nxt[k]=head[i]; head[i]=k; }
+
+  for (i=0,j=0; i < n && r == 0; i++)
+  {
+    const uchar *v=b+e[i].o;
+    int el=e[i].h+e[i].l;
+    if (e[i].t == 0) k=-1;
+    else if (j < rn && re[j].t == e[i].t) k=j;
+    else for (k=head[td_hash(e[i].t,m)]; k >= 0 && (k < j || re[k].t != e[i].t); k=nxt[k]) ;
+    if (k < 0 || td_indef(b,&e[i]) || td_indef(rb,&re[k]))
+    {
+      if (cp) { r=td_op(d,dlen,&pos,TD_COPY,cp); cp=0; }
+      if (td_indef(b,&e[i])) el+=2;
+      if (r == 0) r=td_data(d,dlen,&pos,TD_ADD,v,el);
+      continue;
+    }
+    if (k > j)
+    {
+      if (cp) { r=td_op(d,dlen,&pos,TD_COPY,cp); cp=0; }
+      if (r == 0) r=td_op(d,dlen,&pos,TD_SKIP,k-j);
+      j=k;
+    }
+    if (re[j].h+re[j].l == el && memcmp(rb+re[j].o,v,el) == 0) cp++;
+    else
+    {
+      if (cp) { r=td_op(d,dlen,&pos,TD_COPY,cp); cp=0; }
+      k=tlv_tag(v,el,&tag);
+      if (r == 0) r=td_data(d,dlen,&pos,TD_CHG,v+k,el-k);
+    }
+    j++;
+  }
+  if (r == 0 && cp) r=td_op(d,dlen,&pos,TD_COPY,cp);
+  if (head != hs) free(head);
+  return r < 0 ? r : pos;
+}
+
+/*!
+    \brief reconstruct record from delta against reference record
+    \param rb reference record buffer
+    \param re reference record tag table
+    \param rn reference record number of tags
+    \param d delta
+    \param dlen delta length
+    \param tb output TLVbuf (its content is replaced)
+    \return 1 success, -EINVAL broken delta, -EPIPE TLVbuf too short
+*/
+int td_decode(const uchar *rb, const TLVent *re, int rn,
+              const uchar *d, int dlen, TLVbuf *tb)
+{
+  const uchar *e=d+dlen;
+  unsigned n,s;
+  int op,j=0,k;
+  ushort tag;
+  uchar *o=tb->buf,*oe=tb->buf+tb->mlen;
+
+  while (d < e)
+  {
+    op=*d&0xc0; n=*d&TD_NMAX; d++;
+    if (n == TD_NMAX)
+    {
+      for (s=0; ; s+=7)
+      {
+        if (d >= e || s > 28) return -EINVAL;
+        n+=(*d&0x7f)<<s;
+        if ((*d++&0x80) == 0) break;
+      }
+    }
+    switch (op)
+    {
+      case TD_COPY:
+        if (n > (unsigned)(rn-j)) return -EINVAL;
+        while (n > 0)
+        {
+          /* join adjacent reference tags into one copy */
+          int l=re[j].h+re[j].l;
+          const uchar *v=rb+re[j].o;
+          for (j++,n--; n > 0 && re[j].o == v-rb+l; j++,n--) l+=re[j].h+re[j].l;
+          if (l > oe-o) return -EPIPE;
+          memcpy(o,v,l); o+=l;
+        }
+        break;
+      case TD_SKIP:
+        if (n > (unsigned)(rn-j)) return -EINVAL;
+        j+=n;
+        break;
+      case TD_CHG:
+        if (j >= rn || n > (unsigned)(e-d)) return -EINVAL;
+        k=tlv_tag(rb+re[j].o,re[j].h,&tag);
+        if (k+n > (unsigned)(oe-o)) return -EPIPE;
+        memcpy(o,rb+re[j].o,k); o+=k;
+        memcpy(o,d,n); o+=n; d+=n; j++;
+        break;
+      case TD_ADD:
+        if (n > (unsigned)(e-d)) return -EINVAL;
+        if (n > (unsigned)(oe-o)) return -EPIPE;
+        memcpy(o,d,n); o+=n; d+=n;
+        break;
+    }
+  }
+  tb->len=o-tb->buf;
+  return 1;
+}
+
+/*!
+    \brief encode TLVbuf as delta against reference TLVbuf
+    \param ref reference TLVbuf
+    \param tb TLVbuf to encode
+    \param d output delta buffer
+    \param dlen delta buffer length
+    \return negative - failure, delta length
+*/
+int tb_delta(const TLVbuf *ref, const TLVbuf *tb, uchar *d, int dlen)
+{
+  TLVent re[TD_MAXTAGS],e[TD_MAXTAGS];
+  int rn,n;
+  if ((rn=tb_index(ref,re,TD_MAXTAGS)) < 0) return rn==-1 ? -EINVAL : rn;
+  if ((n=tb_index(tb,e,TD_MAXTAGS)) < 0) return n==-1 ? -EINVAL : n;
+  return td_encode(ref->buf,re,rn,tb->buf,e,n,d,dlen);
+}
+
+/*!
+    \brief reconstruct TLVbuf from delta against reference TLVbuf
+    \param ref reference TLVbuf
+    \param d delta
+    \param dlen delta length
+    \param tb output TLVbuf (must not be ref)
+    \return 1 success, negative failure
+*/
+int tb_undelta(const TLVbuf *ref, const uchar *d, int dlen, TLVbuf *tb)
+{
+  TLVent re[TD_MAXTAGS];
+  int rn;
+  if ((rn=tb_index(ref,re,TD_MAXTAGS)) < 0) return rn==-1 ? -EINVAL : rn;
+  return td_decode(ref->buf,re,rn,d,dlen,tb);
+}
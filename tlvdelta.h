@@ -0,0 +1,27 @@
+#ifndef __COMMON_TLVDELTA_H
+#define __COMMON_TLVDELTA_H
+/*!
+	\file
+	\brief Delta encoding of TLV records against reference record (header)
+*/
+
+#include <sys/types.h>
+#include "tlv.h"
+
+#define TD_MAXTAGS 256    /*!< \brief max tags of record for TLVbuf wrappers */
+
+#define TD_COPY  0x00     /*!< \brief copy n reference tags */
+#define TD_SKIP  0x40     /*!< \brief skip n reference tags */
+#define TD_CHG   0x80     /*!< \brief replace value of reference tag, n bytes of length+value follow */
+#define TD_ADD   0xc0     /*!< \brief insert new tag, n bytes of TLV follow */
+
+__BEGIN_DECLS
+EXPORT int td_encode(const uchar *rb, const TLVent *re, int rn,
+                     const uchar *b, const TLVent *e, int n, uchar *d, int dlen);
+EXPORT int td_decode(const uchar *rb, const TLVent *re, int rn,
+                     const uchar *d, int dlen, TLVbuf *tb);
+EXPORT int tb_delta(const TLVbuf *ref, const TLVbuf *tb, uchar *d, int dlen);
+EXPORT int tb_undelta(const TLVbuf *ref, const uchar *d, int dlen, TLVbuf *tb);
+__END_DECLS
+
+#endif
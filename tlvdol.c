@@ -0,0 +1,255 @@
+/*!
+	\file
+	\brief Digest and MAC of DOL selected TLV values
+
+	DOL (data object list) is list of tags with lengths. Data of DOL is
+	concatenation of values of listed tags, each one formatted to its DOL
+	length (EMV Book 3, 5.4): numeric values are truncated from the left
+	and padded with leading zeros, other values are truncated from the
+	right and padded with trailing 0x00 (0xFF compressed numeric), missing
+	tags give zeros. Instead of building the data in temporary buffer (as
+	tb_addtags() does) value spans and padding are passed straight to
+	update callback of digest or MAC.
+
+	MAC is computed over block cipher callback, so any cipher (DES, 3DES,
+	AES) and key storage may be used: CBC-MAC with ISO 9797-1 padding and
+	optional output transformation (retail MAC: decrypt with K2, encrypt
+	with K1) or CMAC.
+*/
+
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+#include <string.h>
+#include <errno.h>
+#include "sha256.h"
+#include "tlvdol.h"
+
+/*!
+	\brief EMV tags of numeric (n) and compressed numeric (cn) format
+*/
+static const struct { ushort tag; uchar fmt; } dol_fmts[] = {
+  {0x5a,DOL_CN},   {0x5f24,DOL_N},  {0x5f25,DOL_N},  {0x5f28,DOL_N},
+  {0x5f2a,DOL_N},  {0x5f30,DOL_N},  {0x5f34,DOL_N},  {0x5f36,DOL_N},
+  {0x5f57,DOL_N},  {0x9a,DOL_N},    {0x9c,DOL_N},    {0x9f01,DOL_N},
+  {0x9f02,DOL_N},  {0x9f03,DOL_N},  {0x9f11,DOL_N},  {0x9f15,DOL_N},
+  {0x9f1a,DOL_N},  {0x9f20,DOL_CN}, {0x9f21,DOL_N},  {0x9f35,DOL_N},
+  {0x9f39,DOL_N},  {0x9f3c,DOL_N},  {0x9f3d,DOL_N},  {0x9f41,DOL_N},
+  {0x9f42,DOL_N},  {0x9f43,DOL_N},  {0x9f44,DOL_N},  {0x9f57,DOL_N},
+};
+
+/*!
+    \brief get format of tag (for formatting to DOL length)
+    \param tag tag ID
+    \return DOL_N, DOL_CN, DOL_B
+*/
+int dol_fmt(ushort tag)
+{
+  unsigned i;
+  for (i=0; i < sizeof(dol_fmts)/sizeof(dol_fmts[0]); i++)
+    if (dol_fmts[i].tag == tag) return dol_fmts[i].fmt;
+  return DOL_B;
+}
+
+/*!
+    \brief get length of DOL data
+    \param dol DOL (tags and lengths)
+    \param dl DOL length
+    \return -EINVAL broken DOL, data length
+*/
+int dol_len(const uchar *dol, int dl)
+{
+  ushort tag;
+  int i=0,r,n=0;
+  while (i < dl)
+  {
+    if ((r=tlv_tag(dol+i,dl-i,&tag)) <= 0) return r == 0 ? n : -EINVAL;
+    i+=r;
+    if (i >= dl) return -EINVAL;
+    n+=dol[i++];
+  }
+  return n;
+}
+
+/*!
+    \brief pass padding to update callback
+*/
+static void dol_pad(int c, int n, dol_update up, void *ctx)
+{
+  uchar pad[32];
+  int k;
+  memset(pad,c,n < (int)sizeof(pad) ? n : (int)sizeof(pad));
+  for (; n > 0; n-=k)
+  {
+    k = n < (int)sizeof(pad) ? n : (int)sizeof(pad);
+    up(ctx,pad,k);
+  }
+}
+
+/*!
+    \brief pass DOL data to update callback (without building it)
+    \param src TLVbufs with values (searched in order)
+    \param nsrc number of TLVbufs
+    \param dol DOL (tags and lengths)
+    \param dl DOL length
+    \param up update callback
+    \param ctx callback context (digest or MAC)
+    \return -EINVAL broken DOL (some data may be passed), length of passed data
+*/
+int dol_feed(const TLVbuf *src, int nsrc, const uchar *dol, int dl, dol_update up, void *ctx)
+{
+  ushort tag;
+  int i=0,j,r,n=0,len,fmt;
+  TLV t;
+
+  if (dol_len(dol,dl) < 0) return -EINVAL;
+  while (i < dl)
+  {
+    if ((r=tlv_tag(dol+i,dl-i,&tag)) == 0) break;
+    i+=r;
+    len=dol[i++];
+    n+=len;
+    for (j=0, t.l=0; j < nsrc; j++)
+      if (tag != 0 && tb_find(&src[j],tag,&t)) break;
+    if (j == nsrc) { dol_pad(0x00,len,up,ctx); continue; }
+    fmt=dol_fmt(tag);
+    if (t.l >= len)
+    {
+      if (fmt == DOL_N) up(ctx,t.v+t.l-len,len);
+      else up(ctx,t.v,len);
+    }
+    else if (fmt == DOL_N)
+    {
+      dol_pad(0x00,len-t.l,up,ctx);
+      up(ctx,t.v,t.l);
+    }
+    else
+    {
+      up(ctx,t.v,t.l);
+      dol_pad(fmt == DOL_CN ? 0xff : 0x00,len-t.l,up,ctx);
+    }
+  }
+  return n;
+}
+
+/*!
+    \brief update callback of SHA-256
+    \param ctx pointer to sha256_ctx (initialized by sha256_init)
+    \param b next data
+    \param l data length
+*/
+void dol_sha256(void *ctx, const uchar *b, size_t l)
+{
+  sha256_update((sha256_ctx*)ctx,b,l);
+}
+
+/*!
+    \brief xor block
+*/
+static void dol_xor(uchar *c, const uchar *b, int n)
+{
+  while (n-- > 0) c[n]^=b[n];
+}
+
+/*!
+    \brief multiply by x in GF(2^n) (CMAC subkey)
+*/
+static void dol_dbl(uchar *k, int bs)
+{
+  int i,msb=k[0]&0x80;
+  for (i=0; i < bs-1; i++) k[i]=(k[i]<<1)|(k[i+1]>>7);
+  k[bs-1]<<=1;
+  if (msb) k[bs-1]^= bs == 16 ? 0x87 : 0x1b;
+}
+
+/*!
+    \brief initialize MAC context
+    \param m pointer to DOLmac structure
+    \param mode DOL_MAC1, DOL_MAC2, DOL_CMAC
+    \param bs cipher block size (8 or 16)
+    \param enc block encryption callback (with chaining key)
+    \param fin output transformation of last block (NULL none, ignored for CMAC)
+    \param key context of cipher callbacks
+    \return 0 success, -EINVAL wrong mode or block size
+*/
+int dol_macinit(DOLmac *m, int mode, int bs, dol_cipher enc, dol_cipher fin, void *key)
+{
+  if ((bs != 8 && bs != 16) || mode < DOL_MAC1 || mode > DOL_CMAC) return -EINVAL;
+  memset(m,0,sizeof(DOLmac));
+  m->mode=mode; m->bs=bs;
+  m->enc=enc; m->fin=fin; m->key=key;
+  return 0;
+}
+
+/*!
+    \brief update callback of MAC
+    \param ctx pointer to DOLmac structure
+    \param b next data
+    \param l data length
+
+    Full block is chained only when more data follow (CMAC changes the last block).
+*/
+void dol_mac(void *ctx, const uchar *b, size_t l)
+{
+  DOLmac *m=(DOLmac*)ctx;
+  size_t k;
+  while (l > 0)
+  {
+    if (m->n == m->bs)
+    {
+      dol_xor(m->c,m->buf,m->bs);
+      m->enc(m->key,m->c,m->c);
+      m->n=0;
+    }
+    k = (size_t)(m->bs-m->n) < l ? (size_t)(m->bs-m->n) : l;
+    memcpy(m->buf+m->n,b,k);
+    m->n+=k; b+=k; l-=k;
+  }
+}
+
+/*!
+    \brief finish MAC
+    \param m pointer to DOLmac structure
+    \param mac output MAC (block size bytes)
+    \return MAC length (block size), -EINVAL wrong block size
+*/
+int dol_macfinal(DOLmac *m, uchar *mac)
+{
+  uchar k[DOL_MAXBLOCK];
+  int bs=m->bs;
+
+  if (bs != 8 && bs != 16) return -EINVAL;
+  if (m->mode == DOL_CMAC)
+  {
+    memset(k,0,bs);
+    m->enc(m->key,k,k);
+    dol_dbl(k,bs);
+    if (m->n < bs)
+    {
+      m->buf[m->n++]=0x80;
+      memset(m->buf+m->n,0,bs-m->n);
+      dol_dbl(k,bs);
+    }
+    dol_xor(m->buf,k,bs);
+    /* subkey, not to be optimized out as dead store */
+    explicit_bzero(k,sizeof(k));
+  }
+  else
+  {
+    if (m->mode == DOL_MAC2 && m->n == bs)
+    {
+      dol_xor(m->c,m->buf,bs);
+      m->enc(m->key,m->c,m->c);
+      m->n=0;
+    }
+    /* method 1 of empty data is one block of zeros */
+    if (m->mode == DOL_MAC2) m->buf[m->n++]=0x80;
+    memset(m->buf+m->n,0,bs-m->n);
+  }
+  dol_xor(m->c,m->buf,bs);
+  m->enc(m->key,m->c,m->c);
+  if (m->fin && m->mode != DOL_CMAC) m->fin(m->key,m->c,m->c);
+  memcpy(mac,m->c,bs);
+  memset(m->c,0,bs); memset(m->buf,0,bs); m->n=0;
+  return bs;
+}
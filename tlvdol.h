@@ -0,0 +1,63 @@
+#ifndef __COMMON_TLVDOL_H
+#define __COMMON_TLVDOL_H
+/*!
+	\file
+	\brief Digest and MAC of DOL selected TLV values (header)
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include "tlv.h"
+
+#define DOL_B        0      /*!< \brief binary/alphanumeric: left aligned, padded with 0x00 */
+#define DOL_N        1      /*!< \brief numeric: right aligned, padded with leading 0x00 */
+#define DOL_CN       2      /*!< \brief compressed numeric: left aligned, padded with 0xFF */
+
+#define DOL_MAC1     0      /*!< \brief CBC-MAC, ISO 9797-1 padding method 1 (zeros if needed) */
+#define DOL_MAC2     1      /*!< \brief CBC-MAC, ISO 9797-1 padding method 2 (0x80, zeros) */
+#define DOL_CMAC     2      /*!< \brief CMAC (NIST SP 800-38B) */
+#define DOL_MAXBLOCK 16     /*!< \brief max cipher block size */
+
+/*!
+    \brief update callback of digest or MAC
+    \param ctx digest or MAC context
+    \param b next data
+    \param l data length
+*/
+typedef void (*dol_update)(void *ctx, const uchar *b, size_t l);
+
+/*!
+    \brief block cipher callback (one block)
+    \param key cipher key (context)
+    \param in input block
+    \param out output block (may be the same as in)
+*/
+typedef void (*dol_cipher)(void *key, const uchar *in, uchar *out);
+
+/*!
+	\struct DOLmac
+	\brief incremental MAC over block cipher
+*/
+typedef struct
+{
+  dol_cipher enc;           /*!< \brief encryption of chained blocks */
+  dol_cipher fin;           /*!< \brief output transformation (e.g. retail MAC), NULL none */
+  void *key;                /*!< \brief context of cipher callbacks */
+  int mode;                 /*!< \brief DOL_MAC1, DOL_MAC2, DOL_CMAC */
+  int bs;                   /*!< \brief block size (8 or 16) */
+  int n;                    /*!< \brief bytes in buf */
+  uchar c[DOL_MAXBLOCK];    /*!< \brief chaining value */
+  uchar buf[DOL_MAXBLOCK];  /*!< \brief last (partial) block */
+} DOLmac;
+
+__BEGIN_DECLS
+EXPORT int dol_fmt(ushort tag);
+EXPORT int dol_len(const uchar *dol, int dl);
+EXPORT int dol_feed(const TLVbuf *src, int nsrc, const uchar *dol, int dl, dol_update up, void *ctx);
+EXPORT void dol_sha256(void *ctx, const uchar *b, size_t l);
+EXPORT int dol_macinit(DOLmac *m, int mode, int bs, dol_cipher enc, dol_cipher fin, void *key);
+EXPORT void dol_mac(void *ctx, const uchar *b, size_t l);
+EXPORT int dol_macfinal(DOLmac *m, uchar *mac);
+__END_DECLS
+
+#endif
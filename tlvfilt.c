@@ -0,0 +1,474 @@
+/*!
+	\file
+	\brief Predicate filter over TLV archives
+
+	Predicate syntax:
+	  expr   := term { OR term }
+	  term   := factor { AND factor }
+	  factor := NOT factor | '(' expr ')' | tag [ op value | IN value '..' value ]
+	  op     := '==' | '=' | '!=' | '<>' | '<' | '<=' | '>' | '>='
+	  tag    := hex tag ID (tag alone means tag exists)
+	  value  := hex digits (BCD or binary value bytes, right aligned)
+	          | '#' decimal number (binary value)
+	e.g. "9F02 > 100000 AND 5F2A == 0978 AND 9A IN 240101..241231"
+
+	Predicate is compiled into program of comparisons (RPN).
+	Archive records (every top level TLV is a record) are processed in
+	batches of TF_BATCH: all referenced tags of a record are extracted
+	in one pass into per tag columns, then every comparison and logical
+	operation is evaluated over whole batch in branchless loops.
+	Comparisons of 128-bit values are done by AVX2 or SSE4.2 kernels
+	(4 or 2 rows per step) chosen once at startup, logical operations
+	are vectorized by compiler.
+
+	Compiled filter is read-only, so archive can be split into chunks
+	(tf_chunks()) and scanned in parallel by threads sharing the filter.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include "tlvfilt.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define TF_MAXDEPTH 8
+#define TF_MAXREC   (3+3+0xffff)
+#define TF_MAXVAL   16
+
+typedef struct
+{
+  const char *s,*p;
+  TLVfilter *f;
+  int sp;           /* evaluation stack depth */
+} TFparse;
+
+typedef struct
+{
+  uint64_t hi[TF_MAXSLOTS][TF_BATCH];
+  uint64_t lo[TF_MAXSLOTS][TF_BATCH];
+  uchar has[TF_MAXSLOTS][TF_BATCH];     /* 0 missing, 1 present, 2 present but too long */
+  uchar st[TF_MAXSTACK][TF_BATCH];
+  uint64_t off[TF_BATCH];
+} TFwork;
+
+static int tf_expr(TFparse *p);
+
+static void tf_ws(TFparse *p)
+{
+  while (isspace((uchar)*p->p)) p->p++;
+}
+
+static int tf_kw(TFparse *p, const char *kw)
+{
+  int n=strlen(kw);
+  tf_ws(p);
+  if (strncasecmp(p->p,kw,n) || isalnum((uchar)p->p[n])) return 0;
+  p->p+=n;
+  return 1;
+}
+
+static int tf_emit(TFparse *p, uchar c)
+{
+  TLVfilter *f=p->f;
+  if (f->ncode == TF_MAXCODE) return -EINVAL;
+  if (c < TF_AND) { if (++p->sp > TF_MAXSTACK) return -EINVAL; }
+  else if (c != TF_NOT) p->sp--;
+  f->code[f->ncode++]=c;
+  return 0;
+}
+
+static int tf_cond(TFparse *p, int op, int slot, uint64_t hi, uint64_t lo)
+{
+  TLVfilter *f=p->f;
+  if (f->ncond == TF_MAXCOND) return -EINVAL;
+  f->cond[f->ncond].op=op; f->cond[f->ncond].slot=slot;
+  f->cond[f->ncond].hi=hi; f->cond[f->ncond].lo=lo;
+  return tf_emit(p,f->ncond++);
+}
+
+/*!
+    \brief parse constant
+    \return 0 success, -EINVAL syntax error
+*/
+static int tf_value(TFparse *p, uint64_t *hi, uint64_t *lo)
+{
+  int n=0,x;
+  tf_ws(p);
+  *hi=*lo=0;
+  if (*p->p == '#')
+  {
+    for (p->p++; isdigit((uchar)*p->p); p->p++,n++)
+    {
+      if (*lo > (UINT64_MAX-9)/10) return -EINVAL;
+      *lo=*lo*10+(*p->p-'0');
+    }
+    return n && !isalnum((uchar)*p->p) ? 0 : -EINVAL;
+  }
+  for (; isxdigit((uchar)*p->p); p->p++,n++)
+  {
+    if (n == 2*TF_MAXVAL) return -EINVAL;
+    x = *p->p <= '9' ? *p->p-'0' : (*p->p|0x20)-'a'+10;
+    *hi=(*hi<<4)|(*lo>>60); *lo=(*lo<<4)|x;
+  }
+  return n && !isalnum((uchar)*p->p) ? 0 : -EINVAL;
+}
+
+static int tf_factor(TFparse *p)
+{
+  static const struct { const char *s; uchar op; } ops[]={
+    {"==",TF_EQ},{"!=",TF_NE},{"<>",TF_NE},{"<=",TF_LE},{">=",TF_GE},
+    {"=",TF_EQ},{"<",TF_LT},{">",TF_GT}
+  };
+  TLVfilter *f=p->f;
+  uint64_t hi,lo,hi2,lo2;
+  unsigned tag=0;
+  int i,n,s,r;
+
+  if (tf_kw(p,"not"))
+  {
+    if ((r=tf_factor(p)) < 0) return r;
+    return tf_emit(p,TF_NOT);
+  }
+  if (*p->p == '(')
+  {
+    p->p++;
+    if ((r=tf_expr(p)) < 0) return r;
+    tf_ws(p);
+    if (*p->p != ')') return -EINVAL;
+    p->p++;
+    return 0;
+  }
+  for (n=0; isxdigit((uchar)*p->p); p->p++,n++)
+    tag=(tag<<4)|(*p->p <= '9' ? *p->p-'0' : (*p->p|0x20)-'a'+10);
+  if (n == 0 || n > 4 || tag == 0) return -EINVAL;
+  for (s=0; s < f->nslot && f->tag[s] != tag; s++) ;
+  if (s == f->nslot)
+  {
+    if (s == TF_MAXSLOTS) return -EINVAL;
+    f->tag[f->nslot++]=tag;
+  }
+
+  if (tf_kw(p,"in"))
+  {
+    if ((r=tf_value(p,&hi,&lo)) < 0) return r;
+    if (strncmp(p->p,"..",2)) return -EINVAL;
+    p->p+=2;
+    if ((r=tf_value(p,&hi2,&lo2)) < 0) return r;
+    if ((r=tf_cond(p,TF_GE,s,hi,lo)) < 0 || (r=tf_cond(p,TF_LE,s,hi2,lo2)) < 0) return r;
+    return tf_emit(p,TF_AND);
+  }
+  tf_ws(p);
+  for (i=0; i < (int)(sizeof(ops)/sizeof(ops[0])); i++)
+  {
+    n=strlen(ops[i].s);
+    if (strncmp(p->p,ops[i].s,n) == 0)
+    {
+      p->p+=n;
+      if ((r=tf_value(p,&hi,&lo)) < 0) return r;
+      return tf_cond(p,ops[i].op,s,hi,lo);
+    }
+  }
+  return tf_cond(p,TF_EX,s,0,0);
+}
+
+static int tf_term(TFparse *p)
+{
+  int r;
+  if ((r=tf_factor(p)) < 0) return r;
+  while (tf_kw(p,"and"))
+    if ((r=tf_factor(p)) < 0 || (r=tf_emit(p,TF_AND)) < 0) return r;
+  return 0;
+}
+
+static int tf_expr(TFparse *p)
+{
+  int r;
+  if ((r=tf_term(p)) < 0) return r;
+  while (tf_kw(p,"or"))
+    if ((r=tf_term(p)) < 0 || (r=tf_emit(p,TF_OR)) < 0) return r;
+  return 0;
+}
+
+/*!
+    \brief compile predicate
+    \param f output filter
+    \param s predicate text
+    \return 0 success, -EINVAL syntax error or predicate too complex (f->err is error position)
+*/
+int tf_compile(TLVfilter *f, const char *s)
+{
+  TFparse p;
+  int r;
+  memset(f,0,sizeof(TLVfilter));
+  p.s=p.p=s; p.f=f; p.sp=0;
+  if ((r=tf_expr(&p)) == 0)
+  {
+    tf_ws(&p);
+    if (*p.p) r=-EINVAL;
+  }
+  if (r < 0) f->err=p.p-s;
+  return r;
+}
+
+/*!
+    \brief extract referenced tags of record into batch row
+    \return 0 success, -EINVAL broken record
+*/
+static int tf_row(const TLVfilter *f, TFwork *w, int r, const uchar *b, int l)
+{
+  const uchar *sb[TF_MAXDEPTH];
+  int sl[TF_MAXDEPTH];
+  int i=0,s,sp=0,found=0;
+  TLV t;
+
+  for (s=0; s < f->nslot; s++) w->has[s][r]=0;
+  for (;;)
+  {
+    while (found < f->nslot && (i=tlv_parseTLV(b,l,&t)) > 0)
+    {
+      t.v += t.l;
+      l -= t.v - b; b = t.v;
+      t.v -= t.l;
+      for (s=0; s < f->nslot && f->tag[s] != t.t; s++) ;
+      if (s < f->nslot)
+      {
+        uint64_t hi=0,lo=0;
+        if (w->has[s][r]) continue;
+        found++;
+        if (t.l > TF_MAXVAL) { w->has[s][r]=2; continue; }
+        for (i=0; i < t.l; i++) { hi=(hi<<8)|(lo>>56); lo=(lo<<8)|t.v[i]; }
+        w->hi[s][r]=hi; w->lo[s][r]=lo; w->has[s][r]=1;
+      }
+      else if ((tlv_tag0(t.t) & TAG_CONSTR) && sp < TF_MAXDEPTH)
+        { sb[sp]=b; sl[sp]=l; sp++; b=t.v; l=t.l; }
+    }
+    if (found < f->nslot && i < 0) return -EINVAL;
+    if (sp == 0 || found == f->nslot) break;
+    sp--; b=sb[sp]; l=sl[sp];
+  }
+  return 0;
+}
+
+/*!
+    \brief evaluate comparison (not TF_EX) over batch rows r..n-1
+*/
+static void tf_cmp_scalar(const TLVfcond *c, const TFwork *w, uchar *o, int r, int n)
+{
+  const uint64_t *hi=w->hi[c->slot],*lo=w->lo[c->slot];
+  const uchar *has=w->has[c->slot];
+  const uint64_t ch=c->hi,cl=c->lo;
+#define TF_LOOP(expr) for (; r < n; r++) o[r]=(has[r]==1)&(expr)
+  switch (c->op)
+  {
+    case TF_EQ: TF_LOOP((hi[r]==ch)&(lo[r]==cl)); break;
+    case TF_NE: TF_LOOP((hi[r]!=ch)|(lo[r]!=cl)); break;
+    case TF_LT: TF_LOOP((hi[r]<ch)|((hi[r]==ch)&(lo[r]<cl))); break;
+    case TF_LE: TF_LOOP((hi[r]<ch)|((hi[r]==ch)&(lo[r]<=cl))); break;
+    case TF_GT: TF_LOOP((hi[r]>ch)|((hi[r]==ch)&(lo[r]>cl))); break;
+    case TF_GE: TF_LOOP((hi[r]>ch)|((hi[r]==ch)&(lo[r]>=cl))); break;
+  }
+#undef TF_LOOP
+}
+
+#if defined(__x86_64__)
+/*
+  SIMD kernels: 64-bit lanes are compared as signed (pcmpgtq) after
+  flipping the sign bit, what gives unsigned order. NE, LE, GE are
+  negated EQ, GT, LT. Lane mask (movmskpd) is spread to bytes by
+  multiplication and masked with has (bit 0 is set only for has==1).
+*/
+#define TF_SIGN 0x8000000000000000ull
+#define TF_NEG(op) ((op) == TF_NE || (op) == TF_LE || (op) == TF_GE)
+
+__attribute__((target("avx2")))
+static void tf_cmp_avx2(const TLVfcond *c, const TFwork *w, uchar *o, int n)
+{
+  const uint64_t *hi=w->hi[c->slot],*lo=w->lo[c->slot];
+  const uchar *has=w->has[c->slot];
+  const __m256i sg=_mm256_set1_epi64x((long long)TF_SIGN);
+  const __m256i ch=_mm256_set1_epi64x((long long)(c->hi^TF_SIGN));
+  const __m256i cl=_mm256_set1_epi64x((long long)(c->lo^TF_SIGN));
+  const unsigned neg=TF_NEG(c->op) ? 0xf : 0;
+  __m256i h,l,e;
+  uint32_t m,x;
+  int r=0;
+#define TF_VLOOP(expr) \
+  for (; r+4 <= n; r+=4) \
+  { \
+    h=_mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(hi+r)),sg); \
+    l=_mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(lo+r)),sg); \
+    e=_mm256_cmpeq_epi64(h,ch); \
+    m=_mm256_movemask_pd(_mm256_castsi256_pd(expr))^neg; \
+    memcpy(&x,has+r,4); \
+    x&=m*0x00204081u&0x01010101u; \
+    memcpy(o+r,&x,4); \
+  }
+  switch (c->op)
+  {
+    case TF_EQ: case TF_NE:
+      TF_VLOOP(_mm256_and_si256(e,_mm256_cmpeq_epi64(l,cl))); break;
+    case TF_LT: case TF_GE:
+      TF_VLOOP(_mm256_or_si256(_mm256_cmpgt_epi64(ch,h),_mm256_and_si256(e,_mm256_cmpgt_epi64(cl,l)))); break;
+    case TF_GT: case TF_LE:
+      TF_VLOOP(_mm256_or_si256(_mm256_cmpgt_epi64(h,ch),_mm256_and_si256(e,_mm256_cmpgt_epi64(l,cl)))); break;
+  }
+#undef TF_VLOOP
+  tf_cmp_scalar(c,w,o,r,n);
+}
+
+__attribute__((target("sse4.2")))
+static void tf_cmp_sse42(const TLVfcond *c, const TFwork *w, uchar *o, int n)
+{
+  const uint64_t *hi=w->hi[c->slot],*lo=w->lo[c->slot];
+  const uchar *has=w->has[c->slot];
+  const __m128i sg=_mm_set1_epi64x((long long)TF_SIGN);
+  const __m128i ch=_mm_set1_epi64x((long long)(c->hi^TF_SIGN));
+  const __m128i cl=_mm_set1_epi64x((long long)(c->lo^TF_SIGN));
+  const unsigned neg=TF_NEG(c->op) ? 0x3 : 0;
+  __m128i h,l,e;
+  uint16_t m,x;
+  int r=0;
+#define TF_VLOOP(expr) \
+  for (; r+2 <= n; r+=2) \
+  { \
+    h=_mm_xor_si128(_mm_loadu_si128((const __m128i*)(hi+r)),sg); \
+    l=_mm_xor_si128(_mm_loadu_si128((const __m128i*)(lo+r)),sg); \
+    e=_mm_cmpeq_epi64(h,ch); \
+    m=_mm_movemask_pd(_mm_castsi128_pd(expr))^neg; \
+    memcpy(&x,has+r,2); \
+    x&=m*0x0081u&0x0101u; \
+    memcpy(o+r,&x,2); \
+  }
+  switch (c->op)
+  {
+    case TF_EQ: case TF_NE:
+      TF_VLOOP(_mm_and_si128(e,_mm_cmpeq_epi64(l,cl))); break;
+    case TF_LT: case TF_GE:
+      TF_VLOOP(_mm_or_si128(_mm_cmpgt_epi64(ch,h),_mm_and_si128(e,_mm_cmpgt_epi64(cl,l)))); break;
+    case TF_GT: case TF_LE:
+      TF_VLOOP(_mm_or_si128(_mm_cmpgt_epi64(h,ch),_mm_and_si128(e,_mm_cmpgt_epi64(l,cl)))); break;
+  }
+#undef TF_VLOOP
+  tf_cmp_scalar(c,w,o,r,n);
+}
+#endif
+
+static void tf_cmp_all(const TLVfcond *c, const TFwork *w, uchar *o, int n)
+{
+  tf_cmp_scalar(c,w,o,0,n);
+}
+
+static void (*tf_cmp_kernel)(const TLVfcond *c, const TFwork *w, uchar *o, int n) = tf_cmp_all;
+
+__attribute__((constructor))
+static void tf_setup(void)
+{
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) tf_cmp_kernel=tf_cmp_avx2;
+  else if (__builtin_cpu_supports("sse4.2")) tf_cmp_kernel=tf_cmp_sse42;
+#endif
+}
+
+/*!
+    \brief evaluate comparison over batch
+*/
+static void tf_cmp(const TLVfcond *c, const TFwork *w, uchar *o, int n)
+{
+  const uchar *has=w->has[c->slot];
+  int r;
+  if (c->op == TF_EX) { for (r=0; r < n; r++) o[r]=has[r]!=0; return; }
+  tf_cmp_kernel(c,w,o,n);
+}
+
+/*!
+    \brief evaluate program over batch
+    \return result vector (1 for matching records)
+*/
+static const uchar *tf_eval(const TLVfilter *f, TFwork *w, int n)
+{
+  int i,r,sp=0;
+  for (i=0; i < f->ncode; i++)
+  {
+    uchar c=f->code[i],*x,*y;
+    if (c < TF_AND) { tf_cmp(&f->cond[c],w,w->st[sp++],n); continue; }
+    x=w->st[sp-1];
+    if (c == TF_NOT) { for (r=0; r < n; r++) x[r]^=1; continue; }
+    y=w->st[--sp-1];
+    if (c == TF_AND) for (r=0; r < n; r++) y[r]&=x[r];
+    else for (r=0; r < n; r++) y[r]|=x[r];
+  }
+  return w->st[0];
+}
+
+/*!
+    \brief filter records of archive
+    \param f compiled filter
+    \param a archive (or its chunk starting at record boundary)
+    \param alen archive length
+    \param base offset of a in archive (added to reported offsets)
+    \param cb callback receiving offsets of matching records
+    \param ctx callback context
+    \return 0 success, callback result if stopped, -EINVAL broken archive, -ENOMEM no memory
+*/
+int tf_scan(const TLVfilter *f, const uchar *a, size_t alen, uint64_t base, tf_matchcb cb, void *ctx)
+{
+  TFwork *w;
+  const uchar *m;
+  size_t pos=0,l;
+  int n,i,k,r=0;
+  TLV t;
+
+  if (f->ncode == 0) return -EINVAL;
+  if ((w=(TFwork*)malloc(sizeof(TFwork))) == NULL) return -ENOMEM;
+  while (pos < alen && r == 0)
+  {
+    for (n=0; n < TF_BATCH && pos < alen; )
+    {
+      if (a[pos] == 0x00) { pos++; continue; }
+      l = alen-pos > TF_MAXREC ? TF_MAXREC : alen-pos;
+      if (tlv_parseTLV(a+pos,l,&t) <= 0) { r=-EINVAL; break; }
+      l=t.v+t.l-(a+pos);
+      if ((r=tf_row(f,w,n,a+pos,l)) < 0) break;
+      w->off[n++]=base+pos;
+      pos+=l;
+    }
+    if (r < 0 || n == 0) break;
+    m=tf_eval(f,w,n);
+    for (i=k=0; i < n; i++) { w->off[k]=w->off[i]; k+=m[i]; }
+    if (k > 0) r=cb(ctx,w->off,k);
+  }
+  free(w);
+  return r;
+}
+
+/*!
+    \brief split archive into chunks at record boundaries (for parallel scan)
+    \param a archive
+    \param alen archive length
+    \param n number of chunks
+    \param cut output n+1 chunk boundaries (chunk i is cut[i]..cut[i+1])
+    \return 0 success, -EINVAL broken archive
+*/
+int tf_chunks(const uchar *a, size_t alen, int n, size_t *cut)
+{
+  size_t pos=0,l;
+  int k=1;
+  TLV t;
+
+  cut[0]=0;
+  while (pos < alen && k < n)
+  {
+    if (pos >= alen/n*k) { cut[k++]=pos; continue; }
+    if (a[pos] == 0x00) { pos++; continue; }
+    l = alen-pos > TF_MAXREC ? TF_MAXREC : alen-pos;
+    if (tlv_parseTLV(a+pos,l,&t) <= 0) return -EINVAL;
+    pos=t.v+t.l-a;
+  }
+  while (k <= n) cut[k++]=alen;
+  return 0;
+}
@@ -0,0 +1,72 @@
+#ifndef __COMMON_TLVFILT_H
+#define __COMMON_TLVFILT_H
+/*!
+	\file
+	\brief Predicate filter over TLV archives (header)
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include "tlv.h"
+
+#define TF_MAXSLOTS 16    /*!< \brief max distinct tags in predicate */
+#define TF_MAXCOND  32    /*!< \brief max comparisons in predicate */
+#define TF_MAXCODE  64    /*!< \brief max program length */
+#define TF_MAXSTACK 16    /*!< \brief max nesting of evaluation */
+#define TF_BATCH    256   /*!< \brief records evaluated at once */
+
+#define TF_EX   0         /*!< \brief tag exists */
+#define TF_EQ   1         /*!< \brief == */
+#define TF_NE   2         /*!< \brief != */
+#define TF_LT   3         /*!< \brief < */
+#define TF_LE   4         /*!< \brief <= */
+#define TF_GT   5         /*!< \brief > */
+#define TF_GE   6         /*!< \brief >= */
+
+#define TF_AND  0xfd      /*!< \brief program: logical and */
+#define TF_OR   0xfe      /*!< \brief program: logical or */
+#define TF_NOT  0xff      /*!< \brief program: logical not */
+
+/*!
+	\struct TLVfcond
+	\brief single comparison of tag value with constant
+
+	Values up to 16 bytes are compared as right aligned big endian
+	numbers (hi,lo), what is numeric order of BCD and binary values.
+*/
+typedef struct
+{
+  uchar op;         /*!< \brief TF_EX..TF_GE */
+  uchar slot;       /*!< \brief tag slot */
+  uint64_t hi;      /*!< \brief constant, high 8 bytes */
+  uint64_t lo;      /*!< \brief constant, low 8 bytes */
+} TLVfcond;
+
+/*!
+	\struct TLVfilter
+	\brief compiled predicate (read-only, may be shared by threads)
+*/
+typedef struct
+{
+  int nslot;                    /*!< \brief number of tag slots */
+  ushort tag[TF_MAXSLOTS];      /*!< \brief tag of every slot */
+  int ncond;                    /*!< \brief number of comparisons */
+  TLVfcond cond[TF_MAXCOND];    /*!< \brief comparisons */
+  int ncode;                    /*!< \brief program length */
+  uchar code[TF_MAXCODE];       /*!< \brief program (RPN): comparison index or TF_AND/TF_OR/TF_NOT */
+  int err;                      /*!< \brief position of syntax error */
+} TLVfilter;
+
+/*!
+    \brief callback called with offsets of matching records (once per batch)
+    \return 0 continue, otherwise stop filtering and return this value
+*/
+typedef int (*tf_matchcb)(void *ctx, const uint64_t *offs, int n);
+
+__BEGIN_DECLS
+EXPORT int tf_compile(TLVfilter *f, const char *s);
+EXPORT int tf_scan(const TLVfilter *f, const uchar *a, size_t alen, uint64_t base, tf_matchcb cb, void *ctx);
+EXPORT int tf_chunks(const uchar *a, size_t alen, int n, size_t *cut);
+__END_DECLS
+
+#endif
@@ -0,0 +1,501 @@
+/*!
+	\file
+	\brief External sort and hash join of TLV archives by key tags
+
+	Archive is a file of TLV records (every top level TLV is a record),
+	normally mapped into memory. tj_index() extracts keys of all records
+	into index file of fixed size TJent entries (key + record offset),
+	the archive itself is never copied.
+	tj_sort() sorts index file in runs bounded by given memory and merges
+	them (TJ_MAXRUNS at once). tj_join() joins two index files with
+	partitioned (grace) hash join: both sides are split by key hash into
+	partitions small enough to build in-memory hash table. Partition
+	which is still too big (skewed keys, TJ_MAXPART reached) is split
+	again with hash of another seed, up to TJ_MAXLEVEL times. Partition
+	files of one level are limited by RLIMIT_NOFILE (shared by all
+	levels, TJ_FDRESERVE left to caller), more partitions are written in
+	several passes over input. What can't
+	be split (many equal keys) is joined by chunks of build side, each
+	probed with whole other side, so memory stays bounded in any case.
+
+	When key is longer than TJ_KEYLEN entries are flagged with TJ_TRUNC
+	and join callback should compare full keys read from archives.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include "tlvjoin.h"
+
+#define TJ_MAXDEPTH 8
+#define TJ_MAXREC   (3+3+0xffff)  /* max TLV length (tag, length and value) */
+#define TJ_MINBUF   4096
+#define TJ_MAXPART  1024
+#define TJ_MAXLEVEL 3       /* repartitioning of too big partitions */
+#define TJ_FDRESERVE 64     /* descriptors left to caller */
+
+typedef struct
+{
+  int fd;
+  uchar *b;
+  size_t cap,pos,n;
+} TJio;
+
+static int tj_cmp(const void *a, const void *b)
+{
+  const TJent *x=(const TJent*)a,*y=(const TJent*)b;
+  int r=memcmp(x->k,y->k,TJ_KEYLEN);
+  if (r) return r;
+  return x->off < y->off ? -1 : x->off > y->off;
+}
+
+static uint32_t tj_hash(const TJent *e, uint32_t seed)
+{
+  uint32_t h=2166136261u^(seed*0x9e3779b9u);
+  int i;
+  for (i=0; i < TJ_KEYLEN; i++) h=(h^e->k[i])*16777619u;
+  return h;
+}
+
+/*!
+    \brief create temporary file (already unlinked)
+    \param dir directory for temporary files (NULL for /tmp)
+    \return file descriptor, negative errno
+*/
+static int tj_tmp(const char *dir)
+{
+  char n[256];
+  int fd;
+  snprintf(n,sizeof(n),"%s/tjXXXXXX",dir?dir:"/tmp");
+  if ((fd=mkstemp(n)) < 0) return -errno;
+  unlink(n);
+  return fd;
+}
+
+static int tj_open(TJio *io, int fd, size_t cap)
+{
+  io->fd=fd; io->pos=io->n=0;
+  io->cap=cap < TJ_MINBUF ? TJ_MINBUF : cap/sizeof(TJent)*sizeof(TJent);
+  if ((io->b=(uchar*)malloc(io->cap)) == NULL) return -ENOMEM;
+  return 0;
+}
+
+static int tj_flush(TJio *io)
+{
+  size_t p=0;
+  ssize_t r;
+  while (p < io->pos)
+  {
+    if ((r=write(io->fd,io->b+p,io->pos-p)) < 0) { if (errno == EINTR) continue; return -errno; }
+    p+=r;
+  }
+  io->pos=0;
+  return 0;
+}
+
+static int tj_put(TJio *io, const TJent *e)
+{
+  int r;
+  if (io->pos+sizeof(TJent) > io->cap && (r=tj_flush(io)) < 0) return r;
+  memcpy(io->b+io->pos,e,sizeof(TJent)); io->pos+=sizeof(TJent);
+  return 0;
+}
+
+/*!
+    \brief read whole entries
+    \return number of bytes read (multiple of sizeof(TJent)), negative errno
+*/
+static ssize_t tj_rd(int fd, void *b, size_t l)
+{
+  size_t p=0;
+  ssize_t r;
+  while (p < l)
+  {
+    if ((r=read(fd,(uchar*)b+p,l-p)) < 0) { if (errno == EINTR) continue; return -errno; }
+    if (r == 0) break;
+    p+=r;
+  }
+  return p/sizeof(TJent)*sizeof(TJent);
+}
+
+/*!
+    \brief get next entry
+    \return 1 entry read, 0 end of file, negative errno
+*/
+static int tj_get(TJio *io, TJent *e)
+{
+  if (io->pos == io->n)
+  {
+    ssize_t r;
+    if ((r=tj_rd(io->fd,io->b,io->cap)) <= 0) return r;
+    io->n=r; io->pos=0;
+  }
+  memcpy(e,io->b+io->pos,sizeof(TJent)); io->pos+=sizeof(TJent);
+  return 1;
+}
+
+/*!
+    \brief extract key of record (single pass over record tags)
+    \param b binary buffer with record (TLV structured)
+    \param l binary buffer length
+    \param tags key tags
+    \param n number of key tags
+    \param e output entry (off is not changed except TJ_TRUNC flag)
+    \return 0 success, -EINVAL broken record or too many tags
+*/
+int tj_key(const uchar *b, int l, const ushort *tags, int n, TJent *e)
+{
+  const uchar *sb[TJ_MAXDEPTH];
+  int sl[TJ_MAXDEPTH];
+  TLV v[TJ_MAXTAGS],t;
+  int i=0,j,k,sp=0,found=0;
+
+  if (n > TJ_MAXTAGS) return -EINVAL;
+  memset(v,0,sizeof(v));
+  for (;;)
+  {
+    while (found < n && (i=tlv_parseTLV(b,l,&t)) > 0)
+    {
+      t.v += t.l;
+      l -= t.v - b; b = t.v;
+      t.v -= t.l;
+      for (j=0; j < n && (tags[j] != t.t || v[j].v); j++) ;
+      if (j < n) { v[j]=t; found++; }
+      else if ((tlv_tag0(t.t) & TAG_CONSTR) && sp < TJ_MAXDEPTH)
+        { sb[sp]=b; sl[sp]=l; sp++; b=t.v; l=t.l; }
+    }
+    if (found < n && i < 0) return -EINVAL;
+    if (sp == 0 || found == n) break;
+    sp--; b=sb[sp]; l=sl[sp];
+  }
+
+  memset(e->k,0,TJ_KEYLEN);
+  e->off&=~TJ_TRUNC;
+  for (j=0,k=0; j < n; j++)
+  {
+    int vl = v[j].l > 0xff ? 0xff : v[j].l;
+    if (k+1+vl > TJ_KEYLEN)
+    {
+      if (k < TJ_KEYLEN) e->k[k++]=vl;
+      if (k < TJ_KEYLEN) memcpy(e->k+k,v[j].v,TJ_KEYLEN-k);
+      e->off|=TJ_TRUNC;
+      break;
+    }
+    e->k[k++]=vl;
+    memcpy(e->k+k,v[j].v,vl); k+=vl;
+  }
+  return 0;
+}
+
+/*!
+    \brief extract keys of all records of archive into index file
+    \param a archive (mapped)
+    \param alen archive length
+    \param tags key tags
+    \param n number of key tags
+    \param fd index file descriptor opened for writing
+    \return negative errno, number of records
+*/
+int64_t tj_index(const uchar *a, size_t alen, const ushort *tags, int n, int fd)
+{
+  TJio w;
+  TJent e;
+  size_t pos=0,l;
+  int64_t cnt=0;
+  int r;
+  TLV t;
+
+  if ((r=tj_open(&w,fd,1<<16)) < 0) return r;
+  while (pos < alen)
+  {
+    if (a[pos] == 0x00) { pos++; continue; }
+    l = alen-pos > TJ_MAXREC ? TJ_MAXREC : alen-pos;
+    if (tlv_parseTLV(a+pos,l,&t) <= 0) { r=-EINVAL; break; }
+    l=t.v+t.l-(a+pos);
+    e.off=pos;
+    if ((r=tj_key(a+pos,l,tags,n,&e)) < 0 || (r=tj_put(&w,&e)) < 0) break;
+    pos+=l; cnt++;
+  }
+  if (r == 0) r=tj_flush(&w);
+  free(w.b);
+  return r < 0 ? r : cnt;
+}
+
+/*!
+    \brief merge sorted runs
+    \param fds run files
+    \param k number of runs
+    \param ofd output file
+    \param mem memory for buffers
+    \return 0 success, negative errno
+*/
+static int tj_merge(const int *fds, int k, int ofd, size_t mem)
+{
+  TJio *in,w;
+  TJent *h;       /* heap of current entries of runs */
+  int *hr,n=0,i,c,r=0;   /* hr: run of heap entry */
+
+  w.b=NULL;
+  in=(TJio*)calloc(k,sizeof(TJio));
+  h=(TJent*)malloc(k*sizeof(TJent));
+  hr=(int*)malloc(k*sizeof(int));
+  if (in == NULL || h == NULL || hr == NULL) { r=-ENOMEM; goto out; }
+  if ((r=tj_open(&w,ofd,mem/(k+1))) < 0) goto out;
+  for (i=0; i < k; i++)
+  {
+    if (lseek(fds[i],0,SEEK_SET) < 0) { r=-errno; goto out; }
+    if ((r=tj_open(&in[i],fds[i],mem/(k+1))) < 0) goto out;
+    if ((r=tj_get(&in[i],&h[n])) < 0) goto out;
+    if (r == 0) continue;
+    hr[n]=i;
+    for (c=n++; c > 0 && tj_cmp(&h[(c-1)/2],&h[c]) > 0; c=(c-1)/2)
+    {
+      TJent te=h[c]; int tr=hr[c];
+      h[c]=h[(c-1)/2]; hr[c]=hr[(c-1)/2]; h[(c-1)/2]=te; hr[(c-1)/2]=tr;
+    }
+  }
+  while (n > 0)
+  {
+    if ((r=tj_put(&w,&h[0])) < 0) goto out;
+    if ((r=tj_get(&in[hr[0]],&h[0])) < 0) goto out;
+    if (r == 0) { n--; h[0]=h[n]; hr[0]=hr[n]; }
+    for (i=0; ; i=c)
+    {
+      TJent te; int tr;
+      c=2*i+1;
+      if (c >= n) break;
+      if (c+1 < n && tj_cmp(&h[c+1],&h[c]) < 0) c++;
+      if (tj_cmp(&h[i],&h[c]) <= 0) break;
+      te=h[c]; tr=hr[c]; h[c]=h[i]; hr[c]=hr[i]; h[i]=te; hr[i]=tr;
+    }
+  }
+  r=tj_flush(&w);
+out:
+  if (in) for (i=0; i < k; i++) free(in[i].b);
+  free(w.b); free(in); free(h); free(hr);
+  return r;
+}
+
+static int tj_wrall(int fd, const void *b, size_t l)
+{
+  TJio w;
+  w.fd=fd; w.b=(uchar*)b; w.pos=l;
+  return tj_flush(&w);
+}
+
+/*!
+    \brief sort index file (external merge sort)
+    \param ifd input index file
+    \param ofd output index file
+    \param mem memory limit (bytes)
+    \param tmpdir directory for temporary run files (NULL for /tmp)
+    \return 0 success, negative errno
+*/
+int tj_sort(int ifd, int ofd, size_t mem, const char *tmpdir)
+{
+  TJent *b;
+  int *runs=NULL,nr=0,i,r=0,fd;
+  size_t cap=mem/sizeof(TJent);
+  ssize_t n;
+
+  if (cap < TJ_MINBUF/sizeof(TJent)) cap=TJ_MINBUF/sizeof(TJent);
+  if ((b=(TJent*)malloc(cap*sizeof(TJent))) == NULL) return -ENOMEM;
+  while ((n=tj_rd(ifd,b,cap*sizeof(TJent))) > 0)
+  {
+    void *p;
+    qsort(b,n/sizeof(TJent),sizeof(TJent),tj_cmp);
+    if (nr == 0 && (size_t)n < cap*sizeof(TJent))
+      { r=tj_wrall(ofd,b,n); free(b); return r; }
+    if ((p=realloc(runs,(nr+1)*sizeof(int))) == NULL) { r=-ENOMEM; goto out; }
+    runs=(int*)p;
+    if ((fd=tj_tmp(tmpdir)) < 0) { r=fd; goto out; }
+    runs[nr++]=fd;
+    if ((r=tj_wrall(fd,b,n)) < 0) goto out;
+  }
+  if (n < 0) { r=n; goto out; }
+  free(b); b=NULL;
+
+  /* merge to at most TJ_MAXRUNS runs */
+  while (nr > TJ_MAXRUNS)
+  {
+    if ((fd=tj_tmp(tmpdir)) < 0) { r=fd; goto out; }
+    if ((r=tj_merge(runs,TJ_MAXRUNS,fd,mem)) < 0) { close(fd); goto out; }
+    for (i=0; i < TJ_MAXRUNS; i++) close(runs[i]);
+    memmove(runs+1,runs+TJ_MAXRUNS,(nr-TJ_MAXRUNS)*sizeof(int));
+    runs[0]=fd; nr-=TJ_MAXRUNS-1;
+  }
+  if (nr > 0) r=tj_merge(runs,nr,ofd,mem);
+out:
+  for (i=0; i < nr; i++) close(runs[i]);
+  free(runs); free(b);
+  return r;
+}
+
+/*!
+    \brief build hash table from one side partition and probe it with other side
+    \return 0 success, callback result, negative errno
+
+    When build side doesn't fit into mem, it is built in chunks and other
+    side is read again for every chunk.
+*/
+static int tj_hjoin(int afd, int bfd, size_t mem, tj_joincb cb, void *ctx)
+{
+  struct stat st;
+  TJent *a=NULL,e;
+  uint32_t *ht=NULL,m,h,n,i;
+  uint64_t total,done,cap;
+  ssize_t k;
+  TJio rd;
+  int r=0;
+
+  rd.b=NULL;
+  if (fstat(afd,&st) < 0 || lseek(afd,0,SEEK_SET) < 0) return -errno;
+  total=st.st_size/sizeof(TJent);
+  /* entry and up to 4 hash table slots (table is 2-4 times entries) */
+  cap=mem/(sizeof(TJent)+4*sizeof(uint32_t));
+  if (cap < 16) cap=16;
+  if (cap > total) cap=total;
+  if (cap > UINT32_MAX/4) cap=UINT32_MAX/4;
+  for (m=16; m < 2*cap; m<<=1) ;
+  a=(TJent*)malloc(cap*sizeof(TJent)+1);
+  ht=(uint32_t*)malloc(m*sizeof(uint32_t));
+  if (a == NULL || ht == NULL) { r=-ENOMEM; goto out; }
+  if ((r=tj_open(&rd,bfd,mem/8)) < 0) goto out;
+  m--;
+  for (done=0; done < total; done+=n)
+  {
+    n = total-done < cap ? total-done : cap;
+    if ((k=tj_rd(afd,a,n*sizeof(TJent))) != (ssize_t)(n*sizeof(TJent))) { r = k < 0 ? (int)k : -EIO; goto out; }
+    memset(ht,0xff,(m+1)*sizeof(uint32_t));
+    for (i=0; i < n; i++)
+    {
+      for (h=tj_hash(&a[i],0)&m; ht[h] != UINT32_MAX; h=(h+1)&m) ;
+      ht[h]=i;
+    }
+    if (lseek(bfd,0,SEEK_SET) < 0) { r=-errno; goto out; }
+    rd.pos=rd.n=0;
+    while ((r=tj_get(&rd,&e)) > 0)
+    {
+      for (h=tj_hash(&e,0)&m; ht[h] != UINT32_MAX; h=(h+1)&m)
+        if (memcmp(a[ht[h]].k,e.k,TJ_KEYLEN) == 0 && (r=cb(ctx,&a[ht[h]],&e)) != 0) goto out;
+    }
+    if (r < 0) goto out;
+  }
+out:
+  free(rd.b); free(a); free(ht);
+  return r;
+}
+
+/*!
+    \brief number of partitions needed for build side of given size
+*/
+static int tj_nparts(off_t size, size_t mem)
+{
+  /* build side entry costs entry and 2 hash table slots */
+  uint64_t need=size/sizeof(TJent)*(sizeof(TJent)+2*sizeof(uint32_t));
+  uint64_t np=need/(mem/2+1)+1;
+  return np > TJ_MAXPART ? TJ_MAXPART : (int)np;
+}
+
+/*!
+    \brief join partition (split it again when it is too big)
+    \param level partitioning level (seed of partitioning hash)
+    \return 0 success, callback result, negative errno
+
+    Partitions are written in passes of at most k partitions, so that
+    all levels together stay within RLIMIT_NOFILE. Partitions of a pass
+    which fit into memory are joined and closed first, before recursion
+    into the others.
+*/
+static int tj_part(int afd, int bfd, size_t mem, const char *tmpdir, tj_joincb cb, void *ctx, int level)
+{
+  struct stat st;
+  struct rlimit rl;
+  TJio *w=NULL;
+  TJent e;
+  int *pf=NULL,np,k,n,p0,i,s,r=0;
+  uint32_t j;
+
+  if (fstat(afd,&st) < 0) return -errno;
+  np=tj_nparts(st.st_size,mem);
+  if (np == 1 || level == TJ_MAXLEVEL) return tj_hjoin(afd,bfd,mem,cb,ctx);
+  k=np;
+  if (getrlimit(RLIMIT_NOFILE,&rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+  {
+    rlim_t f = rl.rlim_cur > TJ_FDRESERVE ? rl.rlim_cur-TJ_FDRESERVE : 0;
+    /* 2 files per partition on every level */
+    f/=2*TJ_MAXLEVEL;
+    if (f < 1) f=1;
+    if ((rlim_t)k > f) k=f;
+  }
+
+  pf=(int*)malloc(2*k*sizeof(int));
+  w=(TJio*)calloc(k,sizeof(TJio));
+  if (pf == NULL || w == NULL) { r=-ENOMEM; goto out; }
+  for (i=0; i < 2*k; i++) pf[i]=-1;
+  for (p0=0; p0 < np && r == 0; p0+=n)
+  {
+    n = np-p0 < k ? np-p0 : k;
+    for (i=0; i < 2*n; i++) if ((pf[i]=tj_tmp(tmpdir)) < 0) { r=pf[i]; goto out; }
+    for (s=0; s < 2; s++)
+    {
+      TJio rd;
+      int fd = s ? bfd : afd;
+      if (lseek(fd,0,SEEK_SET) < 0) { r=-errno; goto out; }
+      for (i=0; i < n; i++)
+        if ((r=tj_open(&w[i],pf[s*n+i],mem/(2*n))) < 0) goto out;
+      if ((r=tj_open(&rd,fd,mem/2)) < 0) goto out;
+      while ((r=tj_get(&rd,&e)) > 0)
+      {
+        j=((uint64_t)tj_hash(&e,level+1)*np)>>32;
+        if (j-p0 < (uint32_t)n && (r=tj_put(&w[j-p0],&e)) < 0) break;
+      }
+      free(rd.b);
+      for (i=0; i < n; i++)
+      {
+        if (r == 0) r=tj_flush(&w[i]);
+        free(w[i].b); w[i].b=NULL;
+      }
+      if (r < 0) goto out;
+    }
+    /* small partitions first, their files are closed before recursion */
+    for (s=0; s < 2; s++)
+      for (i=0; i < n && r == 0; i++)
+      {
+        struct stat ps;
+        if (pf[i] < 0) continue;
+        if (fstat(pf[i],&ps) < 0) { r=-errno; break; }
+        if (s == 0 && tj_nparts(ps.st_size,mem) > 1) continue;
+        /* nothing was split off (equal keys), another level won't help */
+        if (s == 0 || ps.st_size == st.st_size) r=tj_hjoin(pf[i],pf[n+i],mem,cb,ctx);
+        else r=tj_part(pf[i],pf[n+i],mem,tmpdir,cb,ctx,level+1);
+        close(pf[i]); close(pf[n+i]); pf[i]=pf[n+i]=-1;
+      }
+    for (i=0; i < 2*n; i++) if (pf[i] >= 0) { close(pf[i]); pf[i]=-1; }
+  }
+out:
+  if (w) for (i=0; i < k; i++) free(w[i].b);
+  if (pf) for (i=0; i < 2*k; i++) if (pf[i] >= 0) close(pf[i]);
+  free(w); free(pf);
+  return r;
+}
+
+/*!
+    \brief join two index files on equal keys (partitioned hash join)
+    \param afd index file of first archive (build side, should be the smaller one)
+    \param bfd index file of second archive (probe side)
+    \param mem memory limit (bytes)
+    \param tmpdir directory for temporary partition files (NULL for /tmp)
+    \param cb callback called for every matching pair
+    \param ctx callback context
+    \return 0 success, callback result if stopped, negative errno
+*/
+int tj_join(int afd, int bfd, size_t mem, const char *tmpdir, tj_joincb cb, void *ctx)
+{
+  return tj_part(afd,bfd,mem,tmpdir,cb,ctx,0);
+}
@@ -0,0 +1,43 @@
+#ifndef __COMMON_TLVJOIN_H
+#define __COMMON_TLVJOIN_H
+/*!
+	\file
+	\brief External sort and hash join of TLV archives by key tags (header)
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include "tlv.h"
+
+#define TJ_KEYLEN   24      /*!< \brief key bytes kept in index entry */
+#define TJ_MAXTAGS  8       /*!< \brief max number of key tags */
+#define TJ_MAXRUNS  256     /*!< \brief max runs merged at once */
+#define TJ_TRUNC    ((uint64_t)1<<63) /*!< \brief off flag: key longer than TJ_KEYLEN (truncated) */
+
+/*!
+	\struct TJent
+	\brief index entry - key of record and its offset in archive
+
+	Key is concatenation of (length, value) of every key tag,
+	length 0 if tag is missing, padded with zeros.
+*/
+typedef struct
+{
+  uint64_t off;             /*!< \brief record offset in archive (| TJ_TRUNC) */
+  uchar k[TJ_KEYLEN];       /*!< \brief key */
+} TJent;
+
+/*!
+    \brief join callback, called for every pair of entries with equal keys
+    \return 0 continue, otherwise stop join and return this value
+*/
+typedef int (*tj_joincb)(void *ctx, const TJent *a, const TJent *b);
+
+__BEGIN_DECLS
+EXPORT int tj_key(const uchar *b, int l, const ushort *tags, int n, TJent *e);
+EXPORT int64_t tj_index(const uchar *a, size_t alen, const ushort *tags, int n, int fd);
+EXPORT int tj_sort(int ifd, int ofd, size_t mem, const char *tmpdir);
+EXPORT int tj_join(int afd, int bfd, size_t mem, const char *tmpdir, tj_joincb cb, void *ctx);
+__END_DECLS
+
+#endif
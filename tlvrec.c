@@ -0,0 +1,139 @@
+/*!
+	\file
+	\brief Checksummed records of TLV archive
+
+	Every top level TLV (record) of archive is followed by checksum
+	element: tag TR_CRCTAG, length 4, CRC-32C of whole record (tag,
+	length and value) big endian. Archive stays sequence of TLVs, so
+	tools not knowing checksums see one more tag after each record.
+
+	Checking is one pass record by record: structure of record is checked
+	(as tlv_check) and its CRC is computed right after, while the record
+	is still in cache, instead of checking whole archive and reading it
+	again for checksums. It is not fused into the tlv_check walk, which
+	only skips over values while CRC has to read every byte, so even with
+	crc32 instruction it costs noticeably more than tlv_check alone:
+	about 13% for records of ~300 bytes, about 40% for ~70 bytes.
+*/
+
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include "crc32c.h"
+#include "tlvrec.h"
+
+/*!
+    \brief build checksum element of record
+    \param rec record (one TLV)
+    \param l record length
+    \param t output checksum element (TR_TRAILER bytes)
+    \return TR_TRAILER
+*/
+int tr_trailer(const uchar *rec, int l, uchar *t)
+{
+  uint32_t crc=crc32c(0,rec,l);
+  t[0]=TR_CRCTAG>>8; t[1]=TR_CRCTAG&0xff; t[2]=4;
+  t[3]=crc>>24; t[4]=crc>>16; t[5]=crc>>8; t[6]=crc;
+  return TR_TRAILER;
+}
+
+/*!
+    \brief append record with checksum to TLVbuf
+    \param tb TLVbuf (archive)
+    \param rec record (one TLV)
+    \param l record length
+    \return 0 success, -EPIPE TLVbuf too short
+*/
+int tr_add(TLVbuf *tb, const uchar *rec, int l)
+{
+  if (tb->len+l+TR_TRAILER > tb->mlen) return -EPIPE;
+  memmove(tb->buf+tb->len,rec,l);
+  tr_trailer(tb->buf+tb->len,l,tb->buf+tb->len+l);
+  tb->len+=l+TR_TRAILER;
+  return 0;
+}
+
+/*!
+    \brief write record with checksum to file (one writev)
+    \param fd file descriptor
+    \param rec record (one TLV)
+    \param l record length
+    \return 0 success, -errno of writev
+*/
+int tr_write(int fd, const uchar *rec, int l)
+{
+  uchar t[TR_TRAILER];
+  struct iovec v[2];
+  ssize_t r;
+  int i=0;
+
+  tr_trailer(rec,l,t);
+  v[0].iov_base=(void*)rec; v[0].iov_len=l;
+  v[1].iov_base=t; v[1].iov_len=TR_TRAILER;
+  while (i < 2)
+  {
+    if ((r=writev(fd,v+i,2-i)) < 0)
+    {
+      if (errno == EINTR) continue;
+      return -errno;
+    }
+    for (; i < 2 && (size_t)r >= v[i].iov_len; i++) r-=v[i].iov_len;
+    if (i < 2) { v[i].iov_base=(uchar*)v[i].iov_base+r; v[i].iov_len-=r; }
+  }
+  return 0;
+}
+
+/*!
+    \brief get next record and check it (structure and checksum)
+    \param b binary buffer (archive part)
+    \param l binary buffer length
+    \param rec output record (t,l,v of record TLV)
+    \param off output offset of record (first tag byte)
+    \return negative - failure (-EINVAL broken record, -ENOENT missing checksum,
+            -EBADMSG wrong checksum), 0 no more records, bytes to skip to next record
+*/
+int tr_next(const uchar *b, int l, TLV *rec, int *off)
+{
+  const uchar *s=b,*c;
+  int rl;
+  uint32_t crc;
+  ushort t;
+
+  while (l > 0 && *b == 0x00) { b++; l--; }
+  *off=b-s;
+  if (l == 0) return 0;
+  if (tlv_parseTLV(b,l,rec) <= 0) return -EINVAL;
+  rl=rec->v+rec->l-b;
+  /* indefinite length: record ends after end-of-contents */
+  if (b[tlv_tag(b,l,&t)] == LEN_BYTES) rl+=2;
+  if ((tlv_tag0(rec->t)&TAG_CONSTR) && !tlv_check(rec->v,rec->l)) return -EINVAL;
+  c=b+rl;
+  if (l-rl < TR_TRAILER || c[0] != (TR_CRCTAG>>8) || c[1] != (TR_CRCTAG&0xff) || c[2] != 4)
+    return -ENOENT;
+  crc=(uint32_t)c[3]<<24|(uint32_t)c[4]<<16|(uint32_t)c[5]<<8|c[6];
+  if (crc32c(0,b,rl) != crc) return -EBADMSG;
+  return *off+rl+TR_TRAILER;
+}
+
+/*!
+    \brief check archive (structure and checksums of all records)
+    \param b binary buffer (archive)
+    \param l binary buffer length
+    \param off output offset of wrong record (may be NULL)
+    \return negative - failure (see tr_next), number of records
+*/
+int tr_check(const uchar *b, int l, int *off)
+{
+  const uchar *s=b;
+  int n=0,r,o;
+  TLV t;
+  while ((r=tr_next(b,l,&t,&o)) > 0)
+  {
+    b+=r; l-=r;
+    n++;
+  }
+  if (off) *off=b-s+o;
+  return r < 0 ? r : n;
+}
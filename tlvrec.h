@@ -0,0 +1,23 @@
+#ifndef __COMMON_TLVREC_H
+#define __COMMON_TLVREC_H
+/*!
+	\file
+	\brief Checksummed records of TLV archive (header)
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include "tlv.h"
+
+#define TR_CRCTAG   0xdf43  /*!< \brief tag of record checksum (CRC-32C, 4 bytes big endian) */
+#define TR_TRAILER  7       /*!< \brief length of checksum element */
+
+__BEGIN_DECLS
+EXPORT int tr_trailer(const uchar *rec, int l, uchar *t);
+EXPORT int tr_add(TLVbuf *tb, const uchar *rec, int l);
+EXPORT int tr_write(int fd, const uchar *rec, int l);
+EXPORT int tr_check(const uchar *b, int l, int *off);
+EXPORT int tr_next(const uchar *b, int l, TLV *rec, int *off);
+__END_DECLS
+
+#endif
@@ -0,0 +1,163 @@
+/*!
+	\file
+	\brief TLVbuf with one writer and many lock-free readers (sequence lock)
+
+	Writer makes sequence number odd, changes data with usual tb_*
+	functions and makes it even again. Reader takes sequence number,
+	copies what it needs to its own memory and checks that sequence
+	number is the same, otherwise the data was torn by writer and read
+	is repeated. Reader writes nothing shared, so it never delays the
+	writer and doesn't bounce cache lines between readers.
+
+	Readers may see partially changed data, so they must only parse
+	within tb.len (tlv_parseTLV does) and keep nothing but copies.
+	Only one thread may write, several writers need their own lock.
+*/
+
+#include <string.h>
+#include <errno.h>
+#include "tlvseq.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define tsq_relax() __builtin_ia32_pause()
+#else
+#define tsq_relax()
+#endif
+
+/*!
+    \brief initialize TLVseq
+    \param s pointer to TLVseq structure
+    \param buf data buffer
+    \param size data buffer size
+*/
+void tsq_init(TLVseq *s, uchar *buf, ushort size)
+{
+  atomic_init(&s->seq,0);
+  tb_init(&s->tb,buf,size);
+}
+
+/*!
+    \brief begin change of data (writer only)
+    \param s pointer to TLVseq structure
+    \return TLVbuf to change (until tsq_wend)
+*/
+TLVbuf *tsq_wbegin(TLVseq *s)
+{
+  uint32_t q=atomic_load_explicit(&s->seq,memory_order_relaxed);
+  atomic_store_explicit(&s->seq,q+1,memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  return &s->tb;
+}
+
+/*!
+    \brief end change of data (writer only)
+    \param s pointer to TLVseq structure
+*/
+void tsq_wend(TLVseq *s)
+{
+  uint32_t q=atomic_load_explicit(&s->seq,memory_order_relaxed);
+  atomic_store_explicit(&s->seq,q+1,memory_order_release);
+}
+
+/*!
+    \brief add tag (writer only, see tb_add)
+    \param s pointer to TLVseq structure
+    \param tlv pointer to TLV structure to add
+    \param ovr see tb_add
+    \return see tb_add
+*/
+int tsq_add(TLVseq *s, TLV *tlv, uchar ovr)
+{
+  int r=tb_add(tsq_wbegin(s),tlv,ovr);
+  tsq_wend(s);
+  return r;
+}
+
+/*!
+    \brief delete tag (writer only, see tb_del)
+    \param s pointer to TLVseq structure
+    \param tag tag ID
+    \return 1 deleted, 0 not found
+*/
+int tsq_del(TLVseq *s, ushort tag)
+{
+  int r=tb_del(tsq_wbegin(s),tag);
+  tsq_wend(s);
+  return r;
+}
+
+/*!
+    \brief read data consistently (any thread)
+    \param s pointer to TLVseq structure
+    \param cb reader callback (repeated while data is torn)
+    \param ctx callback context
+    \return value returned by callback for consistent data
+*/
+int tsq_read(TLVseq *s, tsq_readcb cb, void *ctx)
+{
+  TLVbuf tb;
+  uint32_t q;
+  int r;
+  for (;;)
+  {
+    while ((q=atomic_load_explicit(&s->seq,memory_order_acquire))&1) tsq_relax();
+    tb.buf=s->tb.buf; tb.mlen=s->tb.mlen;
+    tb.len=*(volatile ushort*)&s->tb.len;
+    if (tb.len > tb.mlen) tb.len=tb.mlen;
+    r=cb(ctx,&tb);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&s->seq,memory_order_relaxed) == q) return r;
+  }
+}
+
+typedef struct
+{
+  ushort tag;
+  uchar *v;
+  int vlen;
+} TLVseqfind;
+
+static int tsq_findcb(void *ctx, const TLVbuf *tb)
+{
+  TLVseqfind *f=(TLVseqfind*)ctx;
+  TLV t;
+  if (!tb_find(tb,f->tag,&t)) return 0;
+  if (t.l > f->vlen) return -ENOSPC;
+  memcpy(f->v,t.v,t.l);
+  return t.l;
+}
+
+/*!
+    \brief find tag and copy its value (any thread)
+    \param s pointer to TLVseq structure
+    \param tag requested tag identifier
+    \param v output value buffer
+    \param vlen value buffer length
+    \return 0 not found (or value is empty), -ENOSPC value buffer too short, value length
+*/
+int tsq_find(TLVseq *s, ushort tag, uchar *v, int vlen)
+{
+  TLVseqfind f;
+  f.tag=tag; f.v=v; f.vlen=vlen;
+  return tsq_read(s,tsq_findcb,&f);
+}
+
+static int tsq_copycb(void *ctx, const TLVbuf *tb)
+{
+  TLVbuf *dst=(TLVbuf*)ctx;
+  if (tb->len > dst->mlen) return -EPIPE;
+  memcpy(dst->buf,tb->buf,tb->len);
+  dst->len=tb->len;
+  return 1;
+}
+
+/*!
+    \brief copy whole data (any thread)
+    \param s pointer to TLVseq structure
+    \param dst output TLVbuf (its content is replaced)
+    \return 1 success, -EPIPE dst too short
+*/
+int tsq_copy(TLVseq *s, TLVbuf *dst)
+{
+  return tsq_read(s,tsq_copycb,dst);
+}
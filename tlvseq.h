@@ -0,0 +1,42 @@
+#ifndef __COMMON_TLVSEQ_H
+#define __COMMON_TLVSEQ_H
+/*!
+	\file
+	\brief TLVbuf with one writer and many lock-free readers (sequence lock) (header)
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "tlv.h"
+
+/*!
+	\struct TLVseq
+	\brief TLVbuf protected by sequence number (odd while being changed)
+*/
+typedef struct
+{
+  _Atomic uint32_t seq;     /*!< \brief sequence number */
+  TLVbuf tb;                /*!< \brief data (changed only by writer) */
+} TLVseq;
+
+/*!
+    \brief reader callback, called on consistent or torn data (then it is called again)
+    \param ctx callback context
+    \param tb data (read only, may change during call)
+    \return value returned by tsq_read() if data was consistent
+*/
+typedef int (*tsq_readcb)(void *ctx, const TLVbuf *tb);
+
+__BEGIN_DECLS
+EXPORT void tsq_init(TLVseq *s, uchar *buf, ushort size);
+EXPORT TLVbuf *tsq_wbegin(TLVseq *s);
+EXPORT void tsq_wend(TLVseq *s);
+EXPORT int tsq_add(TLVseq *s, TLV *tlv, uchar ovr);
+EXPORT int tsq_del(TLVseq *s, ushort tag);
+EXPORT int tsq_read(TLVseq *s, tsq_readcb cb, void *ctx);
+EXPORT int tsq_find(TLVseq *s, ushort tag, uchar *v, int vlen);
+EXPORT int tsq_copy(TLVseq *s, TLVbuf *dst);
+__END_DECLS
+
+#endif
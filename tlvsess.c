@@ -0,0 +1,457 @@
+/*!
+	\file
+	\brief Session store of TLV contexts sharded per CPU
+
+	Sessions (TLVbuf contexts with 64-bit ID) are spread over shards by
+	hash of ID, every shard has its own lock, hash table and memory, so
+	threads working on different shards share no cache lines. Shards are
+	assigned round robin to CPUs the process may run on (its affinity
+	mask, which reflects cpusets and offline CPUs): worker thread pinned
+	to CPU of shard (tss_pin) and receiving only sessions of its shard
+	(tss_shard) takes uncontended lock and touches only memory of its
+	node.
+
+	Session node and its data are one block from allocator of the shard:
+	free lists by power of 2 size class, carved from chunks. With
+	CONFIG_NUMA (libnuma) chunks, tables and shards are allocated on the
+	node of shard CPU. Otherwise placement is left to first touch: shard
+	is zeroed pages not written by tss_init, its table is allocated by
+	the first thread using the shard, which is its worker when tss_pin
+	is called before other use. Blocks are reused within the shard,
+	memory is returned only by tss_free().
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#ifdef CONFIG_NUMA
+#include <numa.h>
+#endif
+#include "tlvsess.h"
+
+#define TSS_MINCLS  6           /* 64 bytes */
+#define TSS_CLASSES 12          /* up to 128kB (node with 65535 bytes) */
+#define TSS_CHUNK   (256*1024)
+#define TSS_MINCAP  64
+#define TSS_LINE    64          /* first line of chunk holds link */
+
+/*!
+	\brief session node, data follow
+*/
+typedef struct TLVsess
+{
+  struct TLVsess *next;         /*!< \brief next in bucket or in free list */
+  uint64_t id;                  /*!< \brief session ID */
+  int cls;                      /*!< \brief size class */
+  TLVbuf tb;                    /*!< \brief context (buf points after node) */
+} TLVsess;
+
+struct TLVshard
+{
+  pthread_mutex_t lock;
+  int node;                     /*!< \brief NUMA node (-1 not known, CONFIG_NUMA only) */
+  unsigned n;                   /*!< \brief number of sessions */
+  unsigned cap;                 /*!< \brief number of buckets (power of 2) */
+  TLVsess **tab;                /*!< \brief buckets (NULL until first use) */
+  TLVsess *free[TSS_CLASSES];   /*!< \brief free nodes by size class */
+  uchar *chunk;                 /*!< \brief chunks (starting with pointer to next one) */
+  size_t used;                  /*!< \brief used bytes of first chunk */
+} __attribute__((aligned(64)));
+
+/*!
+    \brief allocate memory on node
+*/
+static void *tss_nalloc(int node, size_t size)
+{
+  void *p;
+#ifdef CONFIG_NUMA
+  if (node >= 0) return numa_alloc_onnode(size,node);
+#else
+  (void)node;
+#endif
+  return posix_memalign(&p,TSS_LINE,size) == 0 ? p : NULL;
+}
+
+/*!
+    \brief free memory allocated by tss_nalloc()
+*/
+static void tss_nfree(int node, void *p, size_t size)
+{
+#ifdef CONFIG_NUMA
+  if (node >= 0) { numa_free(p,size); return; }
+#else
+  (void)node; (void)size;
+#endif
+  free(p);
+}
+
+/*!
+    \brief allocate zeroed pages on node (not touched, so without
+           CONFIG_NUMA they are placed by first write)
+*/
+static void *tss_palloc(int node, size_t size)
+{
+  void *p;
+#ifdef CONFIG_NUMA
+  if (node >= 0) return numa_alloc_onnode(size,node);
+#else
+  (void)node;
+#endif
+  p=mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+  return p == MAP_FAILED ? NULL : p;
+}
+
+/*!
+    \brief free memory allocated by tss_palloc()
+*/
+static void tss_pfree(int node, void *p, size_t size)
+{
+#ifdef CONFIG_NUMA
+  if (node >= 0) { numa_free(p,size); return; }
+#else
+  (void)node;
+#endif
+  munmap(p,size);
+}
+
+/*!
+    \brief mix bits of ID (murmur3 finalizer)
+*/
+static uint64_t tss_hash(uint64_t x)
+{
+  x^=x>>33; x*=0xff51afd7ed558ccdull;
+  x^=x>>33; x*=0xc4ceb9fe1a85ec53ull;
+  x^=x>>33;
+  return x;
+}
+
+/*!
+    \brief CPUs the process may run on
+    \param cpu output CPU numbers (CPU_SETSIZE entries)
+    \return number of CPUs
+*/
+static int tss_cpus(int *cpu)
+{
+  cpu_set_t set;
+  long n;
+  int i,k=0;
+
+  if (sched_getaffinity(0,sizeof(set),&set) == 0)
+  {
+    for (i=0; i < CPU_SETSIZE; i++)
+      if (CPU_ISSET(i,&set)) cpu[k++]=i;
+    if (k > 0) return k;
+  }
+  /* affinity not known: all online CPUs */
+  if ((n=sysconf(_SC_NPROCESSORS_ONLN)) < 1) n=1;
+  if (n > CPU_SETSIZE) n=CPU_SETSIZE;
+  for (k=0; k < n; k++) cpu[k]=k;
+  return k;
+}
+
+/*!
+    \brief create buckets of shard (shard locked)
+    \return 0 success, -ENOMEM
+*/
+static int tss_table(TLVshard *h)
+{
+  if (h->tab != NULL) return 0;
+  if ((h->tab=(TLVsess**)tss_nalloc(h->node,TSS_MINCAP*sizeof(TLVsess*))) == NULL) return -ENOMEM;
+  memset(h->tab,0,TSS_MINCAP*sizeof(TLVsess*));
+  h->cap=TSS_MINCAP;
+  return 0;
+}
+
+/*!
+    \brief initialize session store
+    \param s pointer to TLVsessions structure
+    \param nshard number of shards (0 - one per CPU of process affinity)
+    \return 0 success, -EINVAL wrong number of shards, -ENOMEM no memory
+
+    Shards are assigned round robin to CPUs of process affinity.
+*/
+int tss_init(TLVsessions *s, int nshard)
+{
+  static const pthread_mutex_t m0=PTHREAD_MUTEX_INITIALIZER;
+  static const pthread_mutex_t z;
+  int cpu[CPU_SETSIZE];
+  TLVshard *h;
+  int i,ncpu,node=-1;
+
+  ncpu=tss_cpus(cpu);
+  if (nshard == 0) nshard = ncpu < TSS_MAXSHARDS ? ncpu : TSS_MAXSHARDS;
+  if (nshard < 0 || nshard > TSS_MAXSHARDS) return -EINVAL;
+#ifdef CONFIG_NUMA
+  if (numa_available() >= 0) node=0;
+#endif
+  s->nshard=0;
+  s->shard=(TLVshard**)calloc(nshard,sizeof(TLVshard*));
+  s->cpu=(int*)malloc(nshard*sizeof(int));
+  if (s->shard == NULL || s->cpu == NULL) { tss_free(s); return -ENOMEM; }
+  for (i=0; i < nshard; i++)
+  {
+    s->cpu[i]=cpu[i%ncpu];
+#ifdef CONFIG_NUMA
+    if (node >= 0 && (node=numa_node_of_cpu(s->cpu[i])) < 0) node=0;
+#endif
+    if ((h=(TLVshard*)tss_palloc(node,sizeof(TLVshard))) == NULL) break;
+    /* pages are zero, without CONFIG_NUMA they are left untouched
+       (unless zero mutex isn't initialized one) */
+#ifdef CONFIG_NUMA
+    h->node=node;
+#endif
+    if (memcmp(&m0,&z,sizeof(z)) != 0) pthread_mutex_init(&h->lock,NULL);
+    s->shard[s->nshard++]=h;
+  }
+  if (i < nshard) { tss_free(s); return -ENOMEM; }
+  return 0;
+}
+
+/*!
+    \brief free session store with all sessions
+    \param s pointer to TLVsessions structure
+*/
+void tss_free(TLVsessions *s)
+{
+  TLVshard *h;
+  uchar *c;
+  int i;
+  for (i=0; i < s->nshard; i++)
+  {
+    h=s->shard[i];
+    while ((c=h->chunk) != NULL)
+    {
+      memcpy(&h->chunk,c,sizeof(uchar*));
+      tss_nfree(h->node,c,TSS_CHUNK);
+    }
+    if (h->tab != NULL) tss_nfree(h->node,h->tab,h->cap*sizeof(TLVsess*));
+    pthread_mutex_destroy(&h->lock);
+    tss_pfree(h->node,h,sizeof(TLVshard));
+  }
+  free(s->shard); free(s->cpu);
+  s->shard=NULL; s->cpu=NULL; s->nshard=0;
+}
+
+/*!
+    \brief get shard of session (route session work to its worker)
+    \param s pointer to TLVsessions structure
+    \param id session ID
+    \return shard index
+*/
+int tss_shard(const TLVsessions *s, uint64_t id)
+{
+  /* high bits select shard, low bits select bucket */
+  return (int)(((tss_hash(id)>>32)*(uint64_t)s->nshard)>>32);
+}
+
+/*!
+    \brief get CPU of shard
+    \param s pointer to TLVsessions structure
+    \param shard shard index
+    \return CPU number
+*/
+int tss_cpu(const TLVsessions *s, int shard)
+{
+  return s->cpu[shard];
+}
+
+/*!
+    \brief pin calling thread to CPU of shard (make it worker of shard)
+    \param s pointer to TLVsessions structure
+    \param shard shard index
+    \return 0 success, -errno failure
+
+    Shard memory not used yet is touched by the pinned thread (first
+    touch places it on node of the CPU).
+*/
+int tss_pin(const TLVsessions *s, int shard)
+{
+  TLVshard *h=s->shard[shard];
+  cpu_set_t set;
+  int r;
+  CPU_ZERO(&set);
+  CPU_SET(s->cpu[shard],&set);
+  if ((r=pthread_setaffinity_np(pthread_self(),sizeof(set),&set)) != 0) return -r;
+  pthread_mutex_lock(&h->lock);
+  r=tss_table(h);
+  pthread_mutex_unlock(&h->lock);
+  return r;
+}
+
+/*!
+    \brief find session node in locked shard
+    \return pointer to link pointing to node (*link NULL if not found)
+*/
+static TLVsess **tss_link(TLVshard *h, uint64_t id)
+{
+  TLVsess **p=&h->tab[tss_hash(id)&(h->cap-1)];
+  while (*p && (*p)->id != id) p=&(*p)->next;
+  return p;
+}
+
+/*!
+    \brief allocate session node from shard memory (shard locked)
+*/
+static TLVsess *tss_node(TLVshard *h, ushort mlen)
+{
+  size_t size=sizeof(TLVsess)+mlen;
+  TLVsess *e;
+  uchar *c;
+  int cls=0;
+
+  while (((size_t)1<<(TSS_MINCLS+cls)) < size) cls++;
+  size=(size_t)1<<(TSS_MINCLS+cls);
+  if ((e=h->free[cls]) != NULL) { h->free[cls]=e->next; return e; }
+  if (h->chunk == NULL || h->used+size > TSS_CHUNK)
+  {
+    if ((c=(uchar*)tss_nalloc(h->node,TSS_CHUNK)) == NULL) return NULL;
+    memcpy(c,&h->chunk,sizeof(uchar*));
+    h->chunk=c; h->used=TSS_LINE;
+  }
+  e=(TLVsess*)(h->chunk+h->used);
+  h->used+=size;
+  e->cls=cls;
+  return e;
+}
+
+/*!
+    \brief double buckets of shard (shard locked)
+*/
+static void tss_grow(TLVshard *h)
+{
+  unsigned cap=2*h->cap,i;
+  TLVsess **tab,*e;
+  if ((tab=(TLVsess**)tss_nalloc(h->node,cap*sizeof(TLVsess*))) == NULL) return;
+  memset(tab,0,cap*sizeof(TLVsess*));
+  for (i=0; i < h->cap; i++)
+  {
+    while ((e=h->tab[i]) != NULL)
+    {
+      h->tab[i]=e->next;
+      e->next=tab[tss_hash(e->id)&(cap-1)];
+      tab[tss_hash(e->id)&(cap-1)]=e;
+    }
+  }
+  tss_nfree(h->node,h->tab,h->cap*sizeof(TLVsess*));
+  h->tab=tab; h->cap=cap;
+}
+
+/*!
+    \brief add empty session
+    \param s pointer to TLVsessions structure
+    \param id session ID
+    \param mlen max data length of session context
+    \return 0 success, -EEXIST session exists, -ENOMEM no memory
+*/
+int tss_add(TLVsessions *s, uint64_t id, ushort mlen)
+{
+  TLVshard *h=s->shard[tss_shard(s,id)];
+  TLVsess **p,*e;
+  int r=0;
+
+  pthread_mutex_lock(&h->lock);
+  if (tss_table(h) < 0) r=-ENOMEM;
+  else if (*(p=tss_link(h,id)) != NULL) r=-EEXIST;
+  else if ((e=tss_node(h,mlen)) == NULL) r=-ENOMEM;
+  else
+  {
+    e->id=id; e->next=NULL;
+    tb_init(&e->tb,(uchar*)(e+1),mlen);
+    *p=e;
+    if (++h->n > h->cap) tss_grow(h);
+  }
+  pthread_mutex_unlock(&h->lock);
+  return r;
+}
+
+/*!
+    \brief delete session
+    \param s pointer to TLVsessions structure
+    \param id session ID
+    \return 1 deleted, 0 not found
+*/
+int tss_del(TLVsessions *s, uint64_t id)
+{
+  TLVshard *h=s->shard[tss_shard(s,id)];
+  TLVsess **p,*e;
+  int r=0;
+
+  pthread_mutex_lock(&h->lock);
+  if (h->tab != NULL && (e=*(p=tss_link(h,id))) != NULL)
+  {
+    *p=e->next;
+    e->next=h->free[e->cls]; h->free[e->cls]=e;
+    h->n--;
+    r=1;
+  }
+  pthread_mutex_unlock(&h->lock);
+  return r;
+}
+
+/*!
+    \brief work on session context (with its shard locked)
+    \param s pointer to TLVsessions structure
+    \param id session ID
+    \param cb session callback
+    \param ctx callback context
+    \return -ENOENT session not found, value returned by callback
+*/
+int tss_with(TLVsessions *s, uint64_t id, tss_cb cb, void *ctx)
+{
+  TLVshard *h=s->shard[tss_shard(s,id)];
+  TLVsess *e;
+  int r=-ENOENT;
+
+  pthread_mutex_lock(&h->lock);
+  if (h->tab != NULL && (e=*tss_link(h,id)) != NULL) r=cb(ctx,id,&e->tb);
+  pthread_mutex_unlock(&h->lock);
+  return r;
+}
+
+/*!
+    \brief walk sessions of shard (shard locked, sessions must not be added or deleted by callback)
+    \param s pointer to TLVsessions structure
+    \param shard shard index
+    \param cb session callback
+    \param ctx callback context
+    \return 0 all walked, value returned by callback which stopped the walk
+*/
+int tss_each(TLVsessions *s, int shard, tss_cb cb, void *ctx)
+{
+  TLVshard *h=s->shard[shard];
+  TLVsess *e;
+  unsigned i;
+  int r=0;
+
+  pthread_mutex_lock(&h->lock);
+  for (i=0; i < h->cap && r == 0; i++)
+    for (e=h->tab[i]; e && r == 0; e=e->next) r=cb(ctx,e->id,&e->tb);
+  pthread_mutex_unlock(&h->lock);
+  return r;
+}
+
+/*!
+    \brief get number of sessions (not atomic over shards)
+    \param s pointer to TLVsessions structure
+    \return number of sessions
+*/
+long tss_count(TLVsessions *s)
+{
+  long n=0;
+  int i;
+  for (i=0; i < s->nshard; i++)
+  {
+    pthread_mutex_lock(&s->shard[i]->lock);
+    n+=s->shard[i]->n;
+    pthread_mutex_unlock(&s->shard[i]->lock);
+  }
+  return n;
+}
@@ -0,0 +1,49 @@
+#ifndef __COMMON_TLVSESS_H
+#define __COMMON_TLVSESS_H
+/*!
+	\file
+	\brief Session store of TLV contexts sharded per CPU (header)
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include "tlv.h"
+
+#define TSS_MAXSHARDS 1024  /*!< \brief max number of shards */
+
+typedef struct TLVshard TLVshard;
+
+/*!
+	\struct TLVsessions
+	\brief session store (shards are private)
+*/
+typedef struct
+{
+  int nshard;               /*!< \brief number of shards */
+  TLVshard **shard;         /*!< \brief shards (each allocated on its node) */
+  int *cpu;                 /*!< \brief CPU of every shard */
+} TLVsessions;
+
+/*!
+    \brief session callback (called with shard locked)
+    \param ctx callback context
+    \param id session ID
+    \param tb session context (may be changed in place, mlen is fixed)
+    \return value returned by tss_with()/tss_each() (tss_each stops on non zero)
+*/
+typedef int (*tss_cb)(void *ctx, uint64_t id, TLVbuf *tb);
+
+__BEGIN_DECLS
+EXPORT int tss_init(TLVsessions *s, int nshard);
+EXPORT void tss_free(TLVsessions *s);
+EXPORT int tss_shard(const TLVsessions *s, uint64_t id);
+EXPORT int tss_cpu(const TLVsessions *s, int shard);
+EXPORT int tss_pin(const TLVsessions *s, int shard);
+EXPORT int tss_add(TLVsessions *s, uint64_t id, ushort mlen);
+EXPORT int tss_del(TLVsessions *s, uint64_t id);
+EXPORT int tss_with(TLVsessions *s, uint64_t id, tss_cb cb, void *ctx);
+EXPORT int tss_each(TLVsessions *s, int shard, tss_cb cb, void *ctx);
+EXPORT long tss_count(TLVsessions *s);
+__END_DECLS
+
+#endif
@@ -0,0 +1,414 @@
+/*!
+	\file
+	\brief Shared memory arena of TLV buffers for passing between processes
+
+	Arena is memfd (passed to other process with SCM_RIGHTS or inherited
+	by fork) mapped by every process at its own address, so nothing in
+	arena is a pointer: buffers are addressed by index and TLVbuf seen by
+	a process is only a view (buf points into its own mapping).
+
+	Arena layout (every part aligned to cache line):
+	  header     - geometry and head of free buffers list
+	  queue[nq]  - bounded lock-free queue of buffer indexes
+	  buffer[nbuf] - next index (free list), length, data (mlen bytes)
+
+	Buffer is owned by process which allocated it (tsh_alloc) or received
+	it (tsh_recv) and ownership is passed with tsh_send, only buffer index
+	goes through the queue. Receiver sleeps on futex in arena when queue
+	is empty, sender wakes it only if somebody is sleeping.
+
+	Free list is Treiber stack with ABA tag, queue is array of cells with
+	sequence numbers (multiple producers and consumers), all of them work
+	across processes as lock-free atomics are address free.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+#include "tlvshm.h"
+
+#define TSH_MAGIC "TLVS"
+#define TSH_LINE 64
+#define TSH_ALIGN(x) (((x)+TSH_LINE-1)&~(size_t)(TSH_LINE-1))
+#define TSH_NONE 0xffffffffu
+
+/*!
+	\brief arena header (read-only after tsh_create, except free)
+*/
+typedef struct
+{
+  char magic[4];
+  uint32_t nbuf;              /*!< \brief number of buffers */
+  uint32_t mlen;              /*!< \brief max data length of buffer */
+  uint32_t stride;            /*!< \brief buffer size (with its header) */
+  uint32_t nq;                /*!< \brief number of queues */
+  uint32_t qlen;              /*!< \brief queue length (power of 2) */
+  uint64_t qoff;              /*!< \brief offset of first queue */
+  uint64_t qstride;           /*!< \brief queue size (with its cells) */
+  uint64_t boff;              /*!< \brief offset of first buffer */
+  uint64_t size;              /*!< \brief arena size */
+  _Atomic uint64_t free;      /*!< \brief free list head: tag<<32 | index (TSH_NONE empty) */
+} TLVshhdr;
+
+/*!
+	\brief queue header, followed by qlen cells
+*/
+typedef struct
+{
+  _Atomic uint32_t tail;      /*!< \brief enqueue position */
+  char pad1[TSH_LINE-4];
+  _Atomic uint32_t head;      /*!< \brief dequeue position */
+  char pad2[TSH_LINE-4];
+  _Atomic uint32_t ev;        /*!< \brief futex word, incremented on every send */
+  _Atomic uint32_t nwait;     /*!< \brief number of sleeping receivers */
+  char pad3[TSH_LINE-8];
+} TLVshq;
+
+typedef struct
+{
+  _Atomic uint32_t seq;       /*!< \brief position for which the cell is ready */
+  uint32_t idx;               /*!< \brief buffer index */
+} TLVshcell;
+
+/*!
+	\brief buffer header, followed by data
+*/
+typedef struct
+{
+  _Atomic uint32_t next;      /*!< \brief next free buffer */
+  uint32_t len;               /*!< \brief data length */
+} TLVshbuf;
+
+#define TSH_HDR(s) ((TLVshhdr*)(s)->base)
+#define TSH_Q(s,h,q) ((TLVshq*)((s)->base+(h)->qoff+(q)*(h)->qstride))
+#define TSH_BUF(s,h,i) ((TLVshbuf*)((s)->base+(h)->boff+(uint64_t)(i)*(h)->stride))
+
+/*!
+    \brief compute arena geometry
+    \return arena size
+*/
+static size_t tsh_layout(TLVshhdr *h, int nbuf, int mlen, int nq, int qlen)
+{
+  h->nbuf=nbuf; h->mlen=mlen; h->nq=nq; h->qlen=qlen;
+  h->stride=(sizeof(TLVshbuf)+mlen+7)&~7u;
+  h->qoff=TSH_ALIGN(sizeof(TLVshhdr));
+  h->qstride=TSH_ALIGN(sizeof(TLVshq)+qlen*sizeof(TLVshcell));
+  h->boff=h->qoff+nq*h->qstride;
+  return h->size=TSH_ALIGN(h->boff+(uint64_t)nbuf*h->stride);
+}
+
+/*!
+    \brief create arena in new memfd and map it
+    \param s pointer to TLVshm structure
+    \param name name of memfd (for debug purposes)
+    \param nbuf number of buffers
+    \param mlen max data length of buffer (max 0xffff)
+    \param nq number of queues (max TSH_MAXQ)
+    \param qlen length of queue (power of 2)
+    \return 0 success, -EINVAL wrong geometry, -ENOSYS not supported, negative errno
+*/
+int tsh_create(TLVshm *s, const char *name, int nbuf, int mlen, int nq, int qlen)
+{
+#ifdef __linux__
+  TLVshhdr g;
+  TLVshq *q;
+  TLVshcell *c;
+  int i,j;
+
+  s->fd=-1; s->base=NULL;
+  if (nbuf <= 0 || mlen <= 0 || mlen > 0xffff ||
+      nq <= 0 || nq > TSH_MAXQ || qlen <= 0 || (qlen&(qlen-1)) != 0)
+    return -EINVAL;
+  memset(&g,0,sizeof(g));
+  s->size=tsh_layout(&g,nbuf,mlen,nq,qlen);
+  if ((s->fd=memfd_create(name,MFD_CLOEXEC|MFD_ALLOW_SEALING)) < 0) return -errno;
+  if (ftruncate(s->fd,s->size) < 0 ||
+      fcntl(s->fd,F_ADD_SEALS,F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_SEAL) < 0 ||
+      (s->base=(uchar*)mmap(NULL,s->size,PROT_READ|PROT_WRITE,MAP_SHARED,s->fd,0)) == MAP_FAILED)
+  {
+    i=-errno;
+    close(s->fd); s->fd=-1; s->base=NULL;
+    return i;
+  }
+  /* new memfd is zeroed */
+  memcpy(TSH_HDR(s),&g,sizeof(g));
+  memcpy(TSH_HDR(s)->magic,TSH_MAGIC,4);
+  for (i=0; i < nq; i++)
+  {
+    q=TSH_Q(s,&g,i); c=(TLVshcell*)(q+1);
+    for (j=0; j < qlen; j++) atomic_init(&c[j].seq,j);
+  }
+  for (i=0; i < nbuf; i++) atomic_init(&TSH_BUF(s,&g,i)->next,i+1 < nbuf ? (uint32_t)i+1 : TSH_NONE);
+  atomic_store(&TSH_HDR(s)->free,0);
+  return 0;
+#else
+  (void)s; (void)name; (void)nbuf; (void)mlen; (void)nq; (void)qlen;
+  return -ENOSYS;
+#endif
+}
+
+/*!
+    \brief map arena created by other process
+    \param s pointer to TLVshm structure
+    \param fd memfd of arena (owned by s after success)
+    \return 0 success, -EINVAL not an arena, negative errno
+*/
+int tsh_attach(TLVshm *s, int fd)
+{
+  TLVshhdr g,*h;
+  struct stat st;
+  int r;
+
+  s->fd=-1; s->base=NULL;
+  if (fstat(fd,&st) < 0) return -errno;
+  if ((size_t)st.st_size < sizeof(TLVshhdr)) return -EINVAL;
+  s->size=st.st_size;
+  s->base=(uchar*)mmap(NULL,s->size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+  if (s->base == MAP_FAILED) { s->base=NULL; return -errno; }
+  /* geometry must be exactly what creator computed */
+  h=TSH_HDR(s);
+  memset(&g,0,sizeof(g));
+  r=memcmp(h->magic,TSH_MAGIC,4) == 0 &&
+    h->nbuf > 0 && h->nbuf < TSH_NONE>>1 && h->mlen > 0 && h->mlen <= 0xffff &&
+    h->nq > 0 && h->nq <= TSH_MAXQ && h->qlen > 0 && (h->qlen&(h->qlen-1)) == 0 &&
+    tsh_layout(&g,h->nbuf,h->mlen,h->nq,h->qlen) == h->size && h->size <= s->size &&
+    g.stride == h->stride && g.qoff == h->qoff && g.qstride == h->qstride && g.boff == h->boff;
+  if (!r)
+  {
+    munmap(s->base,s->size); s->base=NULL;
+    return -EINVAL;
+  }
+  s->fd=fd;
+  return 0;
+}
+
+/*!
+    \brief unmap arena and close its memfd
+    \param s pointer to TLVshm structure
+*/
+void tsh_detach(TLVshm *s)
+{
+  if (s->base) munmap(s->base,s->size);
+  if (s->fd >= 0) close(s->fd);
+  s->base=NULL; s->fd=-1;
+}
+
+/*!
+    \brief make TLVbuf view of buffer
+*/
+static void tsh_view(TLVshm *s, uint32_t i, TLVbuf *tb)
+{
+  TLVshhdr *h=TSH_HDR(s);
+  TLVshbuf *b=TSH_BUF(s,h,i);
+  tb->buf=(uchar*)(b+1);
+  tb->mlen=h->mlen;
+  tb->len=b->len <= h->mlen ? b->len : h->mlen;
+}
+
+/*!
+    \brief get buffer index of TLVbuf view
+    \return buffer index, TSH_NONE if TLVbuf is not view of buffer
+*/
+static uint32_t tsh_index(TLVshm *s, const TLVbuf *tb)
+{
+  TLVshhdr *h=TSH_HDR(s);
+  uint64_t o;
+  if (tb->buf < s->base+h->boff+sizeof(TLVshbuf)) return TSH_NONE;
+  o=tb->buf-(s->base+h->boff+sizeof(TLVshbuf));
+  if (o%h->stride != 0 || o/h->stride >= h->nbuf) return TSH_NONE;
+  return o/h->stride;
+}
+
+/*!
+    \brief allocate buffer from arena
+    \param s pointer to TLVshm structure
+    \param tb output TLVbuf (empty view of buffer)
+    \return 0 success, -ENOSPC no free buffer
+*/
+int tsh_alloc(TLVshm *s, TLVbuf *tb)
+{
+  TLVshhdr *h=TSH_HDR(s);
+  uint64_t o=atomic_load(&h->free),n;
+  uint32_t i;
+  do
+  {
+    if ((i=(uint32_t)o) == TSH_NONE) return -ENOSPC;
+    /* next may be stale when buffer is taken meanwhile, but then tag differs */
+    n=((o>>32)+1)<<32 | atomic_load_explicit(&TSH_BUF(s,h,i)->next,memory_order_relaxed);
+  } while (!atomic_compare_exchange_weak(&h->free,&o,n));
+  TSH_BUF(s,h,i)->len=0;
+  tsh_view(s,i,tb);
+  return 0;
+}
+
+/*!
+    \brief return buffer to arena
+    \param s pointer to TLVshm structure
+    \param tb view of buffer (from tsh_alloc or tsh_recv)
+    \return 0 success, -EINVAL TLVbuf is not from arena
+*/
+int tsh_free(TLVshm *s, const TLVbuf *tb)
+{
+  TLVshhdr *h=TSH_HDR(s);
+  uint64_t o=atomic_load(&h->free),n;
+  uint32_t i;
+  if ((i=tsh_index(s,tb)) == TSH_NONE) return -EINVAL;
+  do
+  {
+    atomic_store_explicit(&TSH_BUF(s,h,i)->next,(uint32_t)o,memory_order_relaxed);
+    n=((o>>32)+1)<<32 | i;
+  } while (!atomic_compare_exchange_weak(&h->free,&o,n));
+  return 0;
+}
+
+/*!
+    \brief put buffer index to queue
+    \return 0 success, -EAGAIN queue full
+*/
+static int tsh_enq(TLVshq *q, uint32_t mask, uint32_t i)
+{
+  TLVshcell *c,*cs=(TLVshcell*)(q+1);
+  uint32_t pos=atomic_load_explicit(&q->tail,memory_order_relaxed);
+  int32_t d;
+  for (;;)
+  {
+    c=&cs[pos&mask];
+    d=(int32_t)(atomic_load_explicit(&c->seq,memory_order_acquire)-pos);
+    if (d == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit(&q->tail,&pos,pos+1,
+          memory_order_relaxed,memory_order_relaxed)) break;
+    }
+    else if (d < 0) return -EAGAIN;
+    else pos=atomic_load_explicit(&q->tail,memory_order_relaxed);
+  }
+  c->idx=i;
+  atomic_store_explicit(&c->seq,pos+1,memory_order_release);
+  return 0;
+}
+
+/*!
+    \brief get buffer index from queue
+    \return buffer index, TSH_NONE queue empty
+*/
+static uint32_t tsh_deq(TLVshq *q, uint32_t mask)
+{
+  TLVshcell *c,*cs=(TLVshcell*)(q+1);
+  uint32_t pos=atomic_load_explicit(&q->head,memory_order_relaxed),i;
+  int32_t d;
+  for (;;)
+  {
+    c=&cs[pos&mask];
+    d=(int32_t)(atomic_load_explicit(&c->seq,memory_order_acquire)-(pos+1));
+    if (d == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit(&q->head,&pos,pos+1,
+          memory_order_relaxed,memory_order_relaxed)) break;
+    }
+    else if (d < 0) return TSH_NONE;
+    else pos=atomic_load_explicit(&q->head,memory_order_relaxed);
+  }
+  i=c->idx;
+  atomic_store_explicit(&c->seq,pos+mask+1,memory_order_release);
+  return i;
+}
+
+/*!
+    \brief sleep until futex word changes from v
+    \param tmo timeout in ms (negative - infinite)
+    \return 0 woken (or word changed), -ETIMEDOUT
+*/
+static int tsh_wait(_Atomic uint32_t *w, uint32_t v, int tmo)
+{
+#ifdef __linux__
+  struct timespec ts,*tp=NULL;
+  if (tmo >= 0) { ts.tv_sec=tmo/1000; ts.tv_nsec=(tmo%1000)*1000000L; tp=&ts; }
+  if (syscall(SYS_futex,w,FUTEX_WAIT,v,tp,NULL,0) < 0 && errno == ETIMEDOUT) return -ETIMEDOUT;
+#else
+  /* no futex: poll */
+  struct timespec ts={0,100000};
+  (void)tmo;
+  if (atomic_load(w) == v) nanosleep(&ts,NULL);
+#endif
+  return 0;
+}
+
+/*!
+    \brief pass buffer to receiver through queue
+    \param s pointer to TLVshm structure
+    \param q queue number
+    \param tb view of buffer (from tsh_alloc or tsh_recv), not used after success
+    \return 0 success, -EAGAIN queue full, -EINVAL TLVbuf is not from arena
+*/
+int tsh_send(TLVshm *s, int q, const TLVbuf *tb)
+{
+  TLVshhdr *h=TSH_HDR(s);
+  TLVshq *qp;
+  uint32_t i;
+  int r;
+  if (q < 0 || (uint32_t)q >= h->nq || (i=tsh_index(s,tb)) == TSH_NONE) return -EINVAL;
+  TSH_BUF(s,h,i)->len=tb->len;
+  qp=TSH_Q(s,h,q);
+  if ((r=tsh_enq(qp,h->qlen-1,i)) < 0) return r;
+  atomic_fetch_add(&qp->ev,1);
+  if (atomic_load(&qp->nwait) > 0)
+  {
+#ifdef __linux__
+    syscall(SYS_futex,&qp->ev,FUTEX_WAKE,1,NULL,NULL,0);
+#endif
+  }
+  return 0;
+}
+
+/*!
+    \brief receive buffer from queue
+    \param s pointer to TLVshm structure
+    \param q queue number
+    \param tb output TLVbuf (view of received buffer)
+    \param tmo timeout in ms (0 - don't wait, negative - infinite)
+    \return 0 success, -EAGAIN queue empty (tmo=0), -ETIMEDOUT, -EINVAL wrong queue
+*/
+int tsh_recv(TLVshm *s, int q, TLVbuf *tb, int tmo)
+{
+  TLVshhdr *h=TSH_HDR(s);
+  TLVshq *qp;
+  uint32_t i,v,mask=h->qlen-1;
+  struct timespec t0,t1;
+  int r=0,left=tmo;
+
+  if (q < 0 || (uint32_t)q >= h->nq) return -EINVAL;
+  qp=TSH_Q(s,h,q);
+  if (tmo > 0) clock_gettime(CLOCK_MONOTONIC,&t0);
+  while ((i=tsh_deq(qp,mask)) == TSH_NONE)
+  {
+    if (tmo == 0 || r == -ETIMEDOUT) return tmo == 0 ? -EAGAIN : r;
+    /* announce sleeping before the last check, so sender can't miss us */
+    atomic_fetch_add(&qp->nwait,1);
+    v=atomic_load(&qp->ev);
+    if ((i=tsh_deq(qp,mask)) == TSH_NONE) r=tsh_wait(&qp->ev,v,left);
+    atomic_fetch_sub(&qp->nwait,1);
+    if (i != TSH_NONE) break;
+    if (tmo > 0)
+    {
+      clock_gettime(CLOCK_MONOTONIC,&t1);
+      left=tmo-((t1.tv_sec-t0.tv_sec)*1000+(t1.tv_nsec-t0.tv_nsec)/1000000);
+      if (left <= 0) r=-ETIMEDOUT;
+    }
+  }
+  if (i >= h->nbuf) return -EINVAL;
+  tsh_view(s,i,tb);
+  return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef __COMMON_TLVSHM_H
+#define __COMMON_TLVSHM_H
+/*!
+	\file
+	\brief Shared memory arena of TLV buffers for passing between processes (header)
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include "tlv.h"
+
+#define TSH_MAXQ    16      /*!< \brief max number of queues in arena */
+
+/*!
+	\struct TLVshm
+	\brief arena as mapped in this process
+*/
+typedef struct
+{
+  int fd;             /*!< \brief memfd of arena */
+  size_t size;        /*!< \brief arena size */
+  uchar *base;        /*!< \brief mapping address (differs between processes) */
+} TLVshm;
+
+__BEGIN_DECLS
+EXPORT int tsh_create(TLVshm *s, const char *name, int nbuf, int mlen, int nq, int qlen);
+EXPORT int tsh_attach(TLVshm *s, int fd);
+EXPORT void tsh_detach(TLVshm *s);
+EXPORT int tsh_alloc(TLVshm *s, TLVbuf *tb);
+EXPORT int tsh_free(TLVshm *s, const TLVbuf *tb);
+EXPORT int tsh_send(TLVshm *s, int q, const TLVbuf *tb);
+EXPORT int tsh_recv(TLVshm *s, int q, TLVbuf *tb, int tmo);
+__END_DECLS
+
+#endif
@@ -0,0 +1,244 @@
+/*!
+	\file
+	\brief Tag frequency statistics over TLV records
+
+	Records are walked iteratively (explicit stack instead of recursion
+	as in priv_printtags()) collecting per tag counts, value length
+	histograms and nesting levels, plus padding and depth statistics.
+	TLVstat is not shared between threads: every thread accumulates
+	its part of corpus and results are joined with ts_merge().
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include "tlvstat.h"
+
+/*!
+    \brief length histogram bucket
+    \param l value length
+    \return bucket index (0 for l=0, otherwise bit length of l)
+*/
+static int ts_bucket(unsigned l)
+{
+  int b=0;
+  while (l) { b++; l>>=1; }
+  return b;
+}
+
+/*!
+    \brief find (or insert) tag in hash table
+    \param st pointer to TLVstat structure
+    \param tag tag ID
+    \return pointer to tag statistics, NULL if no memory
+*/
+static TLVtagstat *ts_tag(TLVstat *st, ushort tag)
+{
+  unsigned i,m=st->cap-1;
+  TLVtagstat *e;
+  if (2*(st->n+1) > st->cap)
+  {
+    TLVstat o=*st;
+    if ((st->tab=(TLVtagstat*)calloc(2*o.cap,sizeof(TLVtagstat))) == NULL)
+      { st->tab=o.tab; return NULL; }
+    st->cap=2*o.cap; m=st->cap-1;
+    for (i=0; i < o.cap; i++)
+    {
+      unsigned h;
+      if (o.tab[i].cnt == 0) continue;
+      for (h=(o.tab[i].tag*40503u)&m; st->tab[h].cnt; h=(h+1)&m) ;
+      st->tab[h]=o.tab[i];
+    }
+    free(o.tab);
+  }
+  for (i=(tag*40503u)&m; ; i=(i+1)&m)
+  {
+    e=&st->tab[i];
+    if (e->cnt == 0) { e->tag=tag; e->lmin=0xffff; st->n++; return e; }
+    if (e->tag == tag) return e;
+  }
+}
+
+/*!
+    \brief initialize statistics accumulator
+    \param st pointer to TLVstat structure
+    \return 0 success, -ENOMEM no memory
+*/
+int ts_init(TLVstat *st)
+{
+  memset(st,0,sizeof(TLVstat));
+  st->cap=64;
+  if ((st->tab=(TLVtagstat*)calloc(st->cap,sizeof(TLVtagstat))) == NULL) return -ENOMEM;
+  return 0;
+}
+
+/*!
+    \brief walk record, collect statistics of its elements
+    \param st pointer to TLVstat structure (NULL only to check record)
+    \param b binary buffer (TLV structured) with record
+    \param l binary buffer length
+    \return max nesting level, -EINVAL broken record, -ENOMEM no memory
+*/
+static int ts_walk(TLVstat *st, const uchar *b, int l)
+{
+  const uchar *sb[TS_MAXDEPTH];
+  int sl[TS_MAXDEPTH];
+  int i,sp=0,maxd=0;
+  const uchar *p;
+  TLVtagstat *e;
+  TLV t;
+
+  for (;;)
+  {
+    for (p=b; p < b+l && *p == 0x00; p++) ;
+    if (st) st->pad+=p-b;
+    while ((i=tlv_parseTLV(b,l,&t)) > 0)
+    {
+      t.v += t.l;
+      l -= t.v - b; b = t.v;
+      t.v -= t.l;
+      if (st)
+      {
+        if ((e=ts_tag(st,t.t)) == NULL) return -ENOMEM;
+        e->cnt++; e->bytes+=t.l;
+        e->lhist[ts_bucket(t.l)]++;
+        if (t.l < e->lmin) e->lmin=t.l;
+        if (t.l > e->lmax) e->lmax=t.l;
+        e->dmask|=(uint64_t)1<<sp;
+        st->elems++; st->depth[sp]++;
+      }
+      if (sp > maxd) maxd=sp;
+      if (tlv_tag0(t.t) & TAG_CONSTR)
+      {
+        if (sp < TS_MAXDEPTH) { sb[sp]=b; sl[sp]=l; sp++; b=t.v; l=t.l; }
+        else if (st) st->deep++;
+      }
+      for (p=b; p < b+l && *p == 0x00; p++) ;
+      if (st) st->pad+=p-b;
+    }
+    if (i < 0) return -EINVAL;
+    if (sp == 0) break;
+    sp--; b=sb[sp]; l=sl[sp];
+  }
+  return maxd;
+}
+
+/*!
+    \brief accumulate statistics of single record
+    \param st pointer to TLVstat structure
+    \param b binary buffer (TLV structured) with record
+    \param l binary buffer length
+    \return 0 success, -EINVAL broken record (counted in errs), -ENOMEM no memory
+
+    Record is checked before it is counted, so broken record changes
+    only errs.
+*/
+int ts_addrec(TLVstat *st, const uchar *b, int l)
+{
+  int d;
+  if (ts_walk(NULL,b,l) < 0) { st->errs++; return -EINVAL; }
+  if ((d=ts_walk(st,b,l)) < 0) return d;
+  st->bytes+=l;
+  st->recs++; st->rdepth[d]++;
+  return 0;
+}
+
+/*!
+    \brief accumulate statistics of stream of records, every top level TLV is single record
+    \param st pointer to TLVstat structure
+    \param b binary buffer with records
+    \param l binary buffer length
+    \return negative failure, otherwise number of records
+*/
+int ts_addrecs(TLVstat *st, const uchar *b, int l)
+{
+  TLV t;
+  int i,n=0;
+  while ((i=tlv_parseTLV(b,l,&t)) > 0)
+  {
+    t.v += t.l;
+    if ((i=ts_addrec(st,b,t.v-b)) == -ENOMEM) return i;
+    l -= t.v - b; b = t.v;
+    n++;
+  }
+  if (i < 0) { st->errs++; return -EINVAL; }
+  return n;
+}
+
+/*!
+    \brief join statistics of other accumulator
+    \param dst accumulator to join into
+    \param src accumulator to join
+    \return 0 success, -ENOMEM no memory
+*/
+int ts_merge(TLVstat *dst, const TLVstat *src)
+{
+  unsigned i;
+  int j;
+  for (i=0; i < src->cap; i++)
+  {
+    const TLVtagstat *s=&src->tab[i];
+    TLVtagstat *d;
+    if (s->cnt == 0) continue;
+    if ((d=ts_tag(dst,s->tag)) == NULL) return -ENOMEM;
+    d->cnt+=s->cnt; d->bytes+=s->bytes; d->dmask|=s->dmask;
+    if (s->lmin < d->lmin) d->lmin=s->lmin;
+    if (s->lmax > d->lmax) d->lmax=s->lmax;
+    for (j=0; j < TS_LBUCKETS; j++) d->lhist[j]+=s->lhist[j];
+  }
+  dst->recs+=src->recs; dst->bytes+=src->bytes; dst->elems+=src->elems;
+  dst->pad+=src->pad; dst->errs+=src->errs; dst->deep+=src->deep;
+  for (j=0; j <= TS_MAXDEPTH; j++)
+    { dst->depth[j]+=src->depth[j]; dst->rdepth[j]+=src->rdepth[j]; }
+  return 0;
+}
+
+static int ts_cmp(const void *a, const void *b)
+{
+  return (int)(*(const TLVtagstat**)a)->tag - (int)(*(const TLVtagstat**)b)->tag;
+}
+
+/*!
+    \brief print statistics report
+    \param st pointer to TLVstat structure
+    \param f output stream
+*/
+void ts_report(const TLVstat *st, FILE *f)
+{
+  const TLVtagstat **v;
+  unsigned i,n=0;
+  int j;
+
+  fprintf(f,"records %llu bytes %llu elements %llu padding %llu errors %llu too-deep %llu\n",
+    (unsigned long long)st->recs,(unsigned long long)st->bytes,(unsigned long long)st->elems,
+    (unsigned long long)st->pad,(unsigned long long)st->errs,(unsigned long long)st->deep);
+  fprintf(f,"depth:");
+  for (j=0; j <= TS_MAXDEPTH; j++)
+    if (st->depth[j]) fprintf(f," %d=%llu/%llu",j,(unsigned long long)st->depth[j],(unsigned long long)st->rdepth[j]);
+  fprintf(f,"\n");
+
+  if ((v=(const TLVtagstat**)malloc(st->n*sizeof(*v))) == NULL) return;
+  for (i=0; i < st->cap; i++) if (st->tab[i].cnt) v[n++]=&st->tab[i];
+  qsort(v,n,sizeof(*v),ts_cmp);
+  for (i=0; i < n; i++)
+  {
+    const TLVtagstat *e=v[i];
+    fprintf(f,"%4x cnt=%llu len=%u..%u avg=%.1f lvl=%llx lens:",e->tag,(unsigned long long)e->cnt,
+      e->lmin,e->lmax,(double)e->bytes/e->cnt,(unsigned long long)e->dmask);
+    for (j=0; j < TS_LBUCKETS; j++)
+      if (e->lhist[j]) fprintf(f," <%u:%llu",1u<<j,(unsigned long long)e->lhist[j]);
+    fprintf(f,"\n");
+  }
+  free(v);
+}
+
+/*!
+    \brief free statistics accumulator
+    \param st pointer to TLVstat structure
+*/
+void ts_free(TLVstat *st)
+{
+  free(st->tab);
+  memset(st,0,sizeof(TLVstat));
+}
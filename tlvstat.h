@@ -0,0 +1,59 @@
+#ifndef __COMMON_TLVSTAT_H
+#define __COMMON_TLVSTAT_H
+/*!
+	\file
+	\brief Tag frequency statistics over TLV records (header)
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "tlv.h"
+
+#define TS_LBUCKETS 17  /*!< \brief length buckets: 0, 1, 2-3, 4-7, ..., 32768-65535 */
+#define TS_MAXDEPTH 16  /*!< \brief max nesting level walked into */
+
+/*!
+	\struct TLVtagstat
+	\brief statistics of single tag
+*/
+typedef struct
+{
+  ushort tag;                   /*!< \brief Tag ID (0 for tags longer than 2 bytes) */
+  ushort lmin;                  /*!< \brief min value length */
+  ushort lmax;                  /*!< \brief max value length */
+  uint64_t cnt;                 /*!< \brief number of occurrences */
+  uint64_t bytes;               /*!< \brief sum of value lengths */
+  uint64_t lhist[TS_LBUCKETS];  /*!< \brief value length histogram */
+  uint64_t dmask;               /*!< \brief bit n set if tag occurs at nesting level n */
+} TLVtagstat;
+
+/*!
+	\struct TLVstat
+	\brief statistics accumulator (one per thread, joined with ts_merge())
+*/
+typedef struct
+{
+  unsigned n;                       /*!< \brief number of distinct tags */
+  unsigned cap;                     /*!< \brief hash table size (power of 2) */
+  TLVtagstat *tab;                  /*!< \brief hash table of tags */
+  uint64_t recs;                    /*!< \brief number of records */
+  uint64_t bytes;                   /*!< \brief number of scanned bytes */
+  uint64_t elems;                   /*!< \brief number of elements */
+  uint64_t pad;                     /*!< \brief number of padding (0x00) bytes */
+  uint64_t errs;                    /*!< \brief number of broken records */
+  uint64_t deep;                    /*!< \brief constructed elements not walked into (too deep) */
+  uint64_t depth[TS_MAXDEPTH+1];    /*!< \brief elements per nesting level */
+  uint64_t rdepth[TS_MAXDEPTH+1];   /*!< \brief records per max nesting level */
+} TLVstat;
+
+__BEGIN_DECLS
+EXPORT int ts_init(TLVstat *st);
+EXPORT int ts_addrec(TLVstat *st, const uchar *b, int l);
+EXPORT int ts_addrecs(TLVstat *st, const uchar *b, int l);
+EXPORT int ts_merge(TLVstat *dst, const TLVstat *src);
+EXPORT void ts_report(const TLVstat *st, FILE *f);
+EXPORT void ts_free(TLVstat *st);
+__END_DECLS
+
+#endif
@@ -0,0 +1,302 @@
+/*!
+	\file
+	\brief Resumable streaming TLV parser
+
+	Parser is fed with stream in parts of any size (split anywhere, also
+	inside of header) and reports events to callback. Unlike tlv_check()
+	and priv_findr() whole position is kept in TLVpstate: stream offset,
+	partial header, stack of open constructed tags with their end
+	offsets. The state can be saved (tp_save) at any time between calls
+	(or when callback stopped feeding) and parsing continued later from
+	the loaded state, feeding stream from s->off.
+
+	Constructed tags of indefinite length end with end-of-contents,
+	0x00 bytes elsewhere are padding.
+
+	For untrusted input the parsing can be limited (tp_limits): nesting,
+	number of tags and bytes abort it with specific error, work limit
+	makes tp_feed return (yield) after given number of work units (tag
+	or TP_UNIT bytes), so it may be called again with the rest of input
+	from a real-time loop. Parsing is not recursive, so neither limit
+	nor input can exhaust the stack.
+*/
+
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include "crc32c.h"
+#include "tlvstrm.h"
+
+#define TP_MAGIC "TLP2"
+
+/*!
+    \brief initialize parser state
+    \param s pointer to TLVpstate structure
+    \param off stream offset of first byte to feed
+*/
+void tp_init(TLVpstate *s, uint64_t off)
+{
+  memset(s,0,sizeof(TLVpstate));
+  s->off=s->recoff=s->start=off;
+}
+
+/*!
+    \brief set limits of parsing
+    \param s pointer to TLVpstate structure
+    \param lim limits (0 fields - no limit)
+*/
+void tp_limits(TLVpstate *s, const TLVplimits *lim)
+{
+  s->lim=*lim;
+}
+
+/*!
+    \brief get header length
+    \param h header bytes
+    \param n number of header bytes
+    \return -EINVAL wrong coding, 0 more bytes needed, header length
+*/
+static int tp_hdrlen(const uchar *h, int n)
+{
+  int i=1;
+  if ((h[0]&TAG_SEQ) == TAG_SEQ)
+  {
+    for (;; i++)
+    {
+      if (i == 5) return -EINVAL;
+      if (i >= n) return 0;
+      if ((h[i]&TAG_NEXT) == 0) break;
+    }
+    i++;
+  }
+  if (i >= n) return 0;
+  if (h[i] == LEN_BYTES) return i+1;
+  if (h[i]&LEN_BYTES)
+  {
+    if ((h[i]&0x7f) > 4) return -EINVAL;
+    return i+1+(h[i]&0x7f);
+  }
+  return i+1;
+}
+
+/*!
+    \brief get end of innermost open tag of definite length
+    \return stream offset, TP_INDEF if there is no such tag
+*/
+static uint64_t tp_limit(const TLVpstate *s)
+{
+  int d;
+  for (d=s->depth-1; d >= 0; d--)
+    if (s->end[d] != TP_INDEF) return s->end[d];
+  return TP_INDEF;
+}
+
+/*!
+    \brief feed parser with next part of stream
+    \param s pointer to TLVpstate structure
+    \param b binary buffer (next part of stream)
+    \param l binary buffer length
+    \param cb event callback (may be NULL)
+    \param ctx callback context
+    \return negative - failure (-EINVAL wrong coding, -ELOOP too deep,
+            -E2BIG too many tags, -EFBIG too many bytes; s->off is after wrong byte),
+            number of consumed bytes (less than l if callback stopped feeding
+            or work limit was reached)
+*/
+int tp_feed(TLVpstate *s, const uchar *b, int l, tp_event cb, void *ctx)
+{
+  const uchar *h=s->hdr;
+  uint64_t e,lim;
+  int64_t w=(int64_t)s->lim.work*TP_UNIT;
+  int i=0,j,k,n,le=l;
+  unsigned maxd=TP_MAXDEPTH;
+  ushort tag;
+
+  if (s->lim.depth && s->lim.depth < maxd) maxd=s->lim.depth;
+  if (s->lim.bytes)
+  {
+    e=s->off-s->start < s->lim.bytes ? s->lim.bytes-(s->off-s->start) : 0;
+    if ((uint64_t)le > e) le=e;
+  }
+
+  for (;;)
+  {
+    /* close finished tags and record */
+    if (s->skip == 0 && s->nh == 0)
+    {
+      while (s->depth > 0 && s->end[s->depth-1] == s->off)
+      {
+        s->depth--;
+        if (cb && cb(ctx,s,TP_END,s->tag[s->depth],NULL,0)) return i;
+      }
+      if (s->depth == 0 && s->inrec)
+      {
+        s->inrec=0; s->nrec++;
+        if (cb && cb(ctx,s,TP_REC,0,NULL,(long)(s->off-s->recoff))) return i;
+      }
+    }
+    if (i == le) break;
+    if (s->lim.work && w <= 0) return i;
+
+    if (s->skip > 0)
+    {
+      n = s->skip < (uint32_t)(le-i) ? (int)s->skip : le-i;
+      if (s->lim.work && n > w) n=w;
+      s->skip-=n; s->off+=n; i+=n; w-=n;
+      if (cb && cb(ctx,s,TP_DATA,s->ptag,b+i-n,n)) return i;
+      continue;
+    }
+
+    lim=tp_limit(s);
+    if (s->off >= lim) { s->off++; return -EINVAL; }
+    if (s->nh == 0 && b[i] == 0x00 && (s->depth == 0 || s->end[s->depth-1] != TP_INDEF))
+      { s->off++; i++; w--; continue; }
+    if (s->nh == 0 && s->depth == 0) s->recoff=s->off;
+    s->hdr[s->nh++]=b[i++]; s->off++;
+
+    /* end-of-contents */
+    if (h[0] == 0x00)
+    {
+      if (s->nh < 2) continue;
+      s->nh=0;
+      if (h[1] != 0x00) return -EINVAL;
+      s->depth--;
+      if (cb && cb(ctx,s,TP_END,s->tag[s->depth],NULL,0)) return i;
+      continue;
+    }
+    if ((k=tp_hdrlen(h,s->nh)) < 0) return k;
+    if (k == 0 || k > s->nh) continue;
+    s->nh=0;
+    if (s->lim.elems && s->nelem >= s->lim.elems) return -E2BIG;
+    s->nelem++; w-=TP_UNIT;
+
+    j=tlv_tag(h,k,&tag);
+    if (h[j] == LEN_BYTES)
+    {
+      if ((h[0]&TAG_CONSTR) == 0) return -EINVAL;
+      e=TP_INDEF;
+    }
+    else if (h[j]&LEN_BYTES)
+    {
+      for (e=0,n=j+1; n < k; n++) e=(e<<8)|h[n];
+      e+=s->off;
+    }
+    else e=s->off+h[j];
+    if (e != TP_INDEF && e > lim) return -EINVAL;
+
+    s->inrec=1;
+    if (h[0]&TAG_CONSTR)
+    {
+      if (s->depth >= maxd) return -ELOOP;
+      s->tag[s->depth]=tag; s->end[s->depth]=e; s->depth++;
+      if (cb && cb(ctx,s,TP_BEGIN,tag,NULL,e == TP_INDEF ? -1 : (long)(e-s->off))) return i;
+    }
+    else
+    {
+      s->ptag=tag; s->skip=e-s->off;
+      if (cb && cb(ctx,s,TP_PRIM,tag,NULL,s->skip)) return i;
+    }
+  }
+  return le < l ? -EFBIG : i;
+}
+
+static void tp_put(uchar *b, uint64_t v, int n)
+{
+  while (n-- > 0) { b[n]=v; v>>=8; }
+}
+
+static uint64_t tp_get(const uchar *b, int n)
+{
+  uint64_t v=0;
+  int i;
+  for (i=0; i < n; i++) v=(v<<8)|b[i];
+  return v;
+}
+
+/*!
+    \brief serialize parser state (byte order independent)
+    \param s pointer to TLVpstate structure
+    \param b output buffer
+    \param l output buffer length (at least TP_STATELEN)
+    \return -ENOSPC buffer too short, TP_STATELEN
+*/
+int tp_save(const TLVpstate *s, uchar *b, int l)
+{
+  uchar *p=b;
+  int d;
+  if (l < TP_STATELEN) return -ENOSPC;
+  memcpy(p,TP_MAGIC,4); p+=4;
+  tp_put(p,s->off,8); p+=8;
+  tp_put(p,s->recoff,8); p+=8;
+  tp_put(p,s->nrec,8); p+=8;
+  tp_put(p,s->skip,4); p+=4;
+  tp_put(p,s->ptag,2); p+=2;
+  *p++=s->inrec;
+  *p++=s->nh;
+  memcpy(p,s->hdr,TP_MAXHDR); p+=TP_MAXHDR;
+  *p++=s->depth;
+  for (d=0; d < TP_MAXDEPTH; d++) { tp_put(p,s->tag[d],2); p+=2; }
+  for (d=0; d < TP_MAXDEPTH; d++) { tp_put(p,s->end[d],8); p+=8; }
+  tp_put(p,s->start,8); p+=8;
+  tp_put(p,s->nelem,8); p+=8;
+  tp_put(p,s->lim.depth,4); p+=4;
+  tp_put(p,s->lim.elems,8); p+=8;
+  tp_put(p,s->lim.bytes,8); p+=8;
+  tp_put(p,s->lim.work,4); p+=4;
+  memset(p,0,b+TP_STATELEN-4-p); p=b+TP_STATELEN-4;
+  tp_put(p,crc32c(0,b,p-b),4);
+  return TP_STATELEN;
+}
+
+/*!
+    \brief load serialized parser state
+    \param s output TLVpstate structure
+    \param b serialized state
+    \param l serialized state length
+    \return -EINVAL not a state, -EBADMSG wrong CRC, TP_STATELEN
+*/
+int tp_load(TLVpstate *s, const uchar *b, int l)
+{
+  const uchar *p=b;
+  int d;
+  if (l < TP_STATELEN || memcmp(p,TP_MAGIC,4) != 0) return -EINVAL;
+  if (crc32c(0,b,TP_STATELEN-4) != tp_get(b+TP_STATELEN-4,4)) return -EBADMSG;
+  p+=4;
+  s->off=tp_get(p,8); p+=8;
+  s->recoff=tp_get(p,8); p+=8;
+  s->nrec=tp_get(p,8); p+=8;
+  s->skip=tp_get(p,4); p+=4;
+  s->ptag=tp_get(p,2); p+=2;
+  s->inrec=*p++;
+  s->nh=*p++;
+  memcpy(s->hdr,p,TP_MAXHDR); p+=TP_MAXHDR;
+  s->depth=*p++;
+  for (d=0; d < TP_MAXDEPTH; d++) { s->tag[d]=tp_get(p,2); p+=2; }
+  for (d=0; d < TP_MAXDEPTH; d++) { s->end[d]=tp_get(p,8); p+=8; }
+  s->start=tp_get(p,8); p+=8;
+  s->nelem=tp_get(p,8); p+=8;
+  s->lim.depth=tp_get(p,4); p+=4;
+  s->lim.elems=tp_get(p,8); p+=8;
+  s->lim.bytes=tp_get(p,8); p+=8;
+  s->lim.work=tp_get(p,4); p+=4;
+  if (s->nh >= TP_MAXHDR || s->depth > TP_MAXDEPTH) return -EINVAL;
+  return TP_STATELEN;
+}
+
+/*!
+    \brief check consistency of binary buffer (TLV structured) with limits
+    \param b pointer to binary buffer to check
+    \param l binary buffer length
+    \param lim limits (NULL - no limits, work limit is not used)
+    \return 1 buffer is consistent, -EPIPE buffer ends inside of tag,
+            negative failure (see tp_feed)
+*/
+int tp_check(const uchar *b, int l, const TLVplimits *lim)
+{
+  TLVpstate s;
+  int r;
+  tp_init(&s,0);
+  if (lim) { tp_limits(&s,lim); s.lim.work=0; }
+  if ((r=tp_feed(&s,b,l,NULL,NULL)) < 0) return r;
+  return s.nh == 0 && s.skip == 0 && s.depth == 0 ? 1 : -EPIPE;
+}
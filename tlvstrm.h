@@ -0,0 +1,79 @@
+#ifndef __COMMON_TLVSTRM_H
+#define __COMMON_TLVSTRM_H
+/*!
+	\file
+	\brief Resumable streaming TLV parser (header)
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include "tlv.h"
+
+#define TP_MAXDEPTH 16      /*!< \brief max nesting of constructed tags */
+#define TP_MAXHDR   10      /*!< \brief max header bytes (tag 5, length 5) */
+#define TP_INDEF    ((uint64_t)-1) /*!< \brief end of constructed tag of indefinite length */
+#define TP_STATELEN 256     /*!< \brief length of serialized state */
+#define TP_UNIT     256     /*!< \brief bytes of value (or padding) counted as one work unit */
+
+#define TP_BEGIN    1       /*!< \brief event: constructed tag begins (l=length or -1 indefinite) */
+#define TP_END      2       /*!< \brief event: constructed tag ends */
+#define TP_PRIM     3       /*!< \brief event: primitive tag begins (l=length) */
+#define TP_DATA     4       /*!< \brief event: part of primitive value (v,l), s->skip bytes follow */
+#define TP_REC      5       /*!< \brief event: top level tag (record) complete (l=record length) */
+
+/*!
+	\struct TLVplimits
+	\brief limits of parsing (0 - no limit)
+*/
+typedef struct
+{
+  uint32_t depth;               /*!< \brief max nesting (-ELOOP) */
+  uint64_t elems;               /*!< \brief max number of tags (-E2BIG) */
+  uint64_t bytes;               /*!< \brief max number of bytes (-EFBIG) */
+  uint32_t work;                /*!< \brief max work units of one tp_feed call, then it yields */
+} TLVplimits;
+
+/*!
+	\struct TLVpstate
+	\brief parser state, all the position is here (none on call stack)
+*/
+typedef struct
+{
+  uint64_t off;                 /*!< \brief stream offset of next byte to feed */
+  uint64_t recoff;              /*!< \brief stream offset of current record */
+  uint64_t nrec;                /*!< \brief number of complete records */
+  uint32_t skip;                /*!< \brief remaining bytes of primitive value */
+  ushort ptag;                  /*!< \brief tag of current primitive */
+  uchar inrec;                  /*!< \brief inside of record */
+  uchar nh;                     /*!< \brief number of partial header bytes */
+  uchar hdr[TP_MAXHDR];         /*!< \brief partial header */
+  uchar depth;                  /*!< \brief number of open constructed tags */
+  ushort tag[TP_MAXDEPTH];      /*!< \brief tags of open constructed tags */
+  uint64_t end[TP_MAXDEPTH];    /*!< \brief stream offsets of their ends (TP_INDEF) */
+  uint64_t start;               /*!< \brief stream offset of first byte */
+  uint64_t nelem;               /*!< \brief number of tags */
+  TLVplimits lim;               /*!< \brief limits */
+} TLVpstate;
+
+/*!
+    \brief parser event callback
+    \param ctx callback context
+    \param s parser state (already updated by event)
+    \param ev event TP_BEGIN..TP_REC
+    \param tag tag ID (0 if tag is longer than 2 bytes)
+    \param v value part (TP_DATA), else NULL
+    \param l see events
+    \return 0 continue, otherwise stop feeding (tp_feed returns consumed bytes)
+*/
+typedef int (*tp_event)(void *ctx, const TLVpstate *s, int ev, ushort tag, const uchar *v, long l);
+
+__BEGIN_DECLS
+EXPORT void tp_init(TLVpstate *s, uint64_t off);
+EXPORT void tp_limits(TLVpstate *s, const TLVplimits *lim);
+EXPORT int tp_feed(TLVpstate *s, const uchar *b, int l, tp_event cb, void *ctx);
+EXPORT int tp_save(const TLVpstate *s, uchar *b, int l);
+EXPORT int tp_load(TLVpstate *s, const uchar *b, int l);
+EXPORT int tp_check(const uchar *b, int l, const TLVplimits *lim);
+__END_DECLS
+
+#endif
@@ -0,0 +1,371 @@
+/*!
+	\file
+	\brief TLV aware archive encoding
+
+	Block of TLV archive is split into separate streams:
+	- tag stream: dictionary index of every element (varint),
+	- length stream: value length delta against previous length
+	  of the same tag (zigzag varint),
+	- raw stream: bytes which do not parse as TLV,
+	- value streams: primitive values, one stream per tag.
+	Constructed values are split recursively (up to TZ_MAXDEPTH).
+	Padding (0x00) and non-minimal length headers are recorded,
+	so decoding reproduces exactly the original bytes.
+
+	Every stream is then compressed separately with the plugged
+	codec (or stored when the codec does not make it smaller).
+
+	Block layout (little endian):
+	  "TLVZ" ver(1) codec(1) ndict(2) len(4)
+	  ndict * { n(1) tag bytes(n) }
+	  (3+ndict) * { rawlen(4) zlen(4) }, zlen==rawlen means stored
+	  stream data
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include "tlvz.h"
+
+#define TZ_PAD   0  /* padding, length stream: number of 0x00 bytes */
+#define TZ_RAW   1  /* unparsed bytes, length stream: number of bytes */
+#define TZ_DICT  2  /* first dictionary tag code */
+
+#define TZ_HASH  (2*TZ_MAXDICT)
+
+typedef struct
+{
+  uchar *b;
+  size_t len,cap;
+} TZbuf;
+
+typedef struct
+{
+  uchar n;            /* tag bytes */
+  uchar t[TZ_MAXTAG]; /* raw tag */
+  ushort pl;          /* previous length */
+} TZtag;
+
+typedef struct
+{
+  TZbuf s[3+TZ_MAXDICT];      /* tags, lens, raw, values */
+  TZtag d[TZ_MAXDICT];
+  ushort h[TZ_HASH];          /* dictionary hash, index+1 */
+  unsigned nd;
+} TZenc;
+
+#define TZ_TAGS 0
+#define TZ_LENS 1
+#define TZ_RAWS 2
+#define TZ_VALS 3
+
+static int tz_put(TZbuf *s, const void *b, size_t l)
+{
+  if (l == 0) return 0;
+  if (s->len+l > s->cap)
+  {
+    size_t cap=s->cap?s->cap:256;
+    void *p;
+    while (cap < s->len+l) cap<<=1;
+    if ((p=realloc(s->b,cap)) == NULL) return -ENOMEM;
+    s->b=(uchar*)p; s->cap=cap;
+  }
+  memcpy(s->b+s->len,b,l);
+  s->len+=l;
+  return 0;
+}
+
+static int tz_putv(TZbuf *s, uint32_t v)
+{
+  uchar b[5];
+  int n=0;
+  while (v >= 0x80) { b[n++]=v|0x80; v>>=7; }
+  b[n++]=v;
+  return tz_put(s,b,n);
+}
+
+static int tz_getv(const uchar **p, const uchar *e, uint32_t *v)
+{
+  const uchar *b=*p;
+  int s;
+  for (*v=0,s=0; b < e && s < 35; s+=7)
+  {
+    *v |= (uint32_t)(*b&0x7f)<<s;
+    if ((*b++&0x80) == 0) { *p=b; return 0; }
+  }
+  return -EINVAL;
+}
+
+static void tz_le(uchar *b, uint32_t v, int n)
+{
+  while (n-- > 0) { *b++=v; v>>=8; }
+}
+
+static uint32_t tz_rdle(const uchar *b, int n)
+{
+  uint32_t v=0;
+  while (n-- > 0) v=(v<<8)|b[n];
+  return v;
+}
+
+/*!
+    \brief first length byte of minimal length coding
+    \param l value length
+    \return length byte
+*/
+static int tz_len0(unsigned l)
+{
+  return l < 0x80 ? l : l <= 0xff ? 0x81 : 0x82;
+}
+
+/*!
+    \brief find or insert raw tag into dictionary
+    \param e encoder
+    \param t raw tag bytes
+    \param n raw tag length
+    \return dictionary index, -1 if dictionary is full
+*/
+static int tz_dict(TZenc *e, const uchar *t, int n)
+{
+  unsigned h=n,i;
+  for (i=0; i < (unsigned)n; i++) h=h*257+t[i];
+  for (h=(h*40503u)%TZ_HASH; e->h[h]; h=(h+1)%TZ_HASH)
+  {
+    TZtag *d=&e->d[e->h[h]-1];
+    if (d->n == n && memcmp(d->t,t,n) == 0) return e->h[h]-1;
+  }
+  if (e->nd == TZ_MAXDICT) return -1;
+  e->d[e->nd].n=n; memcpy(e->d[e->nd].t,t,n);
+  e->h[h]=++e->nd;
+  return e->nd-1;
+}
+
+/*!
+    \brief split binary buffer into streams
+    \param e encoder
+    \param b binary buffer
+    \param l binary buffer length
+    \return 0 success, -ENOMEM no memory
+*/
+static int tz_split(TZenc *e, const uchar *b, int l)
+{
+  const uchar *sb[TZ_MAXDEPTH];
+  int sl[TZ_MAXDEPTH];
+  int i,k,n,sp=0,r=0;
+  uint32_t zz;
+  ushort tag;
+  const uchar *p;
+  TLV t;
+
+  for (;;)
+  {
+    while (l > 0)
+    {
+      for (p=b; p < b+l && *p == 0x00; p++) ;
+      if ((n=p-b) > 0)
+      {
+        r|=tz_putv(&e->s[TZ_TAGS],TZ_PAD); r|=tz_putv(&e->s[TZ_LENS],n);
+        b+=n; l-=n;
+        continue;
+      }
+      k=-1;
+      if ((i=tlv_parseTLV(b,l,&t)) > 0)
+      {
+        n=tlv_tag(b,l,&tag);
+        if (n <= TZ_MAXTAG) k=tz_dict(e,b,n);
+      }
+      if (k < 0)
+      {
+        /* broken or not fitting dictionary: rest of scope or element as raw */
+        n = i > 0 ? t.v+t.l-b : l;
+        r|=tz_putv(&e->s[TZ_TAGS],TZ_RAW); r|=tz_putv(&e->s[TZ_LENS],n);
+        r|=tz_put(&e->s[TZ_RAWS],b,n);
+        b+=n; l-=n;
+        continue;
+      }
+      r|=tz_putv(&e->s[TZ_TAGS],TZ_DICT+k);
+      i=(int)t.l-e->d[k].pl; e->d[k].pl=t.l;
+      zz=((uint32_t)i<<1)^(uint32_t)(i>>31);
+      if (b[n] != tz_len0(t.l))
+        { r|=tz_putv(&e->s[TZ_LENS],(zz<<1)|1); r|=tz_putv(&e->s[TZ_LENS],b[n]); }
+      else r|=tz_putv(&e->s[TZ_LENS],zz<<1);
+
+      t.v += t.l;
+      l -= t.v - b; b = t.v;
+      t.v -= t.l;
+      if ((e->d[k].t[0] & TAG_CONSTR) && sp < TZ_MAXDEPTH)
+        { sb[sp]=b; sl[sp]=l; sp++; b=t.v; l=t.l; }
+      else r|=tz_put(&e->s[TZ_VALS+k],t.v,t.l);
+    }
+    if (r) return -ENOMEM;
+    if (sp == 0) break;
+    sp--; b=sb[sp]; l=sl[sp];
+  }
+  return 0;
+}
+
+/*!
+    \brief encode block of TLV archive
+    \param b binary buffer
+    \param l binary buffer length (max INT_MAX)
+    \param c stream codec (NULL to store streams)
+    \param z output encoded block (allocated, to be freed by caller)
+    \param zlen output encoded block length
+    \return 0 success, negative failure
+*/
+int tz_encode(const uchar *b, size_t l, const TLVzcodec *c, uchar **z, size_t *zlen)
+{
+  TZenc *e;
+  uchar *o,*p;
+  unsigned i,ns;
+  size_t sz;
+  long r=0;
+
+  *z=NULL; *zlen=0;
+  if (l > INT_MAX) return -EFBIG;
+  if ((e=(TZenc*)calloc(1,sizeof(TZenc))) == NULL) return -ENOMEM;
+  if ((r=tz_split(e,b,l)) < 0) goto out;
+
+  ns=TZ_VALS+e->nd;
+  sz=12+8*ns;
+  for (i=0; i < e->nd; i++) sz+=1+e->d[i].n;
+  for (i=0; i < ns; i++) sz+=c ? c->bound(e->s[i].len) : e->s[i].len;
+  if ((o=(uchar*)malloc(sz)) == NULL) { r=-ENOMEM; goto out; }
+
+  memcpy(o,TZ_MAGIC,4); o[4]=TZ_VERSION; o[5]=c?c->id:0;
+  tz_le(o+6,e->nd,2); tz_le(o+8,l,4);
+  for (p=o+12,i=0; i < e->nd; i++)
+    { *p++=e->d[i].n; memcpy(p,e->d[i].t,e->d[i].n); p+=e->d[i].n; }
+  {
+    uchar *h=p;
+    p+=8*ns;
+    for (i=0; i < ns; i++,h+=8)
+    {
+      TZbuf *s=&e->s[i];
+      r = c && s->len > 0 ? c->comp(c->ctx,s->b,s->len,p,o+sz-p) : -1;
+      if (r < 0 || (size_t)r >= s->len) { if (s->len) memcpy(p,s->b,s->len); r=s->len; }
+      tz_le(h,s->len,4); tz_le(h+4,r,4);
+      p+=r;
+    }
+  }
+  *z=o; *zlen=p-o;
+  r=0;
+out:
+  for (i=0; i < TZ_VALS+TZ_MAXDICT; i++) free(e->s[i].b);
+  free(e);
+  return r;
+}
+
+/*!
+    \brief get decoded length of encoded block
+    \param z encoded block
+    \param zlen encoded block length
+    \param l output decoded length
+    \return 0 success, -EINVAL not encoded block
+*/
+int tz_decodedlen(const uchar *z, size_t zlen, size_t *l)
+{
+  if (zlen < 12 || memcmp(z,TZ_MAGIC,4) || z[4] != TZ_VERSION) return -EINVAL;
+  *l=tz_rdle(z+8,4);
+  return 0;
+}
+
+/*!
+    \brief decode block of TLV archive
+    \param z encoded block
+    \param zlen encoded block length
+    \param c stream codec used to encode block (NULL if stored)
+    \param b output buffer
+    \param l output buffer length (see tz_decodedlen())
+    \return 0 success, -EINVAL broken block, -ENOTSUP wrong codec, -ENOSPC buffer too short
+*/
+int tz_decode(const uchar *z, size_t zlen, const TLVzcodec *c, uchar *b, size_t l)
+{
+  const uchar *ze=z+zlen,*p,*h;
+  const uchar **s=NULL,**se=NULL,*dt[TZ_MAXDICT];
+  uchar **tmp=NULL,dn[TZ_MAXDICT];
+  ushort pl[TZ_MAXDICT];
+  size_t ends[TZ_MAXDEPTH],end,pos=0;
+  unsigned nd,ns,i;
+  uint32_t v,n,rl,zl;
+  int sp=0,r=-EINVAL;
+
+  if (tz_decodedlen(z,zlen,&end) < 0) return -EINVAL;
+  if (end > l) return -ENOSPC;
+  nd=tz_rdle(z+6,2); ns=TZ_VALS+nd;
+  if (nd > TZ_MAXDICT) return -EINVAL;
+  for (p=z+12,i=0; i < nd; i++)
+  {
+    if (p >= ze || *p == 0 || *p > TZ_MAXTAG || ze-p < 1+*p) return -EINVAL;
+    dn[i]=*p++; dt[i]=p; p+=dn[i]; pl[i]=0;
+  }
+  if ((size_t)(ze-p) < 8*ns) return -EINVAL;
+  s=(const uchar**)calloc(2*ns,sizeof(uchar*));
+  tmp=(uchar**)calloc(ns,sizeof(uchar*));
+  if (s == NULL || tmp == NULL) { r=-ENOMEM; goto out; }
+  se=s+ns;
+  for (h=p,p+=8*ns,i=0; i < ns; i++,h+=8)
+  {
+    rl=tz_rdle(h,4); zl=tz_rdle(h+4,4);
+    if ((size_t)(ze-p) < zl) goto out;
+    if (zl == rl) s[i]=p;
+    else
+    {
+      if (c == NULL || c->id != z[5]) { r=-ENOTSUP; goto out; }
+      if ((tmp[i]=(uchar*)malloc(rl)) == NULL) { r=-ENOMEM; goto out; }
+      if (c->decomp(c->ctx,p,zl,tmp[i],rl) != (long)rl) goto out;
+      s[i]=tmp[i];
+    }
+    se[i]=s[i]+rl; p+=zl;
+  }
+
+  for (;;)
+  {
+    if (pos == end)
+    {
+      if (sp == 0) break;
+      end=ends[--sp];
+      continue;
+    }
+    if (tz_getv(&s[TZ_TAGS],se[TZ_TAGS],&v) || tz_getv(&s[TZ_LENS],se[TZ_LENS],&n)) goto out;
+    if (v == TZ_PAD)
+    {
+      if (n > end-pos) goto out;
+      memset(b+pos,0,n); pos+=n;
+    }
+    else if (v == TZ_RAW)
+    {
+      if (n > end-pos || n > (size_t)(se[TZ_RAWS]-s[TZ_RAWS])) goto out;
+      memcpy(b+pos,s[TZ_RAWS],n); s[TZ_RAWS]+=n; pos+=n;
+    }
+    else
+    {
+      int k=v-TZ_DICT,d,len0;
+      if (v-TZ_DICT >= nd) goto out;
+      d=(int)(n>>1); d=(d>>1)^-(d&1);
+      if ((unsigned)(pl[k]+d) > 0xffff) goto out;
+      pl[k]+=d;
+      if (n&1) { if (tz_getv(&s[TZ_LENS],se[TZ_LENS],&v) || v > 0x84) goto out; len0=v; }
+      else len0=tz_len0(pl[k]);
+      n = len0&LEN_BYTES ? len0&0x7f : 0;
+      if (end-pos < dn[k]+1+n+(size_t)pl[k]) goto out;
+      memcpy(b+pos,dt[k],dn[k]); pos+=dn[k];
+      b[pos++]=len0;
+      for (i=n; i > 0; i--) b[pos++]=pl[k]>>(8*(i-1));
+      if ((dt[k][0] & TAG_CONSTR) && sp < TZ_MAXDEPTH)
+        { ends[sp++]=end; end=pos+pl[k]; }
+      else
+      {
+        if (pl[k] > se[TZ_VALS+k]-s[TZ_VALS+k]) goto out;
+        memcpy(b+pos,s[TZ_VALS+k],pl[k]); s[TZ_VALS+k]+=pl[k]; pos+=pl[k];
+      }
+    }
+  }
+  r=0;
+out:
+  if (tmp) for (i=0; i < ns; i++) free(tmp[i]);
+  free(tmp); free(s);
+  return r;
+}
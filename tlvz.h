@@ -0,0 +1,37 @@
+#ifndef __COMMON_TLVZ_H
+#define __COMMON_TLVZ_H
+/*!
+	\file
+	\brief TLV aware archive encoding (header)
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include "tlv.h"
+
+#define TZ_MAGIC    "TLVZ"  /*!< \brief encoded block magic */
+#define TZ_VERSION  1       /*!< \brief encoded block version */
+#define TZ_MAXDEPTH 16      /*!< \brief max nesting level split into streams */
+#define TZ_MAXDICT  4096    /*!< \brief max number of distinct tags in dictionary */
+#define TZ_MAXTAG   4       /*!< \brief max tag bytes kept in dictionary */
+
+/*!
+	\struct TLVzcodec
+	\brief stream compressor plugged into encoder/decoder (e.g. zstd, lz4)
+*/
+typedef struct
+{
+  uchar id;                                                       /*!< \brief codec id stored in block (0 reserved for no compression) */
+  size_t (*bound)(size_t slen);                                   /*!< \brief max compressed size */
+  long (*comp)(void *ctx, const uchar *s, size_t slen, uchar *d, size_t dcap);   /*!< \brief compress, return size or negative */
+  long (*decomp)(void *ctx, const uchar *s, size_t slen, uchar *d, size_t dlen); /*!< \brief decompress, return size or negative */
+  void *ctx;                                                      /*!< \brief codec context */
+} TLVzcodec;
+
+__BEGIN_DECLS
+EXPORT int tz_encode(const uchar *b, size_t l, const TLVzcodec *c, uchar **z, size_t *zlen);
+EXPORT int tz_decodedlen(const uchar *z, size_t zlen, size_t *l);
+EXPORT int tz_decode(const uchar *z, size_t zlen, const TLVzcodec *c, uchar *b, size_t l);
+__END_DECLS
+
+#endif